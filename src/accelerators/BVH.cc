@@ -0,0 +1,1297 @@
+#include "accelerators/BVH.h"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+
+#include "core/skirt.h"
+
+#include "core/Morton.h"
+#include "core/Parallel.h"
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+namespace {
+
+constexpr int nBuckets = 12;
+
+// Ranges larger than this are binned and partitioned by several tasks.
+constexpr int parallelChunk = 16 * 1024;
+// Subtrees with more primitives than this are built in their own task.
+constexpr int forkThreshold = 4 * 1024;
+
+struct BVHPrimitiveInfo {
+  BVHPrimitiveInfo() {}
+  BVHPrimitiveInfo(int index, const AABB& bounds)
+      : index(index),
+        bounds(bounds),
+        centroid(0.5f * bounds.minp + 0.5f * bounds.maxp) {}
+
+  int index;
+  AABB bounds;
+  Vector3 centroid;
+};
+
+struct BVHBuildNode {
+  void InitLeaf(int first, int n, const AABB& b) {
+    firstPrimOffset = first;
+    nPrimitives = n;
+    bounds = b;
+    nodeCount = 1;
+  }
+
+  void InitInterior(int axis,
+                    unique_ptr<BVHBuildNode> c0,
+                    unique_ptr<BVHBuildNode> c1) {
+    bounds = Union(c0->bounds, c1->bounds);
+    nodeCount = 1 + c0->nodeCount + c1->nodeCount;
+    children[0] = move(c0);
+    children[1] = move(c1);
+    splitAxis = axis;
+    nPrimitives = 0;
+  }
+
+  AABB bounds;
+  unique_ptr<BVHBuildNode> children[2];
+  int splitAxis = 0;
+  int firstPrimOffset = 0;
+  int nPrimitives = 0;
+  int nodeCount = 0;  // nodes in this subtree, including itself
+};
+
+struct BucketInfo {
+  int count = 0;
+  AABB bounds;
+};
+
+struct RangeBounds {
+  AABB bounds;
+  AABB centroidBounds;
+};
+
+// Splits [start, end) in chunks of parallelChunk and calls f(s, e, &result)
+// for each of them in parallel. Results come back in chunk order, so merging
+// them doesn't depend on scheduling.
+template <typename T, typename F>
+std::vector<T> mapChunks(int start, int end, const F& f) {
+  const int nChunks = max(1, (end - start + parallelChunk - 1) / parallelChunk);
+  std::vector<T> results(nChunks);
+  ParallelFor(
+      [&](int64_t c) {
+        int s = start + c * parallelChunk;
+        int e = min(end, s + parallelChunk);
+        f(s, e, &results[c]);
+      },
+      nChunks);
+  return results;
+}
+
+// Levels of halving by count it takes to get n primitives down to one.
+INLINE int log2Ceil(int n) {
+  return n > 1 ? 32 - __builtin_clz(n - 1) : 0;
+}
+
+// Whether a node at depth with n primitives has to be split by count from
+// now on, so its leaves are no deeper than BVH::maxDepth. A node that isn't
+// can split any way, as its children have fewer primitives.
+INLINE bool tooDeep(int depth, int n) {
+  return depth + log2Ceil(n) >= BVH::maxDepth;
+}
+
+INLINE int bucketOf(const AABB& centroidBounds, int dim, const Vector3& c) {
+  int b = nBuckets * centroidBounds.Offset(c)[dim];
+  return min(b, nBuckets - 1);
+}
+
+// Surface area in double, as in float it overflows for scenes wider than
+// about 1e19 and every SAH cost becomes inf * 0.
+INLINE double surfaceArea(const AABB& b) {
+  const double dx = b.maxp.x - b.minp.x;
+  const double dy = b.maxp.y - b.minp.y;
+  const double dz = b.maxp.z - b.minp.z;
+  return 2 * (dx * dy + dx * dz + dy * dz);
+}
+
+// Cheapest SAH split of info[start, end) between two of the nBuckets buckets
+// of centroids along dim, with the cost of a split relative to intersecting
+// one primitive.
+struct ObjectSplit {
+  int bucket = -1;  // last bucket below the split, -1 when there's none
+  float cost = Infinity;
+  AABB below, above;
+};
+
+ObjectSplit findObjectSplit(const std::vector<BVHPrimitiveInfo>& info,
+                            int start,
+                            int end,
+                            const AABB& bounds,
+                            const AABB& centroidBounds,
+                            int dim) {
+  typedef std::array<BucketInfo, nBuckets> Buckets;
+  Buckets buckets;
+  for (const Buckets& chunk :
+       mapChunks<Buckets>(start, end, [&](int s, int e, Buckets* bs) {
+         for (int i = s; i < e; ++i) {
+           BucketInfo& b =
+               (*bs)[bucketOf(centroidBounds, dim, info[i].centroid)];
+           b.count++;
+           b.bounds = Union(b.bounds, info[i].bounds);
+         }
+       })) {
+    for (int b = 0; b < nBuckets; ++b) {
+      buckets[b].count += chunk[b].count;
+      buckets[b].bounds = Union(buckets[b].bounds, chunk[b].bounds);
+    }
+  }
+
+  // Sweep from both sides to get the SAH cost of splitting after each
+  // bucket.
+  double cost[nBuckets - 1];
+  int countBelow[nBuckets - 1];
+  int countAbove[nBuckets - 1];
+  AABB boundsBelow[nBuckets - 1];
+  AABB boundsAbove[nBuckets - 1];
+
+  AABB b0;
+  int count0 = 0;
+  for (int i = 0; i < nBuckets - 1; ++i) {
+    b0 = Union(b0, buckets[i].bounds);
+    count0 += buckets[i].count;
+    countBelow[i] = count0;
+    boundsBelow[i] = b0;
+    cost[i] = count0 ? count0 * surfaceArea(b0) : 0;
+  }
+
+  AABB b1;
+  int count1 = 0;
+  for (int i = nBuckets - 1; i > 0; --i) {
+    b1 = Union(b1, buckets[i].bounds);
+    count1 += buckets[i].count;
+    countAbove[i - 1] = count1;
+    boundsAbove[i - 1] = b1;
+    if (count1) cost[i - 1] += count1 * surfaceArea(b1);
+  }
+
+  const double area = surfaceArea(bounds);
+  const double invArea = area > 0 ? 1 / area : 0;
+
+  ObjectSplit split;
+  for (int i = 0; i < nBuckets - 1; ++i) {
+    if (countBelow[i] == 0 || countAbove[i] == 0) continue;
+    float c = 1 + cost[i] * invArea;
+    if (c < split.cost) {
+      split.cost = c;
+      split.bucket = i;
+      split.below = boundsBelow[i];
+      split.above = boundsAbove[i];
+    }
+  }
+  return split;
+}
+
+// Stable partition of info[start, end), so the serial and the chunked
+// parallel versions produce the exact same order.
+template <typename P>
+int partitionInfo(std::vector<BVHPrimitiveInfo>& info,
+                  int start,
+                  int end,
+                  const P& pred) {
+  if (end - start <= parallelChunk) {
+    return std::stable_partition(&info[start], &info[end - 1] + 1, pred) -
+           &info[0];
+  }
+
+  std::vector<int> below =
+      mapChunks<int>(start, end, [&](int s, int e, int* count) {
+        *count = 0;
+        for (int i = s; i < e; ++i) *count += pred(info[i]);
+      });
+
+  const int nChunks = below.size();
+  std::vector<int> belowOffset(nChunks), aboveOffset(nChunks);
+  int totalBelow = 0;
+  for (int c = 0; c < nChunks; ++c) {
+    belowOffset[c] = totalBelow;
+    totalBelow += below[c];
+  }
+  for (int c = 0; c < nChunks; ++c) {
+    aboveOffset[c] = totalBelow + c * parallelChunk - belowOffset[c];
+  }
+
+  std::vector<BVHPrimitiveInfo> scratch(end - start);
+  ParallelFor(
+      [&](int64_t c) {
+        int s = start + c * parallelChunk;
+        int e = min(end, s + parallelChunk);
+        int b = belowOffset[c], a = aboveOffset[c];
+        for (int i = s; i < e; ++i) {
+          scratch[pred(info[i]) ? b++ : a++] = info[i];
+        }
+      },
+      nChunks);
+  ParallelFor([&](int64_t i) { info[start + i] = scratch[i]; },
+              end - start,
+              parallelChunk);
+
+  return start + totalBelow;
+}
+
+// Builds the subtree for info[start, end), partitioning that range in place so
+// every leaf ends up owning a contiguous run of it. Big ranges are binned in
+// parallel and big subtrees are forked, but every decision only depends on
+// the input, so the result is the same for any number of threads.
+unique_ptr<BVHBuildNode> recursiveBuild(std::vector<BVHPrimitiveInfo>& info,
+                                        int start,
+                                        int end,
+                                        int maxPrimsInNode,
+                                        int depth) {
+  unique_ptr<BVHBuildNode> node(new BVHBuildNode);
+
+  RangeBounds rb;
+  for (const RangeBounds& r : mapChunks<RangeBounds>(
+           start, end, [&](int s, int e, RangeBounds* r) {
+             for (int i = s; i < e; ++i) {
+               r->bounds = Union(r->bounds, info[i].bounds);
+               r->centroidBounds = Union(r->centroidBounds, info[i].centroid);
+             }
+           })) {
+    rb.bounds = Union(rb.bounds, r.bounds);
+    rb.centroidBounds = Union(rb.centroidBounds, r.centroidBounds);
+  }
+  const AABB& bounds = rb.bounds;
+  const AABB& centroidBounds = rb.centroidBounds;
+
+  const int n = end - start;
+  if (n == 1) {
+    node->InitLeaf(start, n, bounds);
+    return node;
+  }
+
+  const int dim = centroidBounds.LongestDimension();
+
+  int mid = (start + end) / 2;
+  auto splitMedian = [&]() {
+    std::nth_element(&info[start],
+                     &info[mid],
+                     &info[end - 1] + 1,
+                     [dim](const BVHPrimitiveInfo& a,
+                           const BVHPrimitiveInfo& b) {
+                       return a.centroid[dim] < b.centroid[dim];
+                     });
+  };
+  if (centroidBounds.maxp[dim] == centroidBounds.minp[dim]) {
+    // No plane can separate the centroids. Split by count to keep leaves
+    // small.
+    if (n <= maxPrimsInNode) {
+      node->InitLeaf(start, n, bounds);
+      return node;
+    }
+  } else if (n <= 2) {
+    splitMedian();
+  } else if (tooDeep(depth, n)) {
+    if (n <= maxPrimsInNode) {
+      node->InitLeaf(start, n, bounds);
+      return node;
+    }
+    splitMedian();
+  } else {
+    const ObjectSplit split =
+        findObjectSplit(info, start, end, bounds, centroidBounds, dim);
+
+    const float leafCost = n;
+    if (n <= maxPrimsInNode && split.cost >= leafCost) {
+      node->InitLeaf(start, n, bounds);
+      return node;
+    }
+
+    if (split.bucket >= 0) {
+      mid = partitionInfo(info, start, end, [=](const BVHPrimitiveInfo& pi) {
+        return bucketOf(centroidBounds, dim, pi.centroid) <= split.bucket;
+      });
+    } else {
+      // Only when the costs aren't numbers, as the first and last buckets
+      // always hold centroids. Split by count, which always makes progress.
+      splitMedian();
+    }
+  }
+
+  unique_ptr<BVHBuildNode> left, right;
+  if (n > forkThreshold) {
+    TaskGroup group;
+    group.Run([&]() {
+      left = recursiveBuild(info, start, mid, maxPrimsInNode, depth + 1);
+    });
+    right = recursiveBuild(info, mid, end, maxPrimsInNode, depth + 1);
+    group.Wait();
+  } else {
+    left = recursiveBuild(info, start, mid, maxPrimsInNode, depth + 1);
+    right = recursiveBuild(info, mid, end, maxPrimsInNode, depth + 1);
+  }
+  node->InitInterior(dim, move(left), move(right));
+  return node;
+}
+
+constexpr int nSpatialBins = 32;
+
+// Spatial splits are only tried where the children of the best object split
+// overlap by more than this fraction of the surface area of the whole tree.
+constexpr float spatialSplitAlpha = 1e-5f;
+
+struct SpatialBin {
+  AABB bounds;
+  int enter = 0;  // references starting in the bin
+  int exit = 0;   // references ending in the bin
+};
+
+struct SpatialSplit {
+  int dim = 0;
+  int bin = -1;  // last bin left of the plane, -1 when there's no split
+  float cost = Infinity;
+  float plane = 0;
+  AABB left, right;
+  int nLeft = 0, nRight = 0;
+};
+
+/*
+Builds the BVH of a spatial split BVH, after Stich et al., "Spatial Splits in
+Bounding Volume Hierarchies" (2009). Besides partitioning references by
+centroid as recursiveBuild() does, a node can be cut by a plane, with the
+references crossing it clipped to each side. Long diagonal triangles then
+stop stretching the bounds of every node they pass through, at the cost of
+being referenced by more than one leaf.
+
+Triangles of untransformed meshes are clipped exactly, other primitives by
+their bounds. The extra references are limited by a budget that each split
+shares among its children in proportion to their size, so the tree doesn't
+depend on which task runs first.
+*/
+class SpatialSplitBuilder {
+ public:
+  SpatialSplitBuilder(const std::vector<Primitive>& prims,
+                      int maxPrimsInNode,
+                      const AABB& bounds)
+      : maxPrimsInNode(maxPrimsInNode), rootArea(bounds.SurfaceArea()) {
+    meshes.resize(prims.size());
+    triangles.resize(prims.size());
+    ParallelFor(
+        [&](int64_t i) {
+          const Element* e = prims[i].element;
+          if (e->IsInstance() || e->HasTransform()) return;
+          meshes[i] = dynamic_cast<const TriangleMesh*>(e->GetShape());
+          triangles[i] = prims[i].index;
+        },
+        prims.size(),
+        parallelChunk);
+  }
+
+  // Builds over refs, appending to out the references of each leaf, which
+  // point to them by offset into out.
+  unique_ptr<BVHBuildNode> Build(std::vector<BVHPrimitiveInfo>& refs,
+                                 int budget,
+                                 std::vector<BVHPrimitiveInfo>* out,
+                                 int depth = 0) const;
+
+ private:
+  void clip(const BVHPrimitiveInfo& ref,
+            int dim,
+            float plane,
+            AABB* left,
+            AABB* right) const;
+  SpatialSplit findSpatialSplit(const std::vector<BVHPrimitiveInfo>& refs,
+                                const AABB& bounds,
+                                int budget) const;
+  void partition(std::vector<BVHPrimitiveInfo>& refs,
+                 const AABB& bounds,
+                 SpatialSplit split,
+                 std::vector<BVHPrimitiveInfo>* left,
+                 std::vector<BVHPrimitiveInfo>* right) const;
+
+  const int maxPrimsInNode;
+  const float rootArea;
+  // Mesh and triangle of each primitive that is an untransformed triangle.
+  std::vector<const TriangleMesh*> meshes;
+  std::vector<int32_t> triangles;
+};
+
+INLINE int spatialBin(const AABB& bounds, int dim, float x) {
+  const float extent = bounds.maxp[dim] - bounds.minp[dim];
+  int b = nSpatialBins * ((x - bounds.minp[dim]) / extent);
+  return clamp(b, 0, nSpatialBins - 1);
+}
+
+INLINE float spatialPlane(const AABB& bounds, int dim, int bin) {
+  const float extent = bounds.maxp[dim] - bounds.minp[dim];
+  return bounds.minp[dim] + extent * bin / nSpatialBins;
+}
+
+INLINE bool IsEmpty(const AABB& b) {
+  return b.minp.x > b.maxp.x || b.minp.y > b.maxp.y || b.minp.z > b.maxp.z;
+}
+
+// The parts of the reference on each side of the plane, within its bounds.
+void SpatialSplitBuilder::clip(const BVHPrimitiveInfo& ref,
+                               int dim,
+                               float plane,
+                               AABB* left,
+                               AABB* right) const {
+  const TriangleMesh* mesh = meshes[ref.index];
+  if (!mesh) {
+    *left = *right = ref.bounds;
+    left->maxp[dim] = plane;
+    right->minp[dim] = plane;
+    return;
+  }
+
+  const uint32_t* idx = &mesh->indices[3 * triangles[ref.index]];
+  *left = *right = AABB();
+  for (int k = 0; k < 3; ++k) {
+    const Vector3 a = mesh->Position(idx[k]);
+    const Vector3 b = mesh->Position(idx[(k + 1) % 3]);
+    if (a[dim] <= plane) *left = Union(*left, a);
+    if (a[dim] >= plane) *right = Union(*right, a);
+    if ((a[dim] < plane && plane < b[dim]) ||
+        (b[dim] < plane && plane < a[dim])) {
+      Vector3 p = a + (b - a) * ((plane - a[dim]) / (b[dim] - a[dim]));
+      p[dim] = plane;
+      *left = Union(*left, p);
+      *right = Union(*right, p);
+    }
+  }
+  *left = Intersect(*left, ref.bounds);
+  *right = Intersect(*right, ref.bounds);
+}
+
+// Cheapest plane between two of nSpatialBins bins, along any axis, that
+// doesn't reference more than budget primitives twice. Each reference is
+// clipped into every bin it crosses, and counted where it enters and exits.
+SpatialSplit SpatialSplitBuilder::findSpatialSplit(
+    const std::vector<BVHPrimitiveInfo>& refs,
+    const AABB& bounds,
+    int budget) const {
+  typedef std::array<std::array<SpatialBin, nSpatialBins>, 3> Bins;
+  Bins bins;
+  for (const Bins& chunk : mapChunks<Bins>(
+           0, refs.size(), [&](int s, int e, Bins* bs) {
+             for (int dim = 0; dim < 3; ++dim) {
+               if (bounds.maxp[dim] <= bounds.minp[dim]) continue;
+               std::array<SpatialBin, nSpatialBins>& b = (*bs)[dim];
+               for (int i = s; i < e; ++i) {
+                 const BVHPrimitiveInfo& ref = refs[i];
+                 const AABB& rb = ref.bounds;
+                 const int first = spatialBin(bounds, dim, rb.minp[dim]);
+                 const int last = spatialBin(bounds, dim, rb.maxp[dim]);
+                 b[first].enter++;
+                 b[last].exit++;
+                 BVHPrimitiveInfo rest = ref;
+                 for (int j = first; j < last; ++j) {
+                   AABB l;
+                   clip(rest, dim, spatialPlane(bounds, dim, j + 1), &l,
+                        &rest.bounds);
+                   b[j].bounds = Union(b[j].bounds, l);
+                 }
+                 b[last].bounds = Union(b[last].bounds, rest.bounds);
+               }
+             }
+           })) {
+    for (int dim = 0; dim < 3; ++dim) {
+      for (int j = 0; j < nSpatialBins; ++j) {
+        bins[dim][j].bounds = Union(bins[dim][j].bounds, chunk[dim][j].bounds);
+        bins[dim][j].enter += chunk[dim][j].enter;
+        bins[dim][j].exit += chunk[dim][j].exit;
+      }
+    }
+  }
+
+  const double area = surfaceArea(bounds);
+  const double invArea = area > 0 ? 1 / area : 0;
+  const int n = refs.size();
+
+  SpatialSplit split;
+  for (int dim = 0; dim < 3; ++dim) {
+    if (bounds.maxp[dim] <= bounds.minp[dim]) continue;
+    const std::array<SpatialBin, nSpatialBins>& b = bins[dim];
+
+    AABB rightBounds[nSpatialBins];
+    int rightCount[nSpatialBins];
+    AABB r;
+    int nr = 0;
+    for (int j = nSpatialBins - 1; j > 0; --j) {
+      r = Union(r, b[j].bounds);
+      nr += b[j].exit;
+      rightBounds[j] = r;
+      rightCount[j] = nr;
+    }
+
+    AABB l;
+    int nl = 0;
+    for (int j = 0; j < nSpatialBins - 1; ++j) {
+      l = Union(l, b[j].bounds);
+      nl += b[j].enter;
+      nr = rightCount[j + 1];
+      if (nl == 0 || nr == 0 || nl + nr - n > budget) continue;
+      const float c = 1 + (nl * surfaceArea(l) +
+                           nr * surfaceArea(rightBounds[j + 1])) *
+                              invArea;
+      if (c < split.cost) {
+        split.dim = dim;
+        split.bin = j;
+        split.cost = c;
+        split.plane = spatialPlane(bounds, dim, j + 1);
+        split.left = l;
+        split.right = rightBounds[j + 1];
+        split.nLeft = nl;
+        split.nRight = nr;
+      }
+    }
+  }
+  return split;
+}
+
+// Sends each reference to the side of the plane it is on. Those crossing it
+// are clipped to both sides, unless moving them whole to one side costs less,
+// which saves a duplicate ("reference unsplitting").
+void SpatialSplitBuilder::partition(
+    std::vector<BVHPrimitiveInfo>& refs,
+    const AABB& bounds,
+    SpatialSplit split,
+    std::vector<BVHPrimitiveInfo>* left,
+    std::vector<BVHPrimitiveInfo>* right) const {
+  const int dim = split.dim;
+  for (const BVHPrimitiveInfo& ref : refs) {
+    const int first = spatialBin(bounds, dim, ref.bounds.minp[dim]);
+    const int last = spatialBin(bounds, dim, ref.bounds.maxp[dim]);
+    if (last <= split.bin) {
+      left->push_back(ref);
+      continue;
+    }
+    if (first > split.bin) {
+      right->push_back(ref);
+      continue;
+    }
+
+    const float areaL = split.left.SurfaceArea();
+    const float areaR = split.right.SurfaceArea();
+    const AABB allL = Union(split.left, ref.bounds);
+    const AABB allR = Union(split.right, ref.bounds);
+    const float costSplit = areaL * split.nLeft + areaR * split.nRight;
+    const float costL = allL.SurfaceArea() * split.nLeft +
+                        areaR * (split.nRight - 1);
+    const float costR = areaL * (split.nLeft - 1) +
+                        allR.SurfaceArea() * split.nRight;
+
+    if (costL < costSplit && costL <= costR) {
+      left->push_back(ref);
+      split.left = allL;
+      split.nRight--;
+    } else if (costR < costSplit) {
+      right->push_back(ref);
+      split.right = allR;
+      split.nLeft--;
+    } else {
+      AABB l, r;
+      clip(ref, dim, split.plane, &l, &r);
+      if (!IsEmpty(l)) left->push_back(BVHPrimitiveInfo(ref.index, l));
+      if (!IsEmpty(r)) right->push_back(BVHPrimitiveInfo(ref.index, r));
+    }
+  }
+}
+
+unique_ptr<BVHBuildNode> SpatialSplitBuilder::Build(
+    std::vector<BVHPrimitiveInfo>& refs,
+    int budget,
+    std::vector<BVHPrimitiveInfo>* out,
+    int depth) const {
+  unique_ptr<BVHBuildNode> node(new BVHBuildNode);
+  const int n = refs.size();
+
+  RangeBounds rb;
+  for (const RangeBounds& r :
+       mapChunks<RangeBounds>(0, n, [&](int s, int e, RangeBounds* r) {
+         for (int i = s; i < e; ++i) {
+           r->bounds = Union(r->bounds, refs[i].bounds);
+           r->centroidBounds = Union(r->centroidBounds, refs[i].centroid);
+         }
+       })) {
+    rb.bounds = Union(rb.bounds, r.bounds);
+    rb.centroidBounds = Union(rb.centroidBounds, r.centroidBounds);
+  }
+  const AABB& bounds = rb.bounds;
+  const AABB& centroidBounds = rb.centroidBounds;
+
+  auto leaf = [&]() {
+    node->InitLeaf(out->size(), n, bounds);
+    out->insert(out->end(), refs.begin(), refs.end());
+    return move(node);
+  };
+  if (n == 1) return leaf();
+
+  const int dim = centroidBounds.LongestDimension();
+  // A split never gives a child more references than its parent has, so
+  // only splits by count are needed to stay within BVH::maxDepth.
+  const bool deep = tooDeep(depth, n);
+  ObjectSplit object;
+  if (!deep && centroidBounds.maxp[dim] > centroidBounds.minp[dim]) {
+    object = findObjectSplit(refs, 0, n, bounds, centroidBounds, dim);
+  }
+
+  SpatialSplit spatial;
+  const bool overlap = object.bucket < 0 ||
+                       (Overlaps(object.below, object.above) &&
+                        Intersect(object.below, object.above).SurfaceArea() >
+                            spatialSplitAlpha * rootArea);
+  if (!deep && budget > 0 && overlap) {
+    spatial = findSpatialSplit(refs, bounds, budget);
+  }
+
+  const float leafCost = n;
+  if (n <= maxPrimsInNode && min(object.cost, spatial.cost) >= leafCost) {
+    return leaf();
+  }
+
+  std::vector<BVHPrimitiveInfo> left, right;
+  int axis = dim;
+  if (spatial.cost < object.cost) {
+    partition(refs, bounds, spatial, &left, &right);
+    axis = spatial.dim;
+  }
+  if (left.empty() || right.empty()) {
+    left.clear();
+    right.clear();
+    axis = dim;
+    if (object.bucket >= 0) {
+      for (const BVHPrimitiveInfo& ref : refs) {
+        const bool below =
+            bucketOf(centroidBounds, dim, ref.centroid) <= object.bucket;
+        (below ? left : right).push_back(ref);
+      }
+    } else {
+      // Too deep, or no plane can separate the centroids. Split by count.
+      std::nth_element(refs.begin(),
+                       refs.begin() + n / 2,
+                       refs.end(),
+                       [dim](const BVHPrimitiveInfo& a,
+                             const BVHPrimitiveInfo& b) {
+                         return a.centroid[dim] < b.centroid[dim];
+                       });
+      left.assign(refs.begin(), refs.begin() + n / 2);
+      right.assign(refs.begin() + n / 2, refs.end());
+    }
+  }
+  std::vector<BVHPrimitiveInfo>().swap(refs);
+
+  const int nl = left.size(), nr = right.size();
+  const int remaining = max(0, budget - (nl + nr - n));
+  const int budgetL = int64_t(remaining) * nl / (nl + nr);
+  const int budgetR = remaining - budgetL;
+
+  unique_ptr<BVHBuildNode> c0, c1;
+  if (n > forkThreshold) {
+    // The right subtree writes its leaves apart, to be moved after the left
+    // ones.
+    std::vector<BVHPrimitiveInfo> outR;
+    TaskGroup group;
+    group.Run([&]() { c0 = Build(left, budgetL, out, depth + 1); });
+    c1 = Build(right, budgetR, &outR, depth + 1);
+    group.Wait();
+
+    const int offset = out->size();
+    std::function<void(BVHBuildNode*)> shift = [&](BVHBuildNode* b) {
+      if (b->nPrimitives > 0) {
+        b->firstPrimOffset += offset;
+        return;
+      }
+      shift(b->children[0].get());
+      shift(b->children[1].get());
+    };
+    shift(c1.get());
+    out->insert(out->end(), outR.begin(), outR.end());
+  } else {
+    c0 = Build(left, budgetL, out, depth + 1);
+    c1 = Build(right, budgetR, out, depth + 1);
+  }
+  node->InitInterior(axis, move(c0), move(c1));
+  return node;
+}
+
+struct MortonPrimitive {
+  int index;
+  uint32_t mortonCode;
+};
+
+// LSD radix sort on the 30 bits of the Morton codes, stable, 6 bits a pass.
+void RadixSort(std::vector<MortonPrimitive>* v) {
+  std::vector<MortonPrimitive> tempVector(v->size());
+  constexpr int bitsPerPass = 6;
+  constexpr int nBits = 30;
+  constexpr int nPasses = nBits / bitsPerPass;
+  constexpr int nBins = 1 << bitsPerPass;
+  constexpr int bitMask = nBins - 1;
+
+  for (int pass = 0; pass < nPasses; ++pass) {
+    const int lowBit = pass * bitsPerPass;
+    std::vector<MortonPrimitive>& in = (pass & 1) ? tempVector : *v;
+    std::vector<MortonPrimitive>& out = (pass & 1) ? *v : tempVector;
+
+    int binCount[nBins] = {0};
+    for (const MortonPrimitive& mp : in) {
+      binCount[(mp.mortonCode >> lowBit) & bitMask]++;
+    }
+
+    int outIndex[nBins];
+    outIndex[0] = 0;
+    for (int i = 1; i < nBins; ++i) {
+      outIndex[i] = outIndex[i - 1] + binCount[i - 1];
+    }
+
+    for (const MortonPrimitive& mp : in) {
+      out[outIndex[(mp.mortonCode >> lowBit) & bitMask]++] = mp;
+    }
+  }
+
+  if (nPasses & 1) std::swap(*v, tempVector);
+}
+
+// Builds the subtree for the Morton sorted range [start, end), splitting
+// where the code first differs at or below bitIndex. Each primitive is only
+// looked at a constant number of times per level of bits, so the whole build
+// is linear.
+unique_ptr<BVHBuildNode> emitLBVH(const std::vector<BVHPrimitiveInfo>& info,
+                                  const std::vector<MortonPrimitive>& morton,
+                                  int start,
+                                  int end,
+                                  int bitIndex,
+                                  int maxPrimsInNode) {
+  const int n = end - start;
+  if (n <= maxPrimsInNode || bitIndex == -1) {
+    if (n <= maxPrimsInNode) {
+      unique_ptr<BVHBuildNode> node(new BVHBuildNode);
+      AABB bounds;
+      for (int i = start; i < end; ++i) bounds = Union(bounds, info[i].bounds);
+      node->InitLeaf(start, n, bounds);
+      return node;
+    }
+
+    // Identical codes. Split by count to keep leaves small.
+    int mid = (start + end) / 2;
+    unique_ptr<BVHBuildNode> node(new BVHBuildNode);
+    node->InitInterior(
+        0,
+        emitLBVH(info, morton, start, mid, -1, maxPrimsInNode),
+        emitLBVH(info, morton, mid, end, -1, maxPrimsInNode));
+    return node;
+  }
+
+  const uint32_t mask = 1 << bitIndex;
+  if ((morton[start].mortonCode & mask) ==
+      (morton[end - 1].mortonCode & mask)) {
+    return emitLBVH(info, morton, start, end, bitIndex - 1, maxPrimsInNode);
+  }
+
+  // Binary search for the first code with the bit set.
+  int lo = start, hi = end - 1;
+  while (lo + 1 != hi) {
+    int m = (lo + hi) / 2;
+    if ((morton[lo].mortonCode & mask) == (morton[m].mortonCode & mask)) {
+      lo = m;
+    } else {
+      hi = m;
+    }
+  }
+  const int split = hi;
+
+  unique_ptr<BVHBuildNode> left, right;
+  if (n > forkThreshold) {
+    TaskGroup group;
+    group.Run([&]() {
+      left = emitLBVH(
+          info, morton, start, split, bitIndex - 1, maxPrimsInNode);
+    });
+    right =
+        emitLBVH(info, morton, split, end, bitIndex - 1, maxPrimsInNode);
+    group.Wait();
+  } else {
+    left =
+        emitLBVH(info, morton, start, split, bitIndex - 1, maxPrimsInNode);
+    right = emitLBVH(info, morton, split, end, bitIndex - 1, maxPrimsInNode);
+  }
+
+  unique_ptr<BVHBuildNode> node(new BVHBuildNode);
+  node->InitInterior(bitIndex % 3, move(left), move(right));
+  return node;
+}
+
+// Sorts info by the Morton code of the centroids inside the centroid bounds
+// and emits the hierarchy straight from the code bits. Each of the 30 bits
+// adds at most a level, and splitting identical codes by count at most 31
+// more, so the tree is never deeper than BVH::maxDepth.
+unique_ptr<BVHBuildNode> buildLBVH(std::vector<BVHPrimitiveInfo>& info,
+                                   int maxPrimsInNode) {
+  const int n = info.size();
+
+  AABB centroidBounds;
+  for (const AABB& b : mapChunks<AABB>(0, n, [&](int s, int e, AABB* b) {
+         for (int i = s; i < e; ++i) *b = Union(*b, info[i].centroid);
+       })) {
+    centroidBounds = Union(centroidBounds, b);
+  }
+
+  std::vector<MortonPrimitive> morton(n);
+  ParallelFor(
+      [&](int64_t i) {
+        constexpr int mortonBits = 10;
+        constexpr float mortonScale = 1 << mortonBits;
+        Vector3 v = centroidBounds.Offset(info[i].centroid) * mortonScale;
+        morton[i].index = i;
+        morton[i].mortonCode = EncodeMorton3(v);
+      },
+      n,
+      parallelChunk);
+
+  RadixSort(&morton);
+
+  std::vector<BVHPrimitiveInfo> sorted(n);
+  ParallelFor([&](int64_t i) { sorted[i] = info[morton[i].index]; },
+              n,
+              parallelChunk);
+  info.swap(sorted);
+
+  static_assert(30 + 31 <= BVH::maxDepth, "LBVH trees fit the stack");
+  return emitLBVH(info, morton, 0, n, 29, maxPrimsInNode);
+}
+
+// Writes the subtree at nodes[offset]. Subtree sizes are known from the
+// build, so both children can be written at the same time.
+void flattenBVHTree(const BVHBuildNode* node,
+                    std::vector<LinearBVHNode>& nodes,
+                    int offset) {
+  LinearBVHNode* linear = &nodes[offset];
+  linear->bounds = node->bounds;
+  if (node->nPrimitives > 0) {
+    linear->primitivesOffset = node->firstPrimOffset;
+    linear->nPrimitives = node->nPrimitives;
+    return;
+  }
+
+  linear->axis = node->splitAxis;
+  linear->nPrimitives = 0;
+  linear->secondChildOffset = offset + 1 + node->children[0]->nodeCount;
+
+  if (node->nodeCount > forkThreshold) {
+    TaskGroup group;
+    group.Run([&]() {
+      flattenBVHTree(node->children[0].get(), nodes, offset + 1);
+    });
+    flattenBVHTree(
+        node->children[1].get(), nodes, linear->secondChildOffset);
+    group.Wait();
+  } else {
+    flattenBVHTree(node->children[0].get(), nodes, offset + 1);
+    flattenBVHTree(
+        node->children[1].get(), nodes, linear->secondChildOffset);
+  }
+}
+
+}  // namespace
+
+BVH::BVH(const std::vector<shared_ptr<Element>>& elements,
+         int maxPrimsInNode,
+         SplitMethod splitMethod,
+         float duplicationBudget)
+    : maxPrimsInNode(min(255, maxPrimsInNode)),
+      splitMethod(splitMethod),
+      elements(elements) {
+  CHECK_GT(maxPrimsInNode, 0);
+
+  std::vector<int64_t> firstPrim(elements.size() + 1, 0);
+  for (size_t i = 0; i < elements.size(); ++i) {
+    firstPrim[i + 1] = firstPrim[i] + elements[i]->PrimitiveCount();
+  }
+  CHECK_LE(firstPrim.back(), std::numeric_limits<int32_t>::max());
+  if (firstPrim.back() == 0) return;
+
+  std::vector<Primitive> prims(firstPrim.back());
+  ParallelFor(
+      [&](int64_t i) {
+        for (int64_t j = firstPrim[i]; j < firstPrim[i + 1]; ++j) {
+          prims[j] = Primitive(elements[i].get(), j - firstPrim[i]);
+        }
+      },
+      elements.size(),
+      parallelChunk);
+
+  std::vector<BVHPrimitiveInfo> info(prims.size());
+  ParallelFor(
+      [&](int64_t i) { info[i] = BVHPrimitiveInfo(i, prims[i].Bound()); },
+      prims.size(),
+      parallelChunk);
+
+  unique_ptr<BVHBuildNode> root;
+  if (splitMethod == SplitMethod::LBVH) {
+    root = buildLBVH(info, this->maxPrimsInNode);
+  } else if (splitMethod == SplitMethod::SBVH) {
+    AABB bounds;
+    for (const BVHPrimitiveInfo& i : info) bounds = Union(bounds, i.bounds);
+    const int budget =
+        min<double>(std::numeric_limits<int32_t>::max() - info.size(),
+                    max(0.0f, duplicationBudget) * info.size());
+    SpatialSplitBuilder builder(prims, this->maxPrimsInNode, bounds);
+    std::vector<BVHPrimitiveInfo> refs;
+    root = builder.Build(info, budget, &refs);
+    info = move(refs);
+  } else {
+    root = recursiveBuild(info, 0, info.size(), this->maxPrimsInNode, 0);
+  }
+
+  // Spatial splits can reference a primitive from more than one leaf.
+  primitives.resize(info.size());
+  ParallelFor([&](int64_t i) { primitives[i] = prims[info[i].index]; },
+              info.size(),
+              parallelChunk);
+
+  std::vector<LinearBVHNode> flat(root->nodeCount);
+  flattenBVHTree(root.get(), flat, 0);
+  nodes = move(flat);
+
+  DVLOG(1) << "BVH created with " << nodes.size() << " nodes for "
+           << primitives.size() << " references to " << prims.size()
+           << " primitives of " << elements.size() << " elements";
+}
+
+BVH::BVH(const std::vector<shared_ptr<Element>>& elements,
+         int maxPrimsInNode,
+         SplitMethod splitMethod,
+         std::vector<Primitive>&& primitives,
+         Buffer<LinearBVHNode>&& nodes)
+    : maxPrimsInNode(maxPrimsInNode),
+      splitMethod(splitMethod),
+      elements(elements),
+      primitives(move(primitives)),
+      nodes(move(nodes)) {}
+
+const AABB BVH::Bound() const {
+  return nodes.empty() ? AABB() : nodes[0].bounds;
+}
+
+optional<Hit> BVH::Intersect(const Ray& r) const {
+  if (nodes.empty()) return nullopt;
+  const LinearBVHNode* nodes = this->nodes.data();
+
+  TraversalRay ray(r);
+  optional<Hit> hit;
+
+  int toVisitOffset = 0, currentNodeIndex = 0;
+  int nodesToVisit[maxDepth];
+  while (true) {
+    const LinearBVHNode* node = &nodes[currentNodeIndex];
+    if (node->bounds.IntersectP(ray)) {
+      if (node->nPrimitives > 0) {
+        for (int i = 0; i < node->nPrimitives; ++i) {
+          const Primitive& p = primitives[node->primitivesOffset + i];
+          optional<Hit> h = p.Intersect(ray);
+          if (h) {
+            ray.maxT = h->t;
+            hit = h;
+          }
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+      } else {
+        // Visit the near child first, so the far one can be culled by the
+        // closest hit found so far.
+        DCHECK_LT(toVisitOffset, maxDepth);
+        if (ray.dirIsNeg[node->axis]) {
+          nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+          currentNodeIndex = node->secondChildOffset;
+        } else {
+          nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+          currentNodeIndex = currentNodeIndex + 1;
+        }
+      }
+    } else {
+      if (toVisitOffset == 0) break;
+      currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+  }
+
+  return hit;
+}
+
+bool BVH::IntersectP(const Ray& r) const {
+  if (nodes.empty()) return false;
+  const LinearBVHNode* nodes = this->nodes.data();
+
+  TraversalRay ray(r);
+  int toVisitOffset = 0, currentNodeIndex = 0;
+  int nodesToVisit[maxDepth];
+  while (true) {
+    const LinearBVHNode* node = &nodes[currentNodeIndex];
+    if (node->bounds.IntersectP(ray)) {
+      if (node->nPrimitives > 0) {
+        for (int i = 0; i < node->nPrimitives; ++i) {
+          if (primitives[node->primitivesOffset + i].IntersectP(ray)) {
+            return true;
+          }
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+      } else {
+        // Any hit will do, but the near child is still the likelier to have
+        // one.
+        DCHECK_LT(toVisitOffset, maxDepth);
+        if (ray.dirIsNeg[node->axis]) {
+          nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+          currentNodeIndex = node->secondChildOffset;
+        } else {
+          nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+          currentNodeIndex = currentNodeIndex + 1;
+        }
+      }
+    } else {
+      if (toVisitOffset == 0) break;
+      currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+  }
+
+  return false;
+}
+
+namespace {
+
+// Interval bounds of the origins and inverse directions of a packet of rays
+// with the same direction signs. Multiplying the intervals bounds the slab
+// distances of every ray in the packet, so a box the bounds say is missed is
+// missed by all of them.
+struct PacketFrustum {
+  PacketFrustum(const TraversalRay* rays, int count) {
+    oLo = oHi = rays[0].origin;
+    iLo = iHi = rays[0].invDir;
+    minT = rays[0].minT;
+    maxT = rays[0].maxT;
+    for (int i = 1; i < count; ++i) {
+      oLo = min(oLo, rays[i].origin);
+      oHi = max(oHi, rays[i].origin);
+      iLo = min(iLo, rays[i].invDir);
+      iHi = max(iHi, rays[i].invDir);
+      minT = min(minT, rays[i].minT);
+      maxT = max(maxT, rays[i].maxT);
+    }
+    for (int a = 0; a < 3; ++a) dirIsNeg[a] = rays[0].dirIsNeg[a];
+    // 0 * inf makes the bounds meaningless, so packets with an axis aligned
+    // ray are only culled ray by ray.
+    valid = std::isfinite(iLo.x) && std::isfinite(iLo.y) &&
+            std::isfinite(iLo.z) && std::isfinite(iHi.x) &&
+            std::isfinite(iHi.y) && std::isfinite(iHi.z);
+  }
+
+  // False only if no ray of the packet can hit b.
+  bool MayHit(const AABB& b) const {
+    if (!valid) return true;
+    constexpr float scale = 1 + 2 * gamma(3);
+    float tMin = minT, tMax = maxT;
+    for (int a = 0; a < 3; ++a) {
+      float nearLo, nearHi, farLo, farHi;
+      mul(b[dirIsNeg[a]][a] - oHi[a], b[dirIsNeg[a]][a] - oLo[a], a, &nearLo,
+          &nearHi);
+      mul(b[1 - dirIsNeg[a]][a] - oHi[a], b[1 - dirIsNeg[a]][a] - oLo[a], a,
+          &farLo, &farHi);
+      tMin = max(tMin, nearLo);
+      tMax = min(tMax, farHi * scale);
+    }
+    return tMin <= tMax;
+  }
+
+  // [lo, hi] = [d0, d1] * [iLo[a], iHi[a]].
+  INLINE void mul(float d0, float d1, int a, float* lo, float* hi) const {
+    float p0 = d0 * iLo[a], p1 = d0 * iHi[a];
+    float p2 = d1 * iLo[a], p3 = d1 * iHi[a];
+    *lo = min(min(p0, p1), min(p2, p3));
+    *hi = max(max(p0, p1), max(p2, p3));
+  }
+
+  Vector3 oLo, oHi, iLo, iHi;
+  float minT, maxT;
+  int dirIsNeg[3];
+  bool valid;
+};
+
+}  // namespace
+
+void BVH::IntersectPacket(const Ray* r, int count, optional<Hit>* hits) const {
+  DCHECK_LE(count, MaxPacketSize);
+  for (int i = 0; i < count; ++i) hits[i] = nullopt;
+  if (nodes.empty() || count == 0) return;
+  const LinearBVHNode* nodes = this->nodes.data();
+
+  TraversalRay rays[MaxPacketSize];
+  for (int i = 0; i < count; ++i) rays[i] = TraversalRay(r[i]);
+
+  // Rays going into different octants would want different child orders:
+  // trace them one by one.
+  for (int i = 1; i < count; ++i) {
+    for (int a = 0; a < 3; ++a) {
+      if (rays[i].dirIsNeg[a] != rays[0].dirIsNeg[a]) {
+        for (int j = 0; j < count; ++j) hits[j] = Intersect(r[j]);
+        return;
+      }
+    }
+  }
+
+  PacketFrustum frustum(rays, count);
+
+  int toVisitOffset = 0, currentNodeIndex = 0;
+  int nodesToVisit[maxDepth];
+  while (true) {
+    const LinearBVHNode* node = &nodes[currentNodeIndex];
+
+    bool visit = false;
+    if (frustum.MayHit(node->bounds)) {
+      for (int i = 0; i < count && !visit; ++i) {
+        visit = node->bounds.IntersectP(rays[i]);
+      }
+    }
+
+    if (visit && node->nPrimitives > 0) {
+      for (int i = 0; i < count; ++i) {
+        if (!node->bounds.IntersectP(rays[i])) continue;
+        for (int j = 0; j < node->nPrimitives; ++j) {
+          const Primitive& p = primitives[node->primitivesOffset + j];
+          optional<Hit> h = p.Intersect(rays[i]);
+          if (h) {
+            rays[i].maxT = h->t;
+            hits[i] = h;
+          }
+        }
+      }
+      frustum.maxT = rays[0].maxT;
+      for (int i = 1; i < count; ++i) {
+        frustum.maxT = max(frustum.maxT, rays[i].maxT);
+      }
+    } else if (visit) {
+      DCHECK_LT(toVisitOffset, maxDepth);
+      if (frustum.dirIsNeg[node->axis]) {
+        nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+        currentNodeIndex = node->secondChildOffset;
+      } else {
+        nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+        currentNodeIndex = currentNodeIndex + 1;
+      }
+      continue;
+    }
+
+    if (toVisitOffset == 0) break;
+    currentNodeIndex = nodesToVisit[--toVisitOffset];
+  }
+}
+
+void BVH::Refit(bool rotate) {
+  if (nodes.empty()) return;
+  std::vector<LinearBVHNode>& nodes = this->nodes.Mutable();
+
+  // Leaves first, where the primitive bounds are, then interior nodes from
+  // the last: children always come after their parent. References clipped by
+  // spatial splits get back the bounds of their whole primitive.
+  ParallelFor(
+      [&](int64_t i) {
+        LinearBVHNode& node = nodes[i];
+        if (node.nPrimitives == 0) return;
+        AABB bounds;
+        for (int j = 0; j < node.nPrimitives; ++j) {
+          bounds = Union(bounds, primitives[node.primitivesOffset + j].Bound());
+        }
+        node.bounds = bounds;
+      },
+      nodes.size(),
+      parallelChunk);
+  for (int i = nodes.size() - 1; i >= 0; --i) {
+    LinearBVHNode& node = nodes[i];
+    if (node.nPrimitives > 0) continue;
+    node.bounds =
+        Union(nodes[i + 1].bounds, nodes[node.secondChildOffset].bounds);
+  }
+
+  if (rotate) this->rotate();
+}
+
+// One bottom-up pass of rotations over the tree, which is then flattened
+// again in depth-first order. A rotation is only taken when it doesn't make
+// the subtree deeper, so the traversal stack is never outgrown.
+void BVH::rotate() {
+  std::vector<LinearBVHNode>& nodes = this->nodes.Mutable();
+  const int n = nodes.size();
+  std::vector<int> left(n, -1), right(n, -1), height(n, 0);
+  for (int i = n - 1; i >= 0; --i) {
+    if (nodes[i].nPrimitives > 0) continue;
+    left[i] = i + 1;
+    right[i] = nodes[i].secondChildOffset;
+    height[i] = 1 + max(height[left[i]], height[right[i]]);
+  }
+
+  int rotations = 0;
+  for (int i = n - 1; i >= 0; --i) {
+    if (left[i] < 0) continue;
+
+    // The best swap of child c of i with grandchild g, the other child of i
+    // being p, whose bounds become those of g's sibling and c.
+    int bestC = -1, bestP = -1, bestG = -1;
+    float bestGain = 0;
+    AABB bestBounds;
+    for (int side = 0; side < 2; ++side) {
+      const int c = side ? right[i] : left[i];
+      const int p = side ? left[i] : right[i];
+      if (left[p] < 0) continue;
+      const float area = nodes[p].bounds.SurfaceArea();
+      for (int k = 0; k < 2; ++k) {
+        const int g = k ? right[p] : left[p];
+        const int sibling = k ? left[p] : right[p];
+        const int h = 1 + max(height[g], 1 + max(height[c], height[sibling]));
+        if (h > height[i]) continue;
+        const AABB bounds = Union(nodes[c].bounds, nodes[sibling].bounds);
+        const float gain = area - bounds.SurfaceArea();
+        if (gain > bestGain) {
+          bestGain = gain;
+          bestC = c;
+          bestP = p;
+          bestG = g;
+          bestBounds = bounds;
+        }
+      }
+    }
+    if (bestC < 0) continue;
+
+    (left[i] == bestC ? left[i] : right[i]) = bestG;
+    (left[bestP] == bestG ? left[bestP] : right[bestP]) = bestC;
+    nodes[bestP].bounds = bestBounds;
+    height[bestP] = 1 + max(height[left[bestP]], height[right[bestP]]);
+    height[i] = 1 + max(height[left[i]], height[right[i]]);
+    rotations++;
+  }
+
+  // Children are ordered along the axis that separates their centroids the
+  // most, which traversal uses to visit the nearest first.
+  std::vector<LinearBVHNode> flat;
+  flat.reserve(n);
+  std::function<void(int)> emit = [&](int i) {
+    const int index = flat.size();
+    flat.push_back(nodes[i]);
+    if (left[i] < 0) return;
+
+    int a = left[i], b = right[i];
+    const AABB& ba = nodes[a].bounds;
+    const AABB& bb = nodes[b].bounds;
+    const Vector3 d = (bb.minp + bb.maxp) - (ba.minp + ba.maxp);
+    const int axis = MaxDimension(Abs(d));
+    if (d[axis] < 0) std::swap(a, b);
+    emit(a);
+    flat[index].secondChildOffset = flat.size();
+    flat[index].axis = axis;
+    emit(b);
+  };
+  emit(0);
+  nodes = move(flat);
+
+  DVLOG(2) << "BVH rotated " << rotations << " nodes";
+}
+
+}  // namespace skirt
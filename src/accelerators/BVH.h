@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "core/AABB.h"
+#include "core/Accelerator.h"
+#include "core/Buffer.h"
+#include "core/Element.h"
+#include "core/Primitive.h"
+
+namespace skirt {
+
+/*
+Bounding volume hierarchy, built either with the binned surface area
+heuristic or as a linear BVH from the Morton order of the primitive centroids,
+which builds much faster but gives a worse tree. The spatial split BVH (SBVH)
+adds splits by planes that clip the primitives crossing them, which helps
+with long thin triangles. duplicationBudget is how many extra references
+that may add, as a fraction of the number of primitives.
+
+The tree is stored flattened in depth-first order: the first child of an
+interior node is always the next node in the array, and only the offset of the
+second child is kept. Leaves point to a contiguous range of `primitives`, so a
+mesh's triangles are sorted into the tree one by one rather than as a whole.
+
+Packets of rays going into the same octant are traversed together: a node is
+skipped when the interval bound of the whole packet misses it, and otherwise
+entered as soon as one ray hits it.
+
+For animation, Refit() updates the bounds of an existing tree in linear time.
+Its tree rotations swap a child with a grandchild wherever that shrinks the
+surface area of the node between them, as in Kensler, "Tree Rotations for
+Improving Bounding Volume Hierarchies" (2008).
+*/
+struct LinearBVHNode {
+  AABB bounds;
+  union {
+    int primitivesOffset;   // leaf
+    int secondChildOffset;  // interior
+  };
+  uint16_t nPrimitives;  // 0 for interior nodes
+  uint8_t axis;          // split axis of interior nodes
+  uint8_t pad[1];
+};
+
+class BVH : public Accelerator {
+ public:
+  enum class SplitMethod { SAH, LBVH, SBVH };
+  // Builds keep every leaf at most this deep, so a traversal never has more
+  // nodes than this left to visit.
+  static constexpr int maxDepth = 64;
+
+  BVH(const std::vector<shared_ptr<Element>>& elements,
+      int maxPrimsInNode = 4,
+      SplitMethod splitMethod = SplitMethod::SAH,
+      float duplicationBudget = 0.3f);
+  // Takes a tree built before, as read back from a BVH cache.
+  BVH(const std::vector<shared_ptr<Element>>& elements,
+      int maxPrimsInNode,
+      SplitMethod splitMethod,
+      std::vector<Primitive>&& primitives,
+      Buffer<LinearBVHNode>&& nodes);
+
+  virtual const AABB Bound() const;
+  virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
+  virtual void IntersectPacket(const Ray* rays,
+                               int count,
+                               optional<Hit>* hits) const;
+  virtual void Refit(bool rotate);
+
+  const int maxPrimsInNode;
+  const SplitMethod splitMethod;
+  std::vector<shared_ptr<Element>> elements;
+  // Primitives of all the elements, in leaf order. With spatial splits a
+  // primitive may be in several leaves.
+  std::vector<Primitive> primitives;
+  // May be a view into a mapped cache file until Refit() copies it.
+  Buffer<LinearBVHNode> nodes;
+
+ private:
+  void rotate();
+};
+
+}  // namespace skirt
@@ -0,0 +1,277 @@
+#include "accelerators/BVHCache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+#include "core/skirt.h"
+
+#include "core/Parallel.h"
+#include "loader/MappedFile.h"
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+namespace {
+
+constexpr char magic[8] = {'S', 'K', 'I', 'R', 'T', 'B', 'V', 'H'};
+constexpr uint32_t version = 1;
+// Written as is, so files from a machine of the other byte order don't match.
+constexpr uint32_t byteOrder = 0x01020304;
+// Sections start aligned to cache lines.
+constexpr uint64_t alignment = 64;
+constexpr int64_t hashChunk = 64 * 1024;
+
+// Offsets are from the start of the file.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint64_t key;
+  uint32_t nodeSize;
+  int32_t maxPrimsInNode;
+  int32_t splitMethod;
+  uint32_t pad;
+  uint64_t nodeCount, nodesOffset;
+  uint64_t referenceCount, referencesOffset;
+};
+
+// Leaf reference to the index-th primitive of elements[element].
+struct Reference {
+  int32_t element;
+  int32_t index;
+};
+
+INLINE uint64_t alignUp(uint64_t offset) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Not meant to resist anyone crafting collisions, only to tell scenes apart.
+INLINE uint64_t mix(uint64_t h, uint64_t v) {
+  h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+INLINE uint64_t mixVector(uint64_t h, const Vector3& v) {
+  h = mix(h, uint64_t(FloatToBits(v.x)) << 32 | FloatToBits(v.y));
+  return mix(h, FloatToBits(v.z));
+}
+
+}  // namespace
+
+// Primitives are hashed in chunks, in parallel, and the chunk hashes are
+// then hashed in order, so the key doesn't depend on the number of threads.
+uint64_t BVHCacheKey(const std::vector<shared_ptr<Element>>& elements,
+                     int maxPrimsInNode,
+                     BVH::SplitMethod splitMethod,
+                     float duplicationBudget) {
+  const bool spatial = splitMethod == BVH::SplitMethod::SBVH;
+  uint64_t key = mix(version, sizeof(LinearBVHNode));
+  key = mix(key, maxPrimsInNode);
+  key = mix(key, int(splitMethod));
+  if (spatial) key = mix(key, FloatToBits(duplicationBudget));
+  key = mix(key, elements.size());
+
+  std::vector<int64_t> firstPrim(elements.size() + 1, 0);
+  for (size_t i = 0; i < elements.size(); ++i) {
+    firstPrim[i + 1] = firstPrim[i] + elements[i]->PrimitiveCount();
+    key = mix(key, firstPrim[i + 1]);
+  }
+
+  const int64_t n = firstPrim.back();
+  std::vector<uint64_t> chunks((n + hashChunk - 1) / hashChunk);
+  ParallelFor(
+      [&](int64_t c) {
+        const int64_t start = c * hashChunk;
+        const int64_t end = min(n, start + hashChunk);
+        int e = std::upper_bound(firstPrim.begin(), firstPrim.end(), start) -
+                firstPrim.begin() - 1;
+        uint64_t h = 0;
+        for (int64_t i = start; i < end; ++i) {
+          while (i >= firstPrim[e + 1]) ++e;
+          const Element* element = elements[e].get();
+          const int j = i - firstPrim[e];
+          const AABB b = element->PrimitiveBound(j);
+          h = mixVector(mixVector(h, b.minp), b.maxp);
+
+          // Spatial splits clip these triangles exactly.
+          if (!spatial || element->IsInstance() || element->HasTransform()) {
+            continue;
+          }
+          const TriangleMesh* mesh =
+              dynamic_cast<const TriangleMesh*>(element->GetShape());
+          if (!mesh) continue;
+          for (int k = 0; k < 3; ++k) {
+            h = mixVector(h, mesh->Position(mesh->indices[3 * j + k]));
+          }
+        }
+        chunks[c] = h;
+      },
+      chunks.size());
+
+  for (uint64_t h : chunks) key = mix(key, h);
+  return key;
+}
+
+bool WriteBVHCache(const BVH& bvh, uint64_t key, const string& filename) {
+  std::unordered_map<const Element*, int32_t> elementIndex;
+  for (size_t i = 0; i < bvh.elements.size(); ++i) {
+    elementIndex[bvh.elements[i].get()] = i;
+  }
+  std::vector<Reference> refs(bvh.primitives.size());
+  ParallelFor(
+      [&](int64_t i) {
+        const Primitive& p = bvh.primitives[i];
+        refs[i] = {elementIndex.at(p.element), p.index};
+      },
+      refs.size(),
+      hashChunk);
+
+  Header h = {};
+  memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.byteOrder = byteOrder;
+  h.key = key;
+  h.nodeSize = sizeof(LinearBVHNode);
+  h.maxPrimsInNode = bvh.maxPrimsInNode;
+  h.splitMethod = int(bvh.splitMethod);
+  h.nodeCount = bvh.nodes.size();
+  h.nodesOffset = alignUp(sizeof(Header));
+  h.referenceCount = refs.size();
+  h.referencesOffset =
+      alignUp(h.nodesOffset + h.nodeCount * sizeof(LinearBVHNode));
+
+  const string temp = StringPrintf("%s.%d.tmp", filename.c_str(), getpid());
+  std::ofstream out(temp, std::ios::binary);
+  const char zeros[alignment] = {};
+  out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  out.write(zeros, h.nodesOffset - sizeof(h));
+  out.write(reinterpret_cast<const char*>(bvh.nodes.data()),
+            h.nodeCount * sizeof(LinearBVHNode));
+  out.write(zeros, h.referencesOffset - h.nodesOffset -
+                       h.nodeCount * sizeof(LinearBVHNode));
+  out.write(reinterpret_cast<const char*>(refs.data()),
+            h.referenceCount * sizeof(Reference));
+  out.close();
+
+  if (!out || std::rename(temp.c_str(), filename.c_str()) != 0) {
+    LOG(ERROR) << "Can't write BVH cache " << filename << ": "
+               << strerror(errno);
+    std::remove(temp.c_str());
+    return false;
+  }
+  DVLOG(1) << "BVH cached in " << filename;
+  return true;
+}
+
+unique_ptr<BVH> ReadBVHCache(const std::vector<shared_ptr<Element>>& elements,
+                             uint64_t key,
+                             const string& filename) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename, error)) return nullptr;
+
+  shared_ptr<MappedFile> file(new MappedFile(filename, false));
+  if (!file->IsValid()) return nullptr;
+
+  Header h;
+  if (file->size < sizeof(h)) {
+    LOG(WARNING) << "Ignoring truncated BVH cache " << filename;
+    return nullptr;
+  }
+  memcpy(&h, file->data, sizeof(h));
+  if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+      h.byteOrder != byteOrder || h.nodeSize != sizeof(LinearBVHNode)) {
+    LOG(WARNING) << "Ignoring BVH cache " << filename
+                 << " written by another version";
+    return nullptr;
+  }
+  if (h.key != key) {
+    LOG(WARNING) << "Ignoring BVH cache " << filename << " of another scene";
+    return nullptr;
+  }
+  if (h.splitMethod < int(BVH::SplitMethod::SAH) ||
+      h.splitMethod > int(BVH::SplitMethod::SBVH) || h.maxPrimsInNode <= 0) {
+    LOG(WARNING) << "Ignoring corrupt BVH cache " << filename;
+    return nullptr;
+  }
+  // Counts are checked by division, so a corrupt one can't wrap around.
+  auto inFile = [&](uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % alignment == 0 && offset <= file->size &&
+           count <= (file->size - offset) / size && count <= INT32_MAX;
+  };
+  if (!inFile(h.nodesOffset, h.nodeCount, sizeof(LinearBVHNode)) ||
+      !inFile(h.referencesOffset, h.referenceCount, sizeof(Reference))) {
+    LOG(WARNING) << "Ignoring truncated BVH cache " << filename;
+    return nullptr;
+  }
+
+  const LinearBVHNode* nodeData =
+      reinterpret_cast<const LinearBVHNode*>(file->data + h.nodesOffset);
+  const Reference* refs =
+      reinterpret_cast<const Reference*>(file->data + h.referencesOffset);
+  const int64_t nodeCount = h.nodeCount, referenceCount = h.referenceCount;
+  std::vector<Primitive> primitives(referenceCount);
+  std::atomic<bool> valid(true);
+  ParallelFor(
+      [&](int64_t i) {
+        if (i < referenceCount) {
+          const Reference& r = refs[i];
+          if (r.element < 0 || size_t(r.element) >= elements.size() ||
+              r.index < 0 ||
+              r.index >= elements[r.element]->PrimitiveCount()) {
+            valid = false;
+            return;
+          }
+          primitives[i] = Primitive(elements[r.element].get(), r.index);
+        }
+        if (i < nodeCount) {
+          // Children come after their parent, so traversal can't loop.
+          const LinearBVHNode& n = nodeData[i];
+          bool ok;
+          if (n.nPrimitives > 0) {
+            ok = n.primitivesOffset >= 0 &&
+                 int64_t(n.primitivesOffset) + n.nPrimitives <= referenceCount;
+          } else {
+            ok = n.axis < 3 && n.secondChildOffset > i + 1 &&
+                 n.secondChildOffset < nodeCount;
+          }
+          if (!ok) valid = false;
+        }
+      },
+      std::max(nodeCount, referenceCount),
+      hashChunk);
+  if (!valid) {
+    LOG(WARNING) << "Ignoring corrupt BVH cache " << filename;
+    return nullptr;
+  }
+  // Traversal stacks hold one node per level, so the tree can't be any
+  // deeper than they are. With children after their parents, a node's depth
+  // is final by the time it's reached.
+  std::vector<uint8_t> depth(nodeCount, 0);
+  for (int64_t i = 0; i < nodeCount; ++i) {
+    const LinearBVHNode& n = nodeData[i];
+    if (n.nPrimitives > 0) continue;
+    if (depth[i] >= BVH::maxDepth) {
+      LOG(WARNING) << "Ignoring BVH cache " << filename << " deeper than "
+                   << BVH::maxDepth;
+      return nullptr;
+    }
+    for (int64_t child : {i + 1, int64_t(n.secondChildOffset)}) {
+      depth[child] = std::max<uint8_t>(depth[child], depth[i] + 1);
+    }
+  }
+
+  Buffer<LinearBVHNode> nodes(nodeData, nodeCount, file);
+  DVLOG(1) << "BVH read from " << filename << " with " << h.nodeCount
+           << " nodes";
+  return unique_ptr<BVH>(new BVH(elements, h.maxPrimsInNode,
+                                 BVH::SplitMethod(h.splitMethod),
+                                 move(primitives), move(nodes)));
+}
+
+}  // namespace skirt
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "accelerators/BVH.h"
+#include "core/Element.h"
+
+namespace skirt {
+
+/*
+BVHs saved to disk, so a scene rendered again and again doesn't pay for its
+build every time. A cache file holds one tree: its nodes as they are in
+memory, and the primitive of each leaf reference as indices into the
+elements. With offsets and indices rather than pointers, the file can be
+mapped read-only at any address, by several processes at once, and the nodes
+are traversed in place.
+
+Files are named by a key that hashes everything the build looks at: the
+bounds of every primitive in order, the triangles spatial splits clip, and
+the build settings. A scene whose geometry changes gets a new file.
+*/
+
+// Key of the tree BVH(elements, maxPrimsInNode, splitMethod,
+// duplicationBudget) would build.
+uint64_t BVHCacheKey(const std::vector<shared_ptr<Element>>& elements,
+                     int maxPrimsInNode,
+                     BVH::SplitMethod splitMethod,
+                     float duplicationBudget);
+
+// Writes bvh to filename, through a temporary file renamed into place, so
+// other processes never map it half written. Returns false, after logging
+// why, when it can't.
+bool WriteBVHCache(const BVH& bvh, uint64_t key, const string& filename);
+
+// Maps the tree cached in filename over elements. Returns nullptr when there
+// is no such file, or it wasn't written for key and elements.
+unique_ptr<BVH> ReadBVHCache(const std::vector<shared_ptr<Element>>& elements,
+                             uint64_t key,
+                             const string& filename);
+
+}  // namespace skirt
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "core/skirt.h"
+
+#include "core/Ray.h"
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+/*
+Up to N triangles of a BVH leaf, copied out of their meshes as structure of
+arrays, v[vertex][axis][lane], so a ray can be tested against all of them in
+one SSE (N = 4) or AVX (N = 8) pass. The vertices are kept rather than edges,
+as the watertight test needs them exactly. Unused lanes have a null mesh and
+all their vertices at 0, where the triangle is degenerate and never hit.
+*/
+template <int N>
+struct alignas(N * sizeof(float)) TrianglePack {
+  TrianglePack() {
+    for (int i = 0; i < N; ++i) Clear(i);
+  }
+
+  INLINE void Set(int lane, const TriangleMesh* m, int t) {
+    const uint32_t* idx = &m->indices[3 * t];
+    for (int k = 0; k < 3; ++k) {
+      v[k][0][lane] = m->px[idx[k]];
+      v[k][1][lane] = m->py[idx[k]];
+      v[k][2][lane] = m->pz[idx[k]];
+    }
+    mesh[lane] = m;
+    triangle[lane] = t;
+  }
+
+  INLINE void Clear(int lane) {
+    for (int k = 0; k < 3; ++k) {
+      v[k][0][lane] = v[k][1][lane] = v[k][2][lane] = 0;
+    }
+    mesh[lane] = nullptr;
+    triangle[lane] = -1;
+  }
+
+  float v[3][3][N];
+  const TriangleMesh* mesh[N];
+  int32_t triangle[N];
+};
+
+/*
+Ray set up for the watertight test (see TriangleMesh::IntersectTriangle()): the
+permutation of the axes that makes z the largest direction component, and the
+shear that makes the ray point along +z.
+*/
+struct ShearedRay {
+  explicit ShearedRay(const Ray& r) {
+    kz = MaxDimension(Abs(r.direction));
+    kx = kz + 1 == 3 ? 0 : kz + 1;
+    ky = kx + 1 == 3 ? 0 : kx + 1;
+    Vector3 d = Permute(r.direction, kx, ky, kz);
+    sx = -d.x / d.z;
+    sy = -d.y / d.z;
+    sz = 1 / d.z;
+    ox = r.origin[kx];
+    oy = r.origin[ky];
+    oz = r.origin[kz];
+  }
+
+  int kx, ky, kz;
+  float sx, sy, sz;
+  float ox, oy, oz;
+};
+
+namespace internal {
+
+// Edge functions recomputed in double for the lanes in mask, like the scalar
+// test does when one of them is 0.
+INLINE void edgesInDouble(int mask,
+                          const float* p0x,
+                          const float* p0y,
+                          const float* p1x,
+                          const float* p1y,
+                          const float* p2x,
+                          const float* p2y,
+                          float* e0,
+                          float* e1,
+                          float* e2) {
+  while (mask) {
+    int i = __builtin_ctz(mask);
+    mask &= mask - 1;
+    e0[i] = double(p1x[i]) * p2y[i] - double(p1y[i]) * p2x[i];
+    e1[i] = double(p2x[i]) * p0y[i] - double(p2y[i]) * p0x[i];
+    e2[i] = double(p0x[i]) * p1y[i] - double(p0y[i]) * p1x[i];
+  }
+}
+
+#if defined(__SSE__)
+// Lanes [g, g + 4) of IntersectTrianglePack().
+template <int N>
+INLINE int intersect4(const TrianglePack<N>& pack,
+                      const Ray& ray,
+                      const ShearedRay& r,
+                      int g,
+                      float* t,
+                      float* b0,
+                      float* b1,
+                      float* b2) {
+  const __m128 ox = _mm_set1_ps(r.ox);
+  const __m128 oy = _mm_set1_ps(r.oy);
+  const __m128 oz = _mm_set1_ps(r.oz);
+  const __m128 sx = _mm_set1_ps(r.sx);
+  const __m128 sy = _mm_set1_ps(r.sy);
+  const __m128 sz = _mm_set1_ps(r.sz);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 signBit = _mm_set1_ps(-0.f);
+
+  __m128 p0x = _mm_sub_ps(_mm_load_ps(pack.v[0][r.kx] + g), ox);
+  __m128 p0y = _mm_sub_ps(_mm_load_ps(pack.v[0][r.ky] + g), oy);
+  __m128 p0z = _mm_sub_ps(_mm_load_ps(pack.v[0][r.kz] + g), oz);
+  __m128 p1x = _mm_sub_ps(_mm_load_ps(pack.v[1][r.kx] + g), ox);
+  __m128 p1y = _mm_sub_ps(_mm_load_ps(pack.v[1][r.ky] + g), oy);
+  __m128 p1z = _mm_sub_ps(_mm_load_ps(pack.v[1][r.kz] + g), oz);
+  __m128 p2x = _mm_sub_ps(_mm_load_ps(pack.v[2][r.kx] + g), ox);
+  __m128 p2y = _mm_sub_ps(_mm_load_ps(pack.v[2][r.ky] + g), oy);
+  __m128 p2z = _mm_sub_ps(_mm_load_ps(pack.v[2][r.kz] + g), oz);
+  p0x = _mm_add_ps(p0x, _mm_mul_ps(sx, p0z));
+  p0y = _mm_add_ps(p0y, _mm_mul_ps(sy, p0z));
+  p1x = _mm_add_ps(p1x, _mm_mul_ps(sx, p1z));
+  p1y = _mm_add_ps(p1y, _mm_mul_ps(sy, p1z));
+  p2x = _mm_add_ps(p2x, _mm_mul_ps(sx, p2z));
+  p2y = _mm_add_ps(p2y, _mm_mul_ps(sy, p2z));
+
+  __m128 e0 = _mm_sub_ps(_mm_mul_ps(p1x, p2y), _mm_mul_ps(p1y, p2x));
+  __m128 e1 = _mm_sub_ps(_mm_mul_ps(p2x, p0y), _mm_mul_ps(p2y, p0x));
+  __m128 e2 = _mm_sub_ps(_mm_mul_ps(p0x, p1y), _mm_mul_ps(p0y, p1x));
+  int onEdge = _mm_movemask_ps(_mm_or_ps(
+      _mm_or_ps(_mm_cmpeq_ps(e0, zero), _mm_cmpeq_ps(e1, zero)),
+      _mm_cmpeq_ps(e2, zero)));
+  if (onEdge) {
+    alignas(16) float x[3][4], y[3][4], e[3][4];
+    _mm_store_ps(x[0], p0x);
+    _mm_store_ps(y[0], p0y);
+    _mm_store_ps(x[1], p1x);
+    _mm_store_ps(y[1], p1y);
+    _mm_store_ps(x[2], p2x);
+    _mm_store_ps(y[2], p2y);
+    _mm_store_ps(e[0], e0);
+    _mm_store_ps(e[1], e1);
+    _mm_store_ps(e[2], e2);
+    edgesInDouble(
+        onEdge, x[0], y[0], x[1], y[1], x[2], y[2], e[0], e[1], e[2]);
+    e0 = _mm_load_ps(e[0]);
+    e1 = _mm_load_ps(e[1]);
+    e2 = _mm_load_ps(e[2]);
+  }
+
+  // Inside when the edge functions don't have mixed signs.
+  __m128 anyNeg = _mm_or_ps(
+      _mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)),
+      _mm_cmplt_ps(e2, zero));
+  __m128 anyPos = _mm_or_ps(
+      _mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)),
+      _mm_cmpgt_ps(e2, zero));
+  __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+  __m128 valid =
+      _mm_andnot_ps(_mm_and_ps(anyNeg, anyPos), _mm_cmpneq_ps(det, zero));
+  if (!_mm_movemask_ps(valid)) return 0;
+
+  // Distance range check on tScaled = t * det, with the sign of det moved
+  // over to tScaled.
+  p0z = _mm_mul_ps(p0z, sz);
+  p1z = _mm_mul_ps(p1z, sz);
+  p2z = _mm_mul_ps(p2z, sz);
+  __m128 tScaled = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(e0, p0z), _mm_mul_ps(e1, p1z)),
+      _mm_mul_ps(e2, p2z));
+  __m128 detSign = _mm_and_ps(det, signBit);
+  __m128 absDet = _mm_xor_ps(det, detSign);
+  __m128 tS = _mm_xor_ps(tScaled, detSign);
+  valid = _mm_and_ps(
+      valid, _mm_cmpgt_ps(tS, _mm_mul_ps(_mm_set1_ps(ray.minT), absDet)));
+  valid = _mm_and_ps(
+      valid, _mm_cmple_ps(tS, _mm_mul_ps(_mm_set1_ps(ray.maxT), absDet)));
+  if (!_mm_movemask_ps(valid)) return 0;
+
+  __m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+  __m128 tHit = _mm_mul_ps(tScaled, invDet);
+
+  // Same conservative bound on the error of t as the scalar test.
+  __m128 maxZt = _mm_max_ps(
+      _mm_andnot_ps(signBit, p0z),
+      _mm_max_ps(_mm_andnot_ps(signBit, p1z), _mm_andnot_ps(signBit, p2z)));
+  __m128 maxXt = _mm_max_ps(
+      _mm_andnot_ps(signBit, p0x),
+      _mm_max_ps(_mm_andnot_ps(signBit, p1x), _mm_andnot_ps(signBit, p2x)));
+  __m128 maxYt = _mm_max_ps(
+      _mm_andnot_ps(signBit, p0y),
+      _mm_max_ps(_mm_andnot_ps(signBit, p1y), _mm_andnot_ps(signBit, p2y)));
+  __m128 maxE = _mm_max_ps(
+      _mm_andnot_ps(signBit, e0),
+      _mm_max_ps(_mm_andnot_ps(signBit, e1), _mm_andnot_ps(signBit, e2)));
+  __m128 deltaZ = _mm_mul_ps(_mm_set1_ps(gamma(3)), maxZt);
+  __m128 deltaX = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxXt, maxZt));
+  __m128 deltaY = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxYt, maxZt));
+  __m128 deltaXY = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(2)), maxXt), maxYt);
+  __m128 deltaE = _mm_mul_ps(
+      _mm_set1_ps(2),
+      _mm_add_ps(_mm_add_ps(deltaXY, _mm_mul_ps(deltaY, maxXt)),
+                 _mm_mul_ps(deltaX, maxYt)));
+  __m128 deltaT = _mm_mul_ps(
+      _mm_mul_ps(
+          _mm_set1_ps(3),
+          _mm_add_ps(
+              _mm_add_ps(
+                  _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(3)), maxE), maxZt),
+                  _mm_mul_ps(deltaE, maxZt)),
+              _mm_mul_ps(deltaZ, maxE))),
+      _mm_andnot_ps(signBit, invDet));
+  valid = _mm_and_ps(valid, _mm_cmpgt_ps(tHit, deltaT));
+
+  _mm_store_ps(t + g, tHit);
+  _mm_store_ps(b0 + g, _mm_mul_ps(e0, invDet));
+  _mm_store_ps(b1 + g, _mm_mul_ps(e1, invDet));
+  _mm_store_ps(b2 + g, _mm_mul_ps(e2, invDet));
+  return _mm_movemask_ps(valid) << g;
+}
+#endif
+
+#if defined(__AVX__)
+INLINE int intersect8(const TrianglePack<8>& pack,
+                      const Ray& ray,
+                      const ShearedRay& r,
+                      float* t,
+                      float* b0,
+                      float* b1,
+                      float* b2) {
+  const __m256 ox = _mm256_set1_ps(r.ox);
+  const __m256 oy = _mm256_set1_ps(r.oy);
+  const __m256 oz = _mm256_set1_ps(r.oz);
+  const __m256 sx = _mm256_set1_ps(r.sx);
+  const __m256 sy = _mm256_set1_ps(r.sy);
+  const __m256 sz = _mm256_set1_ps(r.sz);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 signBit = _mm256_set1_ps(-0.f);
+
+  __m256 p0x = _mm256_sub_ps(_mm256_load_ps(pack.v[0][r.kx]), ox);
+  __m256 p0y = _mm256_sub_ps(_mm256_load_ps(pack.v[0][r.ky]), oy);
+  __m256 p0z = _mm256_sub_ps(_mm256_load_ps(pack.v[0][r.kz]), oz);
+  __m256 p1x = _mm256_sub_ps(_mm256_load_ps(pack.v[1][r.kx]), ox);
+  __m256 p1y = _mm256_sub_ps(_mm256_load_ps(pack.v[1][r.ky]), oy);
+  __m256 p1z = _mm256_sub_ps(_mm256_load_ps(pack.v[1][r.kz]), oz);
+  __m256 p2x = _mm256_sub_ps(_mm256_load_ps(pack.v[2][r.kx]), ox);
+  __m256 p2y = _mm256_sub_ps(_mm256_load_ps(pack.v[2][r.ky]), oy);
+  __m256 p2z = _mm256_sub_ps(_mm256_load_ps(pack.v[2][r.kz]), oz);
+  p0x = _mm256_add_ps(p0x, _mm256_mul_ps(sx, p0z));
+  p0y = _mm256_add_ps(p0y, _mm256_mul_ps(sy, p0z));
+  p1x = _mm256_add_ps(p1x, _mm256_mul_ps(sx, p1z));
+  p1y = _mm256_add_ps(p1y, _mm256_mul_ps(sy, p1z));
+  p2x = _mm256_add_ps(p2x, _mm256_mul_ps(sx, p2z));
+  p2y = _mm256_add_ps(p2y, _mm256_mul_ps(sy, p2z));
+
+  __m256 e0 = _mm256_sub_ps(_mm256_mul_ps(p1x, p2y), _mm256_mul_ps(p1y, p2x));
+  __m256 e1 = _mm256_sub_ps(_mm256_mul_ps(p2x, p0y), _mm256_mul_ps(p2y, p0x));
+  __m256 e2 = _mm256_sub_ps(_mm256_mul_ps(p0x, p1y), _mm256_mul_ps(p0y, p1x));
+  int onEdge = _mm256_movemask_ps(_mm256_or_ps(
+      _mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_EQ_OQ),
+                   _mm256_cmp_ps(e1, zero, _CMP_EQ_OQ)),
+      _mm256_cmp_ps(e2, zero, _CMP_EQ_OQ)));
+  if (onEdge) {
+    alignas(32) float x[3][8], y[3][8], e[3][8];
+    _mm256_store_ps(x[0], p0x);
+    _mm256_store_ps(y[0], p0y);
+    _mm256_store_ps(x[1], p1x);
+    _mm256_store_ps(y[1], p1y);
+    _mm256_store_ps(x[2], p2x);
+    _mm256_store_ps(y[2], p2y);
+    _mm256_store_ps(e[0], e0);
+    _mm256_store_ps(e[1], e1);
+    _mm256_store_ps(e[2], e2);
+    edgesInDouble(
+        onEdge, x[0], y[0], x[1], y[1], x[2], y[2], e[0], e[1], e[2]);
+    e0 = _mm256_load_ps(e[0]);
+    e1 = _mm256_load_ps(e[1]);
+    e2 = _mm256_load_ps(e[2]);
+  }
+
+  __m256 anyNeg =
+      _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_LT_OQ),
+                                _mm256_cmp_ps(e1, zero, _CMP_LT_OQ)),
+                   _mm256_cmp_ps(e2, zero, _CMP_LT_OQ));
+  __m256 anyPos =
+      _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ),
+                                _mm256_cmp_ps(e1, zero, _CMP_GT_OQ)),
+                   _mm256_cmp_ps(e2, zero, _CMP_GT_OQ));
+  __m256 det = _mm256_add_ps(_mm256_add_ps(e0, e1), e2);
+  __m256 valid = _mm256_andnot_ps(_mm256_and_ps(anyNeg, anyPos),
+                                  _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+  if (!_mm256_movemask_ps(valid)) return 0;
+
+  p0z = _mm256_mul_ps(p0z, sz);
+  p1z = _mm256_mul_ps(p1z, sz);
+  p2z = _mm256_mul_ps(p2z, sz);
+  __m256 tScaled = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(e0, p0z), _mm256_mul_ps(e1, p1z)),
+      _mm256_mul_ps(e2, p2z));
+  __m256 detSign = _mm256_and_ps(det, signBit);
+  __m256 absDet = _mm256_xor_ps(det, detSign);
+  __m256 tS = _mm256_xor_ps(tScaled, detSign);
+  valid = _mm256_and_ps(
+      valid,
+      _mm256_cmp_ps(tS,
+                    _mm256_mul_ps(_mm256_set1_ps(ray.minT), absDet),
+                    _CMP_GT_OQ));
+  valid = _mm256_and_ps(
+      valid,
+      _mm256_cmp_ps(tS,
+                    _mm256_mul_ps(_mm256_set1_ps(ray.maxT), absDet),
+                    _CMP_LE_OQ));
+  if (!_mm256_movemask_ps(valid)) return 0;
+
+  __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1), det);
+  __m256 tHit = _mm256_mul_ps(tScaled, invDet);
+
+  __m256 maxZt = _mm256_max_ps(_mm256_andnot_ps(signBit, p0z),
+                               _mm256_max_ps(_mm256_andnot_ps(signBit, p1z),
+                                             _mm256_andnot_ps(signBit, p2z)));
+  __m256 maxXt = _mm256_max_ps(_mm256_andnot_ps(signBit, p0x),
+                               _mm256_max_ps(_mm256_andnot_ps(signBit, p1x),
+                                             _mm256_andnot_ps(signBit, p2x)));
+  __m256 maxYt = _mm256_max_ps(_mm256_andnot_ps(signBit, p0y),
+                               _mm256_max_ps(_mm256_andnot_ps(signBit, p1y),
+                                             _mm256_andnot_ps(signBit, p2y)));
+  __m256 maxE = _mm256_max_ps(_mm256_andnot_ps(signBit, e0),
+                              _mm256_max_ps(_mm256_andnot_ps(signBit, e1),
+                                            _mm256_andnot_ps(signBit, e2)));
+  __m256 deltaZ = _mm256_mul_ps(_mm256_set1_ps(gamma(3)), maxZt);
+  __m256 deltaX =
+      _mm256_mul_ps(_mm256_set1_ps(gamma(5)), _mm256_add_ps(maxXt, maxZt));
+  __m256 deltaY =
+      _mm256_mul_ps(_mm256_set1_ps(gamma(5)), _mm256_add_ps(maxYt, maxZt));
+  __m256 deltaE = _mm256_mul_ps(
+      _mm256_set1_ps(2),
+      _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(gamma(2)), maxXt),
+                            maxYt),
+              _mm256_mul_ps(deltaY, maxXt)),
+          _mm256_mul_ps(deltaX, maxYt)));
+  __m256 deltaT = _mm256_mul_ps(
+      _mm256_mul_ps(
+          _mm256_set1_ps(3),
+          _mm256_add_ps(
+              _mm256_add_ps(
+                  _mm256_mul_ps(
+                      _mm256_mul_ps(_mm256_set1_ps(gamma(3)), maxE), maxZt),
+                  _mm256_mul_ps(deltaE, maxZt)),
+              _mm256_mul_ps(deltaZ, maxE))),
+      _mm256_andnot_ps(signBit, invDet));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(tHit, deltaT, _CMP_GT_OQ));
+
+  _mm256_store_ps(t, tHit);
+  _mm256_store_ps(b0, _mm256_mul_ps(e0, invDet));
+  _mm256_store_ps(b1, _mm256_mul_ps(e1, invDet));
+  _mm256_store_ps(b2, _mm256_mul_ps(e2, invDet));
+  return _mm256_movemask_ps(valid);
+}
+#endif
+
+}  // namespace internal
+
+// Watertight test of the ray, set up in r, against every triangle of the pack.
+// Returns a bit mask of the lanes hit within the ray's range, and writes the
+// distance and barycentric coordinates of those hits to t and b0, b1, b2,
+// which must be aligned like the pack.
+template <int N>
+INLINE int IntersectTrianglePack(const TrianglePack<N>& pack,
+                                 const Ray& ray,
+                                 const ShearedRay& r,
+                                 float* t,
+                                 float* b0,
+                                 float* b1,
+                                 float* b2) {
+#if defined(__AVX__)
+  if constexpr (N == 8) {
+    return internal::intersect8(pack, ray, r, t, b0, b1, b2);
+  }
+#endif
+
+#if defined(__SSE__)
+  int mask = 0;
+  for (int g = 0; g < N; g += 4) {
+    mask |= internal::intersect4(pack, ray, r, g, t, b0, b1, b2);
+  }
+  return mask;
+#else
+  int mask = 0;
+  for (int i = 0; i < N; ++i) {
+    float b[3];
+    if (pack.mesh[i] &&
+        pack.mesh[i]->IntersectTriangle(ray, pack.triangle[i], t + i, b)) {
+      b0[i] = b[0];
+      b1[i] = b[1];
+      b2[i] = b[2];
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+}  // namespace skirt
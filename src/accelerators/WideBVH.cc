@@ -0,0 +1,630 @@
+#include "accelerators/WideBVH.h"
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "core/skirt.h"
+
+#include "core/Parallel.h"
+
+namespace skirt {
+
+namespace {
+
+// Each node pushes at most 8 children and pops one, and collapsing never
+// makes a tree deeper than the binary BVH it comes from.
+constexpr int maxStackSize = BVH::maxDepth * 8;
+
+struct StackEntry {
+  int32_t child;
+  uint8_t count;
+  uint8_t packed;
+  float t;
+};
+
+template <int N>
+void setBounds(WideBVHNode<N>* node, int slot, const AABB& b) {
+  node->minX[slot] = b.minp.x;
+  node->minY[slot] = b.minp.y;
+  node->minZ[slot] = b.minp.z;
+  node->maxX[slot] = b.maxp.x;
+  node->maxY[slot] = b.maxp.y;
+  node->maxZ[slot] = b.maxp.z;
+}
+
+template <int N>
+void setChild(WideBVHNode<N>* node,
+              int slot,
+              const AABB& b,
+              int32_t child,
+              int count) {
+  setBounds(node, slot, b);
+  node->child[slot] = child;
+  node->count[slot] = count;
+  node->packed[slot] = 0;
+}
+
+template <int N>
+void clearChild(WideBVHNode<N>* node, int slot) {
+  node->minX[slot] = node->minY[slot] = node->minZ[slot] = Infinity;
+  node->maxX[slot] = node->maxY[slot] = node->maxZ[slot] = -Infinity;
+  node->child[slot] = -1;
+  node->count[slot] = 0;
+  node->packed[slot] = 0;
+}
+
+// AABB::IntersectP of the ray against every child of the node. Writes the
+// entry distance of each child to tNear and returns a bit mask of the hit
+// children. SSE/AVX max and min return their second operand when either is
+// NaN, so the running interval goes second to drop NaN slabs.
+template <int N>
+INLINE int intersectChildren(const WideBVHNode<N>& node,
+                             const TraversalRay& ray,
+                             float* tNear) {
+  const Vector3& o = ray.origin;
+  const Vector3& invDir = ray.invDir;
+  const int* dirIsNeg = ray.dirIsNeg;
+  constexpr float scale = 1 + 2 * gamma(3);
+
+  const float* nearX = dirIsNeg[0] ? node.maxX : node.minX;
+  const float* farX = dirIsNeg[0] ? node.minX : node.maxX;
+  const float* nearY = dirIsNeg[1] ? node.maxY : node.minY;
+  const float* farY = dirIsNeg[1] ? node.minY : node.maxY;
+  const float* nearZ = dirIsNeg[2] ? node.maxZ : node.minZ;
+  const float* farZ = dirIsNeg[2] ? node.minZ : node.maxZ;
+
+#if defined(__AVX__)
+  if (N == 8) {
+    const __m256 ox = _mm256_set1_ps(o.x);
+    const __m256 oy = _mm256_set1_ps(o.y);
+    const __m256 oz = _mm256_set1_ps(o.z);
+    const __m256 ix = _mm256_set1_ps(invDir.x);
+    const __m256 iy = _mm256_set1_ps(invDir.y);
+    const __m256 iz = _mm256_set1_ps(invDir.z);
+    const __m256 fx = _mm256_set1_ps(invDir.x * scale);
+    const __m256 fy = _mm256_set1_ps(invDir.y * scale);
+    const __m256 fz = _mm256_set1_ps(invDir.z * scale);
+
+    __m256 t0 = _mm256_set1_ps(ray.minT);
+    __m256 t1 = _mm256_set1_ps(ray.maxT);
+    t0 = _mm256_max_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearZ), oz), iz), t0);
+    t0 = _mm256_max_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearY), oy), iy), t0);
+    t0 = _mm256_max_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearX), ox), ix), t0);
+    t1 = _mm256_min_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farZ), oz), fz), t1);
+    t1 = _mm256_min_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farY), oy), fy), t1);
+    t1 = _mm256_min_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farX), ox), fx), t1);
+
+    _mm256_store_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+  }
+#endif
+
+#if defined(__SSE__)
+  const __m128 ox = _mm_set1_ps(o.x);
+  const __m128 oy = _mm_set1_ps(o.y);
+  const __m128 oz = _mm_set1_ps(o.z);
+  const __m128 ix = _mm_set1_ps(invDir.x);
+  const __m128 iy = _mm_set1_ps(invDir.y);
+  const __m128 iz = _mm_set1_ps(invDir.z);
+  const __m128 fx = _mm_set1_ps(invDir.x * scale);
+  const __m128 fy = _mm_set1_ps(invDir.y * scale);
+  const __m128 fz = _mm_set1_ps(invDir.z * scale);
+
+  int mask = 0;
+  for (int g = 0; g < N; g += 4) {
+    __m128 t0 = _mm_set1_ps(ray.minT);
+    __m128 t1 = _mm_set1_ps(ray.maxT);
+    t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearZ + g), oz), iz), t0);
+    t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearY + g), oy), iy), t0);
+    t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearX + g), ox), ix), t0);
+    t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farZ + g), oz), fz), t1);
+    t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farY + g), oy), fy), t1);
+    t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farX + g), ox), fx), t1);
+
+    _mm_store_ps(tNear + g, t0);
+    mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << g;
+  }
+  return mask;
+#else
+  int mask = 0;
+  for (int i = 0; i < N; ++i) {
+    float tx0 = (nearX[i] - o.x) * invDir.x;
+    float ty0 = (nearY[i] - o.y) * invDir.y;
+    float tz0 = (nearZ[i] - o.z) * invDir.z;
+    float tx1 = (farX[i] - o.x) * invDir.x * scale;
+    float ty1 = (farY[i] - o.y) * invDir.y * scale;
+    float tz1 = (farZ[i] - o.z) * invDir.z * scale;
+    float t0 = max(max(max(ray.minT, tz0), ty0), tx0);
+    float t1 = min(min(min(ray.maxT, tz1), ty1), tx1);
+    tNear[i] = t0;
+    mask |= (t0 <= t1) << i;
+  }
+  return mask;
+#endif
+}
+
+INLINE float stepScale(uint8_t exponent) {
+  return BitsToFloat(uint32_t(exponent) << 23);
+}
+
+// Decodes the bounds of the children of q into node. Slots not in use get
+// whatever their planes decode to.
+template <int N>
+INLINE void decodeBounds(const CompressedWideBVHNode<N>& q,
+                         WideBVHNode<N>* node) {
+  float* lo[3] = {node->minX, node->minY, node->minZ};
+  float* hi[3] = {node->maxX, node->maxY, node->maxZ};
+  for (int a = 0; a < 3; ++a) {
+    const float o = q.origin[a];
+    const float s = stepScale(q.exponent[a]);
+    for (int i = 0; i < N; ++i) {
+      lo[a][i] = o + q.lo[a][i] * s;
+      hi[a][i] = o + q.hi[a][i] * s;
+    }
+  }
+}
+
+template <int N>
+INLINE int intersectChildren(const CompressedWideBVHNode<N>& q,
+                             const TraversalRay& ray,
+                             float* tNear) {
+  WideBVHNode<N> node;
+  decodeBounds(q, &node);
+  return intersectChildren(node, ray, tNear) & q.mask;
+}
+
+// Quantizes the bounds of the children of node. The step on each axis is the
+// smallest power of two that spans the node in 255 steps, or the next one if
+// rounding makes the last plane fall short. Planes are estimated rounding
+// outwards and then moved out until they decode outside the bound.
+template <int N>
+void encode(const WideBVHNode<N>& node, CompressedWideBVHNode<N>* q) {
+  const float* lo[3] = {node.minX, node.minY, node.minZ};
+  const float* hi[3] = {node.maxX, node.maxY, node.maxZ};
+
+  q->mask = 0;
+  for (int i = 0; i < N; ++i) {
+    if (node.child[i] >= 0) q->mask |= 1 << i;
+    q->child[i] = node.child[i];
+    q->count[i] = node.count[i];
+    q->packed[i] = node.packed[i];
+  }
+
+  for (int a = 0; a < 3; ++a) {
+    float o = Infinity, end = -Infinity;
+    for (int i = 0; i < N; ++i) {
+      if (!(q->mask & (1 << i))) continue;
+      o = min(o, lo[a][i]);
+      end = max(end, hi[a][i]);
+    }
+    if (!q->mask) o = end = 0;
+
+    auto quantize = [&](int e) {
+      const float s = std::ldexp(1.0f, e);
+      for (int i = 0; i < N; ++i) {
+        if (!(q->mask & (1 << i))) {
+          q->lo[a][i] = q->hi[a][i] = 0;
+          continue;
+        }
+        int l = clamp(int(std::floor(FloatDown(lo[a][i] - o) / s)), 0, 255);
+        while (l > 0 && o + l * s > lo[a][i]) --l;
+        int h = max(0, int(std::ceil(FloatUp(hi[a][i] - o) / s)));
+        while (h <= 255 && o + h * s < hi[a][i]) ++h;
+        if (h > 255) return false;
+        q->lo[a][i] = l;
+        q->hi[a][i] = h;
+      }
+      return true;
+    };
+
+    int e;
+    std::frexp(FloatUp((end - o) / 255), &e);
+    for (e = clamp(e, -126, 127); !quantize(e); ++e) {
+      CHECK_LT(e, 127) << "Node bounds too large to compress";
+    }
+    q->origin[a] = o;
+    q->exponent[a] = e + 127;
+  }
+}
+
+}  // namespace
+
+// What collapse() needs to know about the binary BVH: the range of primitives
+// under each node, with count 0 when they aren't contiguous, and the mesh of
+// each primitive that is a triangle.
+template <int N>
+struct WideBVH<N>::Builder {
+  Builder(const BVH& bvh) : binary(bvh.nodes) {
+    first.resize(binary.size());
+    count.resize(binary.size());
+    for (int i = binary.size() - 1; i >= 0; --i) {
+      const LinearBVHNode& n = binary[i];
+      if (n.nPrimitives > 0) {
+        first[i] = n.primitivesOffset;
+        count[i] = n.nPrimitives;
+        continue;
+      }
+      int a = i + 1, b = n.secondChildOffset;
+      if (first[b] < first[a]) std::swap(a, b);
+      first[i] = first[a];
+      count[i] = count[a] > 0 && count[b] > 0 &&
+                         first[a] + count[a] == first[b]
+                     ? count[a] + count[b]
+                     : 0;
+    }
+
+    meshes.resize(bvh.primitives.size());
+    ParallelFor(
+        [&](int64_t i) {
+          // Instances and transformed elements hold their triangles in
+          // object space, which packs can't see.
+          const Element* e = bvh.primitives[i].element;
+          if (e->IsInstance() || e->HasTransform()) return;
+          meshes[i] = dynamic_cast<const TriangleMesh*>(e->GetShape());
+        },
+        meshes.size(),
+        16 * 1024);
+  }
+
+  bool AllTriangles(int first, int count) const {
+    for (int i = first; i < first + count; ++i) {
+      if (!meshes[i]) return false;
+    }
+    return true;
+  }
+
+  // Whether the binary node becomes a leaf of the wide BVH.
+  bool IsLeaf(int index) const {
+    return binary[index].nPrimitives > 0 ||
+           (count[index] > 0 && count[index] <= N &&
+            AllTriangles(first[index], count[index]));
+  }
+
+  const Buffer<LinearBVHNode>& binary;
+  std::vector<int32_t> first, count;
+  std::vector<const TriangleMesh*> meshes;
+};
+
+template <int N>
+WideBVH<N>::WideBVH(const BVH& bvh, bool compressNodes)
+    : bounds(bvh.Bound()), elements(bvh.elements), primitives(bvh.primitives) {
+  if (bvh.nodes.empty()) return;
+
+  Builder b(bvh);
+  if (b.IsLeaf(0)) {
+    nodes.emplace_back();
+    setLeaf(b, &nodes[0], 0, bvh.nodes[0].bounds, b.first[0], b.count[0]);
+    for (int i = 1; i < N; ++i) clearChild(&nodes[0], i);
+  } else {
+    nodes.reserve(bvh.nodes.size() / (N - 1) + 1);
+    collapse(b, 0);
+  }
+
+  DVLOG(1) << "BVH" << N << " created with " << nodes.size() << " nodes and "
+           << packs.size() << " triangle packs from " << bvh.nodes.size()
+           << " binary nodes";
+  if (compressNodes) compress();
+}
+
+// Replaces nodes by their quantized version.
+template <int N>
+void WideBVH<N>::compress() {
+  compressedNodes.resize(nodes.size());
+  ParallelFor([&](int64_t i) { encode(nodes[i], &compressedNodes[i]); },
+              nodes.size(),
+              1024);
+  std::vector<WideBVHNode<N>>().swap(nodes);
+}
+
+// Replaces compressedNodes by the nodes they decode to, with the bounds they
+// had rounded outwards.
+template <int N>
+void WideBVH<N>::decompress() {
+  nodes.resize(compressedNodes.size());
+  ParallelFor(
+      [&](int64_t i) {
+        const CompressedWideBVHNode<N>& q = compressedNodes[i];
+        WideBVHNode<N>* node = &nodes[i];
+        decodeBounds(q, node);
+        for (int slot = 0; slot < N; ++slot) {
+          if (!(q.mask & (1 << slot))) {
+            clearChild(node, slot);
+            continue;
+          }
+          node->child[slot] = q.child[slot];
+          node->count[slot] = q.count[slot];
+          node->packed[slot] = q.packed[slot];
+        }
+      },
+      compressedNodes.size(),
+      1024);
+  std::vector<CompressedWideBVHNode<N>>().swap(compressedNodes);
+}
+
+// Fills the slot with a leaf of count primitives from first: TrianglePacks if
+// they are all triangles, or the primitives themselves otherwise.
+template <int N>
+void WideBVH<N>::setLeaf(const Builder& b,
+                         WideBVHNode<N>* node,
+                         int slot,
+                         const AABB& bounds,
+                         int first,
+                         int count) {
+  if (!b.AllTriangles(first, count)) {
+    setChild(node, slot, bounds, first, count);
+    return;
+  }
+
+  const int firstPack = packs.size();
+  for (int i = 0; i < count; i += N) {
+    packs.emplace_back();
+    for (int j = 0; j < N && i + j < count; ++j) {
+      const Primitive& p = primitives[first + i + j];
+      packs.back().Set(j, b.meshes[first + i + j], p.index);
+    }
+  }
+  setChild(node, slot, bounds, firstPack, packs.size() - firstPack);
+  node->packed[slot] = 1;
+}
+
+// Makes a wide node out of the binary interior node at index and returns its
+// position. Nodes are written in depth-first order.
+template <int N>
+int WideBVH<N>::collapse(const Builder& b, int index) {
+  const Buffer<LinearBVHNode>& binary = b.binary;
+  DCHECK(!b.IsLeaf(index));
+
+  int open[N];
+  int nOpen = 0;
+  open[nOpen++] = index + 1;
+  open[nOpen++] = binary[index].secondChildOffset;
+
+  while (nOpen < N) {
+    int best = -1;
+    float bestArea = -1;
+    for (int i = 0; i < nOpen; ++i) {
+      const LinearBVHNode& n = binary[open[i]];
+      if (!b.IsLeaf(open[i]) && n.bounds.SurfaceArea() > bestArea) {
+        best = i;
+        bestArea = n.bounds.SurfaceArea();
+      }
+    }
+    if (best < 0) break;
+
+    int o = open[best];
+    open[best] = o + 1;
+    open[nOpen++] = binary[o].secondChildOffset;
+  }
+
+  const int nodeIndex = nodes.size();
+  nodes.emplace_back();
+
+  int32_t child[N];
+  for (int i = 0; i < nOpen; ++i) {
+    child[i] = b.IsLeaf(open[i]) ? -1 : collapse(b, open[i]);
+  }
+
+  WideBVHNode<N>* node = &nodes[nodeIndex];
+  for (int i = 0; i < nOpen; ++i) {
+    const AABB& bounds = binary[open[i]].bounds;
+    if (child[i] < 0) {
+      setLeaf(b, node, i, bounds, b.first[open[i]], b.count[open[i]]);
+    } else {
+      setChild(node, i, bounds, child[i], 0);
+    }
+  }
+  for (int i = nOpen; i < N; ++i) clearChild(node, i);
+
+  return nodeIndex;
+}
+
+template <int N>
+const AABB WideBVH<N>::Bound() const {
+  return bounds;
+}
+
+template <int N>
+optional<Hit> WideBVH<N>::Intersect(const Ray& r) const {
+  return IsCompressed() ? intersect(compressedNodes, r) : intersect(nodes, r);
+}
+
+template <int N>
+bool WideBVH<N>::IntersectP(const Ray& r) const {
+  return IsCompressed() ? intersectP(compressedNodes, r) : intersectP(nodes, r);
+}
+
+template <int N>
+template <typename Node>
+optional<Hit> WideBVH<N>::intersect(const std::vector<Node>& nodes,
+                                    const Ray& r) const {
+  if (nodes.empty()) return nullopt;
+
+  TraversalRay ray(r);
+  const ShearedRay sheared(r);
+  optional<Hit> hit;
+
+  StackEntry stack[maxStackSize];
+  int stackSize = 0;
+  int current = 0;
+
+  while (true) {
+    const Node& node = nodes[current];
+    alignas(32) float tNear[N];
+    int mask = intersectChildren(node, ray, tNear);
+
+    // Sort the hit children by distance and push the farthest first.
+    int order[N];
+    int nHits = 0;
+    while (mask) {
+      int slot = __builtin_ctz(mask);
+      mask &= mask - 1;
+      int j = nHits++;
+      for (; j > 0 && tNear[order[j - 1]] < tNear[slot]; --j) {
+        order[j] = order[j - 1];
+      }
+      order[j] = slot;
+    }
+    DCHECK_LE(stackSize + nHits, maxStackSize);
+    for (int i = 0; i < nHits; ++i) {
+      int slot = order[i];
+      stack[stackSize++] = {node.child[slot], node.count[slot],
+                            node.packed[slot], tNear[slot]};
+    }
+
+    // Pop until the next interior node, intersecting leaves on the way and
+    // skipping children that start past the closest hit.
+    current = -1;
+    while (stackSize > 0) {
+      const StackEntry& e = stack[--stackSize];
+      if (e.t > ray.maxT) continue;
+      if (e.count == 0) {
+        current = e.child;
+        break;
+      }
+      if (e.packed) {
+        for (int i = 0; i < e.count; ++i) {
+          const TrianglePack<N>& pack = packs[e.child + i];
+          alignas(32) float t[N], b0[N], b1[N], b2[N];
+          int hits = IntersectTrianglePack(pack, ray, sheared, t, b0, b1, b2);
+          if (!hits) continue;
+          int lane = __builtin_ctz(hits);
+          for (hits &= hits - 1; hits; hits &= hits - 1) {
+            int l = __builtin_ctz(hits);
+            if (t[l] < t[lane]) lane = l;
+          }
+          const float b[3] = {b0[lane], b1[lane], b2[lane]};
+          ray.maxT = t[lane];
+          hit = pack.mesh[lane]->TriangleHit(pack.triangle[lane], t[lane], b);
+        }
+        continue;
+      }
+      for (int i = 0; i < e.count; ++i) {
+        optional<Hit> h = primitives[e.child + i].Intersect(ray);
+        if (h) {
+          ray.maxT = h->t;
+          hit = h;
+        }
+      }
+    }
+    if (current < 0) break;
+  }
+
+  return hit;
+}
+
+template <int N>
+template <typename Node>
+bool WideBVH<N>::intersectP(const std::vector<Node>& nodes,
+                            const Ray& r) const {
+  if (nodes.empty()) return false;
+
+  TraversalRay ray(r);
+  const ShearedRay sheared(r);
+  StackEntry stack[maxStackSize];
+  int stackSize = 0;
+  stack[stackSize++] = {0, 0, 0, 0};
+
+  // The first hit ends the search, so children are pushed as they come
+  // rather than sorted by distance.
+  while (stackSize > 0) {
+    const StackEntry e = stack[--stackSize];
+    if (e.packed) {
+      alignas(32) float t[N], b0[N], b1[N], b2[N];
+      for (int i = 0; i < e.count; ++i) {
+        if (IntersectTrianglePack(
+                packs[e.child + i], ray, sheared, t, b0, b1, b2)) {
+          return true;
+        }
+      }
+      continue;
+    }
+    if (e.count > 0) {
+      for (int i = 0; i < e.count; ++i) {
+        if (primitives[e.child + i].IntersectP(ray)) return true;
+      }
+      continue;
+    }
+
+    const Node& node = nodes[e.child];
+    alignas(32) float tNear[N];
+    int mask = intersectChildren(node, ray, tNear);
+    DCHECK_LE(stackSize + __builtin_popcount(mask), maxStackSize);
+    while (mask) {
+      int slot = __builtin_ctz(mask);
+      mask &= mask - 1;
+      stack[stackSize++] = {node.child[slot], node.count[slot],
+                            node.packed[slot], tNear[slot]};
+    }
+  }
+
+  return false;
+}
+
+// Leaves are refit in parallel, re-reading triangle packs from their meshes,
+// then every interior slot takes the bounds of its node, from the last node:
+// children are always written after their parent. Compressed nodes are
+// decoded for it and quantized again after.
+template <int N>
+void WideBVH<N>::Refit(bool rotate) {
+  const bool compressed = IsCompressed();
+  if (compressed) decompress();
+  if (nodes.empty()) return;
+
+  ParallelFor(
+      [&](int64_t i) {
+        WideBVHNode<N>& node = nodes[i];
+        for (int slot = 0; slot < N; ++slot) {
+          if (node.count[slot] == 0) continue;
+          AABB b;
+          if (node.packed[slot]) {
+            for (int k = 0; k < node.count[slot]; ++k) {
+              TrianglePack<N>& pack = packs[node.child[slot] + k];
+              for (int lane = 0; lane < N && pack.mesh[lane]; ++lane) {
+                pack.Set(lane, pack.mesh[lane], pack.triangle[lane]);
+                b = Union(b,
+                          pack.mesh[lane]->PrimitiveBound(pack.triangle[lane]));
+              }
+            }
+          } else {
+            for (int k = 0; k < node.count[slot]; ++k) {
+              b = Union(b, primitives[node.child[slot] + k].Bound());
+            }
+          }
+          setBounds(&node, slot, b);
+        }
+      },
+      nodes.size(),
+      1024);
+
+  auto nodeBounds = [&](const WideBVHNode<N>& node) {
+    Vector3 lo(Infinity, Infinity, Infinity);
+    Vector3 hi(-Infinity, -Infinity, -Infinity);
+    for (int slot = 0; slot < N; ++slot) {
+      lo = min(lo, Vector3(node.minX[slot], node.minY[slot], node.minZ[slot]));
+      hi = max(hi, Vector3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]));
+    }
+    return AABB(lo, hi);
+  };
+  for (int i = nodes.size() - 1; i >= 0; --i) {
+    WideBVHNode<N>& node = nodes[i];
+    for (int slot = 0; slot < N; ++slot) {
+      if (node.count[slot] == 0 && node.child[slot] >= 0) {
+        setBounds(&node, slot, nodeBounds(nodes[node.child[slot]]));
+      }
+    }
+  }
+  bounds = nodeBounds(nodes[0]);
+  if (compressed) compress();
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+}  // namespace skirt
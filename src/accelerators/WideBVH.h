@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "accelerators/BVH.h"
+#include "accelerators/TrianglePack.h"
+#include "core/AABB.h"
+#include "core/Accelerator.h"
+#include "core/Element.h"
+#include "core/Primitive.h"
+
+namespace skirt {
+
+/*
+N-wide node, with the bounds of its children stored as structure of arrays so
+a ray can be tested against all of them in one SSE (N = 4) or AVX (N = 8)
+pass.
+
+child[i] is the index of an interior node when count[i] == 0. Otherwise it is
+the first of count[i] primitives of a leaf, or the first of count[i]
+TrianglePacks when packed[i] is set. Unused slots have empty bounds, which no
+ray can hit.
+*/
+template <int N>
+struct alignas(N * sizeof(float)) WideBVHNode {
+  float minX[N], minY[N], minZ[N];
+  float maxX[N], maxY[N], maxZ[N];
+  int32_t child[N];
+  uint8_t count[N];
+  uint8_t packed[N];
+};
+
+/*
+WideBVHNode with the bounds of its children quantized to 8 bits per plane.
+A plane q on axis a is at origin[a] + q * 2^(exponent[a] - 127): steps are a
+power of two, so decoding rounds only once, and planes are rounded outwards,
+so decoded bounds always contain the child. At about half the size of a
+WideBVHNode, twice as many nodes fit in the caches.
+
+mask has a bit set for each slot in use, as empty bounds can't be quantized.
+*/
+template <int N>
+struct alignas(16) CompressedWideBVHNode {
+  float origin[3];
+  uint8_t exponent[3];
+  uint8_t mask;
+  uint8_t lo[3][N], hi[3][N];
+  int32_t child[N];
+  uint8_t count[N];
+  uint8_t packed[N];
+};
+
+/*
+BVH with N children per node, made by collapsing a binary BVH: starting from
+the two children of a node, the child with the largest surface area is
+replaced by its own children until there are N of them. Children are visited
+front to back.
+
+Leaves made only of triangles are stored as TrianglePacks of N triangles, and
+binary subtrees with up to N triangles in all become a single packed leaf, so
+leaves are tested with the same width as nodes.
+
+When compressed, nodes are stored as CompressedWideBVHNodes instead, which
+trades a little work decoding each node for half the memory.
+*/
+template <int N>
+class WideBVH : public Accelerator {
+  static_assert(N == 4 || N == 8, "WideBVH supports 4 or 8 wide nodes");
+
+ public:
+  explicit WideBVH(const BVH& bvh, bool compressNodes = false);
+
+  virtual const AABB Bound() const;
+  virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
+  // Refits bounds and triangle packs in place. Wide nodes are never rotated.
+  virtual void Refit(bool rotate);
+
+  INLINE bool IsCompressed() const {
+    return !compressedNodes.empty();
+  }
+
+  AABB bounds;
+  std::vector<shared_ptr<Element>> elements;
+  std::vector<Primitive> primitives;
+  // Only one of nodes and compressedNodes is used.
+  std::vector<WideBVHNode<N>> nodes;
+  std::vector<CompressedWideBVHNode<N>> compressedNodes;
+  std::vector<TrianglePack<N>> packs;
+
+ private:
+  struct Builder;
+  template <typename Node>
+  optional<Hit> intersect(const std::vector<Node>& nodes, const Ray& r) const;
+  template <typename Node>
+  bool intersectP(const std::vector<Node>& nodes, const Ray& r) const;
+  void compress();
+  void decompress();
+  int collapse(const Builder& b, int index);
+  void setLeaf(const Builder& b,
+               WideBVHNode<N>* node,
+               int slot,
+               const AABB& bounds,
+               int first,
+               int count);
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
+
+}  // namespace skirt
@@ -0,0 +1,114 @@
+// Memory and closest hit rays per second of 4 and 8 wide BVHs over a bumpy
+// sphere, with full float and quantized nodes. Rays are traced on every
+// thread of the pool.
+//
+//   skirt_bench compressedbvh [triangles] [rays]
+
+#include <atomic>
+#include <chrono>
+#include <random>
+
+#include "core/skirt.h"
+
+#include "accelerators/BVH.h"
+#include "accelerators/WideBVH.h"
+#include "bench/bench.h"
+#include "core/Parallel.h"
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+namespace {
+
+// A sphere of res * res quads with ridges, so nodes overlap a little as they
+// do on real meshes.
+shared_ptr<TriangleMesh> bumpySphere(int res) {
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  for (int j = 0; j <= res; ++j) {
+    const float theta = PI * j / res;
+    for (int i = 0; i <= res; ++i) {
+      const float phi = 2 * PI * i / res;
+      const float r = 1 + 0.05f * sin(20 * theta) * sin(20 * phi);
+      mesh->AddVertex(r * Vector3(sin(theta) * cos(phi),
+                                  sin(theta) * sin(phi), cos(theta)));
+    }
+  }
+  for (int j = 0; j < res; ++j) {
+    for (int i = 0; i < res; ++i) {
+      const int v = j * (res + 1) + i;
+      mesh->AddTriangle(v, v + 1, v + res + 2);
+      mesh->AddTriangle(v, v + res + 2, v + res + 1);
+    }
+  }
+  return mesh;
+}
+
+// Rays from a sphere of radius 3 towards points inside the mesh bounds.
+std::vector<Ray> makeRays(int count) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> u(-1, 1);
+  std::vector<Ray> rays;
+  rays.reserve(count);
+  while (int(rays.size()) < count) {
+    Vector3 o(u(rng), u(rng), u(rng));
+    if (o.LengthSq() > 1 || o.LengthSq() < 1e-3) continue;
+    o = 3 * Normalize(o);
+    rays.emplace_back(o, Vector3(u(rng), u(rng), u(rng)) - o);
+  }
+  return rays;
+}
+
+template <int N>
+void run(const BVH& bvh, const std::vector<Ray>& rays, bool compress) {
+  WideBVH<N> wide(bvh, compress);
+  const double nodeBytes =
+      compress ? wide.compressedNodes.size() * sizeof(wide.compressedNodes[0])
+               : wide.nodes.size() * sizeof(wide.nodes[0]);
+  const double packBytes = wide.packs.size() * sizeof(wide.packs[0]);
+
+  std::atomic<int64_t> hits(0);
+  auto trace = [&]() {
+    ParallelFor(
+        [&](int64_t chunk) {
+          int64_t h = 0;
+          const int64_t end = min<int64_t>(rays.size(), (chunk + 1) * 4096);
+          for (int64_t i = chunk * 4096; i < end; ++i) {
+            h += bool(wide.Intersect(rays[i]));
+          }
+          hits += h;
+        },
+        (rays.size() + 4095) / 4096);
+  };
+  trace();
+  hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  trace();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  printf("BVH%d %-10s nodes %6.2f MB packs %6.2f MB %7.3f Mrays/s %ld hits\n",
+         N, compress ? "compressed" : "float", nodeBytes / (1 << 20),
+         packBytes / (1 << 20), rays.size() / seconds / 1e6, long(hits));
+}
+
+}  // namespace
+
+int CompressedBVHBench(int argc, char** argv) {
+  const int triangles = argc > 0 ? atoi(argv[0]) : 2000000;
+  const int nRays = argc > 1 ? atoi(argv[1]) : 4000000;
+
+  const int res = max(1, int(sqrt(triangles / 2)));
+  std::vector<shared_ptr<Element>> elements = {
+      shared_ptr<Element>(new Element(bumpySphere(res)))};
+  BVH bvh(elements);
+  const std::vector<Ray> rays = makeRays(nRays);
+  printf("%d triangles, %d rays, %d threads\n", 2 * res * res, nRays,
+         ParallelThreadCount());
+
+  for (bool compress : {false, true}) run<4>(bvh, rays, compress);
+  for (bool compress : {false, true}) run<8>(bvh, rays, compress);
+  return 0;
+}
+
+}  // namespace skirt
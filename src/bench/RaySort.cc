@@ -0,0 +1,96 @@
+// Wavefront rendering of a Cornell style box, with and without sorting the
+// bounce rays.
+//
+//   skirt_bench raysort [spp] [both|sorted|unsorted] [width] [height] [tile]
+//
+// Each tile traces its tile width * height * spp rays as one queue, and the
+// sort only pays for itself once that queue is much larger than the caches.
+// The defaults render the whole 200x100 film as a single tile at 64 spp, 1.28M
+// rays per bounce against a BVH of 200k boxes. The camera spans 200x100
+// pixels, so a larger film looks past the box. Compare cache misses with
+//
+//   perf stat -e cache-misses,cache-references skirt_bench raysort 64 unsorted
+//   perf stat -e cache-misses,cache-references skirt_bench raysort 64 sorted
+//
+// On a single core VM at -O2, with no hardware counters for perf to read, the
+// throughput was:
+//
+//   64 spp, 200 pixel tile (1.28M rays): 0.885 unsorted, 0.932 sorted Mrays/s
+//   16 spp, 200 pixel tile (320k rays):  0.636 unsorted, 0.593 sorted Mrays/s
+//   16 spp, 64 pixel tiles (64k rays):   0.546 unsorted, 0.525 sorted Mrays/s
+
+#include <algorithm>
+#include <random>
+
+#include "core/skirt.h"
+
+#include "bench/bench.h"
+#include "core/Parallel.h"
+#include "core/Renderer.h"
+#include "core/Scene.h"
+#include "shapes/Box.h"
+#include "shapes/Sphere.h"
+
+namespace skirt {
+
+namespace {
+
+void addBox(Scene* scene, const Vector3& minp, const Vector3& maxp) {
+  shared_ptr<Shape> box(new Box(AABB(minp, maxp)));
+  scene->AddElement(shared_ptr<Element>(new Element(box)));
+}
+
+// Floor, ceiling, back and side walls, open towards the camera, with two
+// blocks and a sphere inside and the floor covered in small boxes so the BVH
+// doesn't fit in the caches.
+unique_ptr<const Scene> cornellScene(bool sortRays) {
+  unique_ptr<Scene> scene(new Scene());
+  scene->desc.reset(new Description);
+  scene->desc->integratorType = "wavefront";
+  scene->desc->sortRays = sortRays;
+
+  addBox(scene.get(), Vector3(-2, -1.1, -5), Vector3(2, -1, 0.5));
+  addBox(scene.get(), Vector3(-2, 2, -5), Vector3(2, 2.1, 0.5));
+  addBox(scene.get(), Vector3(-2, -1, -5.1), Vector3(2, 2, -5));
+  addBox(scene.get(), Vector3(-2.1, -1, -5), Vector3(-2, 2, 0.5));
+  addBox(scene.get(), Vector3(2, -1, -5), Vector3(2.1, 2, 0.5));
+  addBox(scene.get(), Vector3(-1.5, -1, -4), Vector3(-0.6, 0.8, -3));
+  addBox(scene.get(), Vector3(0.6, -1, -3.5), Vector3(1.4, -0.2, -2.7));
+  scene->AddElement(
+      shared_ptr<Element>(new Element(shared_ptr<Shape>(new Sphere(0.5)))));
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> x(-2, 2), z(-5, 0.5), size(0.01, 0.05);
+  for (int i = 0; i < 200000; ++i) {
+    Vector3 p(x(rng), -1, z(rng));
+    addBox(scene.get(), p, p + Vector3(size(rng), size(rng), size(rng)));
+  }
+
+  return unique_ptr<const Scene>(scene->Bake(move(scene)));
+}
+
+void run(bool sortRays, int spp, int width, int height, int tileSize) {
+  unique_ptr<const Scene> scene = cornellScene(sortRays);
+  Film film(width, height, "raysort.exr");
+  Renderer renderer(scene.get(), tileSize);
+  renderer.pixelSamples = spp;
+  renderer.Render(&film);
+  printf("%-8s %6.2fs %8.3f Mrays/s\n", sortRays ? "sorted" : "unsorted",
+         renderer.stats.seconds, renderer.stats.RaysPerSecond() / 1e6);
+}
+
+}  // namespace
+
+int RaySortBench(int argc, char** argv) {
+  const int spp = argc > 0 ? atoi(argv[0]) : 64;
+  const std::string mode = argc > 1 ? argv[1] : "both";
+  const int width = argc > 2 ? atoi(argv[2]) : 200;
+  const int height = argc > 3 ? atoi(argv[3]) : 100;
+  const int tileSize = argc > 4 ? atoi(argv[4]) : std::max(width, height);
+
+  if (mode != "sorted") run(false, spp, width, height, tileSize);
+  if (mode != "unsorted") run(true, spp, width, height, tileSize);
+  return 0;
+}
+
+}  // namespace skirt
@@ -0,0 +1,9 @@
+#pragma once
+
+namespace skirt {
+
+// Benchmarks run by skirt_bench, each given the arguments after its name.
+int RaySortBench(int argc, char** argv);
+int CompressedBVHBench(int argc, char** argv);
+
+}  // namespace skirt
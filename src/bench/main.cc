@@ -0,0 +1,29 @@
+// Runs one of the benchmarks by name:
+//
+//   skirt_bench raysort [spp] [both|sorted|unsorted] [width] [height] [tile]
+//   skirt_bench compressedbvh [triangles] [rays]
+
+#include "core/skirt.h"
+
+#include "bench/bench.h"
+#include "core/Parallel.h"
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  const std::string name = argc > 1 ? argv[1] : "";
+
+  int (*bench)(int, char**) = nullptr;
+  if (name == "raysort") {
+    bench = skirt::RaySortBench;
+  } else if (name == "compressedbvh") {
+    bench = skirt::CompressedBVHBench;
+  } else {
+    fprintf(stderr, "usage: %s raysort|compressedbvh [args]\n", argv[0]);
+    return 1;
+  }
+
+  skirt::ParallelInit();
+  const int result = bench(argc - 2, argv + 2);
+  skirt::ParallelCleanup();
+  return result;
+}
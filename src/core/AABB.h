@@ -2,6 +2,8 @@
 
 #include "skirt.h"
 
+#include "core/Ray.h"
+
 namespace skirt {
 
 class AABB {
@@ -67,6 +69,9 @@ class AABB {
 
   INLINE tuple<Vector3, float> BoundingSphere() const;
 
+  INLINE bool IntersectP(const TraversalRay& ray,
+                         float* hitt0 = nullptr) const;
+
   INLINE bool operator==(const AABB& o) const {
     return o.minp == minp && o.maxp == maxp;
   }
@@ -109,6 +114,28 @@ INLINE tuple<Vector3, float> AABB::BoundingSphere() const {
   return make_tuple(center, radius);
 }
 
+// Slab test without branches: the direction signs pick the near and far
+// planes, and the far distances are scaled up by the gamma(3) bound on the
+// error of (p - o) * invDir, so rays that graze the box are never missed.
+// max(a, b) and min(a, b) return a when b is NaN, so each slab is folded into
+// the running interval as b: a NaN slab puts no limit on the ray.
+INLINE bool AABB::IntersectP(const TraversalRay& ray, float* hitt0) const {
+  const AABB& b = *this;
+  float txMin = (b[ray.dirIsNeg[0]].x - ray.origin.x) * ray.invDir.x;
+  float txMax = (b[1 - ray.dirIsNeg[0]].x - ray.origin.x) * ray.invDir.x;
+  float tyMin = (b[ray.dirIsNeg[1]].y - ray.origin.y) * ray.invDir.y;
+  float tyMax = (b[1 - ray.dirIsNeg[1]].y - ray.origin.y) * ray.invDir.y;
+  float tzMin = (b[ray.dirIsNeg[2]].z - ray.origin.z) * ray.invDir.z;
+  float tzMax = (b[1 - ray.dirIsNeg[2]].z - ray.origin.z) * ray.invDir.z;
+
+  constexpr float scale = 1 + 2 * gamma(3);
+  float tMin = max(max(max(ray.minT, txMin), tyMin), tzMin);
+  float tMax = min(min(min(ray.maxT, txMax * scale), tyMax * scale),
+                   tzMax * scale);
+  if (hitt0) *hitt0 = tMin;
+  return tMin <= tMax;
+}
+
 INLINE float DistanceSq(const AABB& b, const Vector3& p) {
   float dx = max(0.0f, max(b.minp.x - p.x, p.x - b.maxp.x));
   float dy = max(0.0f, max(b.minp.y - p.y, p.y - b.maxp.y));
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "core/skirt.h"
+
+#include "core/AABB.h"
+#include "core/Hit.h"
+#include "core/Ray.h"
+
+namespace skirt {
+
+/*
+An Accelerator is built once by Scene::Bake() over all the scene Elements and
+answers ray queries against all of them.
+*/
+class Accelerator {
+ public:
+  static constexpr int MaxPacketSize = 16;
+
+  virtual ~Accelerator() = default;
+  virtual const AABB Bound() const = 0;
+  virtual optional<Hit> Intersect(const Ray& r) const = 0;
+
+  // Occlusion query, for shadow rays: true as soon as any element is hit
+  // between minT and maxT, in no particular order.
+  virtual bool IntersectP(const Ray& r) const = 0;
+
+  // Recomputes the bounds of the tree from the current bounds of the
+  // elements, which may have moved or deformed but not been added or
+  // removed. It keeps the tree built by the constructor unless rotate is set,
+  // in which case accelerators may also restructure it locally.
+  virtual void Refit(bool rotate) = 0;
+
+  // Intersects count <= MaxPacketSize rays, meant to be coherent, like
+  // neighbouring camera rays. Accelerators without packet traversal answer
+  // one ray at a time.
+  virtual void IntersectPacket(const Ray* rays,
+                               int count,
+                               optional<Hit>* hits) const {
+    for (int i = 0; i < count; ++i) hits[i] = Intersect(rays[i]);
+  }
+};
+
+}  // namespace skirt
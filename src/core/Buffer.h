@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+/*
+Array of T that either owns its elements or is a read-only view of memory
+kept alive by someone else, like a file mapped by several processes at once.
+Writes go through Mutable(), which copies a view into owned memory first.
+*/
+template <typename T>
+class Buffer {
+ public:
+  Buffer() {}
+  Buffer(std::vector<T>&& v) : owned(move(v)) {}
+  Buffer(const T* data, size_t size, shared_ptr<const void> keepAlive)
+      : view(data), viewSize(size), keepAlive(move(keepAlive)), isView(true) {}
+
+  INLINE const T* data() const {
+    return isView ? view : owned.data();
+  }
+  INLINE size_t size() const {
+    return isView ? viewSize : owned.size();
+  }
+  INLINE bool empty() const {
+    return size() == 0;
+  }
+  INLINE const T& operator[](size_t i) const {
+    return data()[i];
+  }
+  INLINE const T* begin() const {
+    return data();
+  }
+  INLINE const T* end() const {
+    return data() + size();
+  }
+
+  INLINE bool IsView() const {
+    return isView;
+  }
+
+  std::vector<T>& Mutable() {
+    if (isView) {
+      owned.assign(view, view + viewSize);
+      view = nullptr;
+      viewSize = 0;
+      keepAlive.reset();
+      isView = false;
+    }
+    return owned;
+  }
+
+ private:
+  std::vector<T> owned;
+  const T* view = nullptr;
+  size_t viewSize = 0;
+  shared_ptr<const void> keepAlive;
+  bool isView = false;
+};
+
+}  // namespace skirt
@@ -4,14 +4,70 @@
 
 namespace skirt {
 
+Element::Element(shared_ptr<Shape> shape, const Matrix4& objectToWorld)
+    : shape(shape),
+      hasTransform(true),
+      objectToWorld(objectToWorld),
+      worldToObject(Inverse(objectToWorld)) {}
+
+Element::Element(shared_ptr<Shape> shape,
+                 const Matrix4& objectToWorld,
+                 const Matrix4& worldToObject)
+    : shape(shape),
+      hasTransform(true),
+      objectToWorld(objectToWorld),
+      worldToObject(worldToObject) {}
+
 Element::~Element() {}
 
+void Element::SetTransform(const Matrix4& m) {
+  hasTransform = true;
+  objectToWorld = m;
+  worldToObject = Inverse(m);
+}
+
+// The ray's direction keeps its scale through the transform, so t is the same
+// in both spaces.
+optional<Hit> Element::toWorld(optional<Hit> hit) const {
+  if (!hit || !hasTransform) return hit;
+  hit->p = Transform(objectToWorld, hit->p);
+  hit->normal = Normalize(TransformNormal(worldToObject, hit->normal));
+  return hit;
+}
+
 const AABB Element::Bound() const {
-  return shape->Bound();
+  const AABB bound = instance ? instance->Bound() : shape->Bound();
+  return hasTransform ? Transform(objectToWorld, bound) : bound;
 }
 
 optional<Hit> Element::Intersect(const Ray& r) const {
-  return shape->Intersect(r);
+  const Ray o = toObject(r);
+  return toWorld(instance ? instance->Intersect(o) : shape->Intersect(o));
+}
+
+bool Element::IntersectP(const Ray& r) const {
+  const Ray o = toObject(r);
+  return instance ? instance->IntersectP(o) : shape->IntersectP(o);
+}
+
+int Element::PrimitiveCount() const {
+  return instance ? 1 : shape->PrimitiveCount();
+}
+
+const AABB Element::PrimitiveBound(int i) const {
+  if (instance) return Bound();
+  const AABB bound = shape->PrimitiveBound(i);
+  return hasTransform ? Transform(objectToWorld, bound) : bound;
+}
+
+optional<Hit> Element::IntersectPrimitive(const Ray& r, int i) const {
+  if (instance) return Intersect(r);
+  return toWorld(shape->IntersectPrimitive(toObject(r), i));
+}
+
+bool Element::IntersectPrimitiveP(const Ray& r, int i) const {
+  if (instance) return IntersectP(r);
+  return shape->IntersectPrimitiveP(toObject(r), i);
 }
 
 }  // namespace skirt
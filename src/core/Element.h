@@ -3,21 +3,80 @@
 #include "core/skirt.h"
 
 #include "core/AABB.h"
+#include "core/Accelerator.h"
 #include "core/Hit.h"
+#include "core/Matrix4.h"
 #include "core/Ray.h"
 #include "core/Shape.h"
 
 namespace skirt {
 
+/*
+Something placed in the scene, made of a Shape. The shape is always in object
+space, and the element's transform places it in world space: rays are brought
+into object space for the shape and hits are taken back to world space.
+
+A shape made of many primitives, used by several elements or moved by a
+transform, gets its own object space accelerator at Scene::Bake(). Elements
+using it become instances: a single primitive for the scene accelerator, so
+the shape's primitives are stored once however many times it is placed.
+*/
 class Element {
  public:
   Element(shared_ptr<Shape> shape) : shape(shape) {}
+  Element(shared_ptr<Shape> shape, const Matrix4& objectToWorld);
+  // With the inverse transform already known, as compiled scenes store it.
+  Element(shared_ptr<Shape> shape,
+          const Matrix4& objectToWorld,
+          const Matrix4& worldToObject);
   virtual ~Element();
   virtual const AABB Bound() const;
   virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
+
+  virtual int PrimitiveCount() const;
+  virtual const AABB PrimitiveBound(int i) const;
+  virtual optional<Hit> IntersectPrimitive(const Ray& r, int i) const;
+  virtual bool IntersectPrimitiveP(const Ray& r, int i) const;
+
+  INLINE const Shape* GetShape() const {
+    return shape.get();
+  }
+  INLINE const shared_ptr<Shape>& GetSharedShape() const {
+    return shape;
+  }
+
+  INLINE bool HasTransform() const {
+    return hasTransform;
+  }
+  // Moves the element, for animation. The scene accelerators keep the old
+  // bounds until Scene::Refit().
+  void SetTransform(const Matrix4& objectToWorld);
+  INLINE const Matrix4& ObjectToWorld() const {
+    return objectToWorld;
+  }
+  INLINE const Matrix4& WorldToObject() const {
+    return worldToObject;
+  }
+
+  // Intersects the shape through accel, built over it in object space.
+  INLINE void SetInstance(const Accelerator* accel) {
+    instance = accel;
+  }
+  INLINE bool IsInstance() const {
+    return instance != nullptr;
+  }
 
  private:
+  INLINE Ray toObject(const Ray& r) const {
+    return hasTransform ? Transform(worldToObject, r) : r;
+  }
+  optional<Hit> toWorld(optional<Hit> hit) const;
+
   shared_ptr<Shape> shape;
+  bool hasTransform = false;
+  Matrix4 objectToWorld, worldToObject;
+  const Accelerator* instance = nullptr;
 };
 
 }  // namespace skirt
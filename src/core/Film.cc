@@ -5,6 +5,8 @@
 
 #include "core/skirt.h"
 
+#include "core/Parallel.h"
+
 #include "3rdp/lodepng.h"
 #define TINYEXR_IMPLEMENTATION
 #include "3rdp/tinyexr.h"
@@ -27,6 +29,58 @@ void Film::MergeTile(const FilmTile& tile) {
   }
 }
 
+void Film::AccumulateTile(const FilmTile& tile) {
+  for (int y = 0; y < tile.height; ++y) {
+    for (int x = 0; x < tile.width; ++x) {
+      const int i = x + y * tile.width;
+      if (tile.weights[i] == 0) continue;
+      const int p = (x + tile.x) + (y + tile.y) * width;
+      sums[3 * p].Add(tile.data[i].x);
+      sums[3 * p + 1].Add(tile.data[i].y);
+      sums[3 * p + 2].Add(tile.data[i].z);
+      weights[p].Add(tile.weights[i]);
+
+      const int64_t n = tile.variance[3 * i].Count();
+      if (n == 0) continue;
+      sampleCounts[p] += n;
+      for (int c = 0; c < 3; ++c) {
+        const VarianceEstimator& v = tile.variance[3 * i + c];
+        const double mean = v.Mean();
+        moments[6 * p + 2 * c].Add(n * mean);
+        moments[6 * p + 2 * c + 1].Add(v.Variance() * (n - 1) +
+                                       n * mean * mean);
+      }
+    }
+  }
+}
+
+float Film::RelativeError(int x, int y) const {
+  const int p = x + y * width;
+  const int64_t n = sampleCounts[p];
+  if (n < 2) return Infinity;
+  double error = 0;
+  for (int c = 0; c < 3; ++c) {
+    const double sum = moments[6 * p + 2 * c];
+    const double mean = sum / n;
+    const double variance =
+        max(0.0, (moments[6 * p + 2 * c + 1] - sum * mean) / (n - 1));
+    error = max(error, std::sqrt(variance / n) / max(mean, 0.01));
+  }
+  return error;
+}
+
+void Film::Resolve() {
+  ParallelFor(
+      [&](int64_t y) {
+        for (int p = y * width; p < (y + 1) * width; ++p) {
+          const float w = weights[p];
+          if (w == 0) continue;
+          data[p] = Vector3(sums[3 * p], sums[3 * p + 1], sums[3 * p + 2]) / w;
+        }
+      },
+      height, 16);
+}
+
 // http://netpbm.sourceforge.net/doc/pfm.html
 void Film::SaveImagePFM() {
   DVLOG(1) << "Saving file PFM: " << filename;
@@ -73,19 +127,21 @@ void Film::SaveImagePNG() {
   std::unique_ptr<unsigned char[]> image(
       new unsigned char[width * height * 4]());
 
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      const Vector3& v = data[x + y * width];
-      int r = int(255.99 * v.x);
-      int g = int(255.99 * v.y);
-      int b = int(255.99 * v.z);
-      const int p = (x + y * width) * 4;
-      image[p] = r;
-      image[p + 1] = g;
-      image[p + 2] = b;
-      image[p + 3] = 255;
-    }
-  }
+  ParallelFor(
+      [&](int64_t y) {
+        for (int x = 0; x < width; ++x) {
+          const Vector3& v = data[x + y * width];
+          int r = int(255.99 * v.x);
+          int g = int(255.99 * v.y);
+          int b = int(255.99 * v.z);
+          const int p = (x + y * width) * 4;
+          image[p] = r;
+          image[p + 1] = g;
+          image[p + 2] = b;
+          image[p + 3] = 255;
+        }
+      },
+      height, 16);
 
   unsigned int error = lodepng::encode(filename, image.get(), width, height);
   if (error) {
@@ -109,12 +165,16 @@ void Film::SaveImageEXR() {
   images[1].resize(width * height);
   images[2].resize(width * height);
 
-  for (int i = 0; i < width * height; i++) {
-    const Vector3& v = data[i];
-    images[0][i] = v.x;
-    images[1][i] = v.y;
-    images[2][i] = v.z;
-  }
+  ParallelFor(
+      [&](int64_t y) {
+        for (int i = y * width; i < (y + 1) * width; i++) {
+          const Vector3& v = data[i];
+          images[0][i] = v.x;
+          images[1][i] = v.y;
+          images[2][i] = v.z;
+        }
+      },
+      height, 16);
 
   float* image_ptr[3];
   image_ptr[0] = &(images[2].at(0));  // B
@@ -1,42 +1,134 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include "core/skirt.h"
 
+#include "core/Parallel.h"
+
 namespace skirt {
 
+/*
+Running mean and variance of a stream of values, with Welford's update. Each
+tile keeps one per pixel channel, and Film::AccumulateTile() adds the sums
+they stand for to the film's.
+*/
+class VarianceEstimator {
+ public:
+  INLINE void Add(float x) {
+    count++;
+    double delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+  }
+
+  INLINE int64_t Count() const {
+    return count;
+  }
+  INLINE double Mean() const {
+    return mean;
+  }
+  INLINE double Variance() const {
+    return count > 1 ? m2 / (count - 1) : 0;
+  }
+
+ private:
+  int64_t count = 0;
+  double mean = 0, m2 = 0;
+};
+
+/*
+Rectangle of pixels rendered by a single thread. Pixels are either written
+once with WritePixel(), to be copied into the Film with MergeTile(), or built
+up with AddSample() as a weighted sum, to be added to the Film with
+AccumulateTile(), which also tracks the variance of each channel.
+Pixels whose flag in `active` is false are left alone by the Integrator; an
+empty `active` means every pixel is rendered. filmWidth, the width of the
+whole film, numbers the pixels so each gets its own random sequence.
+*/
 class FilmTile {
  public:
-  FilmTile(int x, int y, int width, int height)
-      : x(x), y(y), width(width), height(height) {
+  FilmTile(int x, int y, int width, int height, int filmWidth)
+      : x(x), y(y), width(width), height(height), filmWidth(filmWidth) {
     data.resize(width * height);
+    weights.resize(width * height);
+    variance.resize(3 * width * height);
+  }
+
+  INLINE bool IsActive(int x, int y) const {
+    return active.empty() || active[x + y * width];
   }
 
   INLINE void WritePixel(int x, int y, const Vector3& rgb) {
     data[x + y * width] = rgb;
   }
 
+  INLINE void AddSample(int x, int y, const Vector3& rgb, float weight = 1) {
+    data[x + y * width] += weight * rgb;
+    weights[x + y * width] += weight;
+    const int p = x + y * width;
+    variance[3 * p].Add(rgb.x);
+    variance[3 * p + 1].Add(rgb.y);
+    variance[3 * p + 2].Add(rgb.z);
+  }
+
   int x, y;
   int width, height;
+  int filmWidth;
   std::vector<Vector3> data;
+  std::vector<float> weights;
+  std::vector<VarianceEstimator> variance;  // 3 per pixel
+  std::vector<uint8_t> active;
 };
 
 class Film {
  public:
   Film(int width, int height, string filename)
-      : width(width), height(height), filename(filename) {
+      : width(width),
+        height(height),
+        filename(filename),
+        sums(new AtomicFloat[3 * width * height]),
+        weights(new AtomicFloat[width * height]),
+        moments(new AtomicDouble[6 * width * height]),
+        sampleCounts(new std::atomic<int64_t>[width * height]()) {
     data.resize(width * height);
   }
 
+  // Copies the pixels of tile into data. Tiles never overlap, so this can be
+  // called from many threads at once without locking.
   void MergeTile(const FilmTile& tile);
 
+  // Adds the weighted samples of tile to the per pixel sums and variance
+  // estimates. Tiles covering the same pixels, like successive passes, may be
+  // added concurrently.
+  void AccumulateTile(const FilmTile& tile);
+
+  // Largest standard error of the mean of a channel of pixel (x, y), relative
+  // to that mean, which is clamped to 0.01 so black pixels can converge.
+  // Infinity until the pixel has two samples.
+  float RelativeError(int x, int y) const;
+
+  // Sets data to the weighted mean of the accumulated samples, for every
+  // pixel that has any.
+  void Resolve();
+
   void SaveImage();
 
   std::vector<Vector3> data;
   int width, height;
   string filename;
 
+  // Running sums of AccumulateTile(): rgb and weight per pixel.
+  unique_ptr<AtomicFloat[]> sums;
+  unique_ptr<AtomicFloat[]> weights;
+  // What RelativeError() needs from the tiles' variance estimates: the sum of
+  // the samples and of their squares, per channel, and the number of samples
+  // per pixel. Unlike the estimators these are merged by plain additions.
+  unique_ptr<AtomicDouble[]> moments;  // 6 per pixel
+  unique_ptr<std::atomic<int64_t>[]> sampleCounts;
+
  private:
   void SaveImagePFM();
   void SaveImagePBM();
@@ -3,10 +3,10 @@
 #include "core/Vector3.h"
 #include "core/skirt.h"
 
-class Element;
-
 namespace skirt {
 
+class Element;
+
 class Hit {
  public:
   Hit(float t, const Vector3& p, const Vector3& normal)
@@ -15,7 +15,7 @@ class Hit {
   float t;
   Vector3 p;
   Vector3 normal;
-  Element* element;
+  Element* element = nullptr;
 };
 
 }  // namespace skirt
@@ -1,52 +1,91 @@
 #include "core/Integrator.h"
 
 #include "core/Hit.h"
+#include "core/Random.h"
 #include "core/Scene.h"
 #include "core/skirt.h"
 
 namespace skirt {
 
-Vector3 SamplerIntegrator::color(const Ray& r) {
-  optional<Hit> hit = scene->root->Intersect(r);
-  if (hit) {
-    Vector3 n = Normalize(hit->p - Vector3(0, 0, -1));
-    return 0.5 * (n + Vector3(1, 1, 1));
-  }
+Ray Integrator::cameraRay(float x, float y) const {
+  const int WIDTH = 200;
+  const int HEIGHT = 100;
+
+  Vector3 llc(-2, -1, -1);
+  Vector3 hor(4, 0, 0);
+  Vector3 ver(0, 2, 0);
+  Vector3 origin(0, 0, 0);
+
+  float u = x / WIDTH;
+  float v = y / HEIGHT;
+  return Ray(origin, llc + u * hor + v * ver);
+}
 
-  Vector3 ud = Normalize(r.direction);
+Vector3 Integrator::background(const Vector3& direction) {
+  Vector3 ud = Normalize(direction);
   float t = 0.5 * (ud.y + 1);
   return (1.0 - t) * Vector3(1, 1, 1) + t * Vector3(0.5, 0.7, 1.0);
 }
 
-FilmTile SamplerIntegrator::Render(int x0, int y0, int width, int height) {
-  FilmTile tile(x0, y0, width, height);
+Vector3 SamplerIntegrator::color(const Ray& r, const optional<Hit>& hit) {
+  if (hit) {
+    Vector3 n = Normalize(hit->p - Vector3(0, 0, -1));
+    return 0.5 * (n + Vector3(1, 1, 1));
+  }
 
-  int WIDTH = 200;
-  int HEIGHT = 100;
+  return background(r.direction);
+}
 
-  Vector3 llc(-2, -1, -1);
-  Vector3 hor(4, 0, 0);
-  Vector3 ver(0, 2, 0);
-  Vector3 origin(0, 0, 0);
+void SamplerIntegrator::Render(FilmTile* tile, int firstSample, int nSamples) {
+  // Blocks of packetSize pixels, as square as possible.
+  int blockWidth = 1;
+  while (blockWidth * blockWidth < packetSize) blockWidth *= 2;
+  const int blockHeight = max(1, packetSize / blockWidth);
 
-  for (int i = 0; i < width; ++i) {
-    for (int j = 0; j < height; ++j) {
-      int x = x0 + i;
-      int y = HEIGHT - y0 - height + j;
+  int px[Accelerator::MaxPacketSize], py[Accelerator::MaxPacketSize];
+  RNG rng[Accelerator::MaxPacketSize];
+  Ray packet[Accelerator::MaxPacketSize];
+  optional<Hit> hits[Accelerator::MaxPacketSize];
 
-      float u = float(x) / WIDTH;
-      float v = float(y) / HEIGHT;
+  for (int by = 0; by < tile->height; by += blockHeight) {
+    for (int bx = 0; bx < tile->width; bx += blockWidth) {
+      int count = 0;
+      for (int j = by; j < min(by + blockHeight, tile->height); ++j) {
+        for (int i = bx; i < min(bx + blockWidth, tile->width); ++i) {
+          if (!tile->IsActive(i, j)) continue;
+          px[count] = i;
+          py[count] = j;
+          // Each pixel has its own sequence, each sample uses two values of
+          // it.
+          const int x = tile->x + i;
+          const int y = tile->y + j;
+          rng[count].SetSequence(x + y * tile->filmWidth);
+          rng[count].Advance(2 * firstSample);
+          count++;
+        }
+      }
+      if (count == 0) continue;
 
-      Ray r(origin, llc + u * hor + v * ver);
+      for (int s = 0; s < nSamples; ++s) {
+        for (int k = 0; k < count; ++k) {
+          float u = tile->x + px[k] + rng[k].UniformFloat();
+          float v = tile->y + py[k] + rng[k].UniformFloat();
+          packet[k] = cameraRay(u, v);
+        }
 
-      // color.
-      Vector3 c = color(r);
+        if (count == 1) {
+          hits[0] = scene->Intersect(packet[0]);
+        } else {
+          scene->IntersectPacket(packet, count, hits);
+        }
+        rays += count;
 
-      tile.WritePixel(i, j, c);
+        for (int k = 0; k < count; ++k) {
+          tile->AddSample(px[k], py[k], color(packet[k], hits[k]));
+        }
+      }
     }
   }
-
-  return tile;
 }
 
 }  // namespace skirt
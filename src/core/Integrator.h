@@ -1,5 +1,6 @@
 #pragma once
 
+#include "core/Accelerator.h"
 #include "core/Film.h"
 #include "core/Ray.h"
 #include "core/skirt.h"
@@ -12,19 +13,41 @@ class Integrator {
  public:
   Integrator(const Scene* scene) : scene(scene) {}
   virtual ~Integrator() = default;
-  virtual FilmTile Render(int x, int y, int width, int height) = 0;
+
+  // Renders samples [firstSample, firstSample + nSamples) of every active
+  // pixel of the tile, added to it with FilmTile::AddSample().
+  virtual void Render(FilmTile* tile, int firstSample, int nSamples) = 0;
 
   const Scene* scene;
+  // Rays traced so far.
+  int64_t rays = 0;
+
   DISALLOW_COPY_AND_ASSIGN(Integrator);
+
+ protected:
+  // Camera ray through the film position (x, y), in pixels.
+  Ray cameraRay(float x, float y) const;
+  // Radiance of the sky along direction.
+  static Vector3 background(const Vector3& direction);
 };
 
+/*
+Shades the first hit of camera rays. Camera rays are traced in packets of
+packetSize rays (see Accelerator::IntersectPacket()), taken from blocks of
+neighbouring pixels, 1 to trace them one by one.
+*/
 class SamplerIntegrator : public Integrator {
  public:
-  SamplerIntegrator(const Scene* scene) : Integrator(scene) {}
-  virtual FilmTile Render(int x, int y, int width, int height) final;
+  SamplerIntegrator(const Scene* scene, int packetSize = 16)
+      : Integrator(scene), packetSize(packetSize) {
+    CHECK(packetSize >= 1 && packetSize <= Accelerator::MaxPacketSize);
+  }
+  virtual void Render(FilmTile* tile, int firstSample, int nSamples) final;
+
+  const int packetSize;
 
  private:
-  Vector3 color(const Ray& r);
+  Vector3 color(const Ray& r, const optional<Hit>& hit);
 
   DISALLOW_COPY_AND_ASSIGN(SamplerIntegrator);
 };
@@ -98,15 +98,24 @@ INLINE Vector3 Transform(const Matrix4& mat, const Vector3& v) {
                  (mat[2] * v.x + mat[6] * v.y + mat[10] * v.z + mat[14]) / w);
 }
 
-INLINE Vector3 TransformNormal(const Matrix4& mat, const Vector3& v) {
+// Transforms a direction, which translations don't change.
+INLINE Vector3 TransformVector(const Matrix4& mat, const Vector3& v) {
   return Vector3(mat[0] * v.x + mat[4] * v.y + mat[8] * v.z,
                  mat[1] * v.x + mat[5] * v.y + mat[9] * v.z,
                  mat[2] * v.x + mat[6] * v.y + mat[10] * v.z);
 }
 
+// Transforms a normal by the matrix whose inverse is inv: normals stay
+// perpendicular to surfaces under the inverse transpose, not the matrix itself.
+INLINE Vector3 TransformNormal(const Matrix4& inv, const Vector3& n) {
+  return Vector3(inv[0] * n.x + inv[1] * n.y + inv[2] * n.z,
+                 inv[4] * n.x + inv[5] * n.y + inv[6] * n.z,
+                 inv[8] * n.x + inv[9] * n.y + inv[10] * n.z);
+}
+
 INLINE Ray Transform(const Matrix4& mat, const Ray& ray) {
   Vector3 origin = Transform(mat, ray.origin);
-  Vector3 direction = Transform(mat, ray.direction);
+  Vector3 direction = TransformVector(mat, ray.direction);
 
   return Ray(origin, direction, ray.minT, ray.maxT);
 }
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+// Spreads the low 10 bits of x so there are two zero bits between each.
+INLINE uint32_t LeftShift3(uint32_t x) {
+  DCHECK_LE(x, 1u << 10);
+  if (x == (1 << 10)) --x;
+  x = (x | (x << 16)) & 0x030000FF;
+  x = (x | (x << 8)) & 0x0300F00F;
+  x = (x | (x << 4)) & 0x030C30C3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+// 30 bit Morton code of a point in [0, 1024)^3. Bit b splits axis b % 3.
+INLINE uint32_t EncodeMorton3(const Vector3& v) {
+  return (LeftShift3(v.z) << 2) | (LeftShift3(v.y) << 1) | LeftShift3(v.x);
+}
+
+}  // namespace skirt
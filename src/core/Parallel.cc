@@ -0,0 +1,209 @@
+#include "core/Parallel.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+struct Task {
+  std::function<void()> func;
+  TaskGroup* group;
+};
+
+// Index of the current thread's deque in the pool, -1 for threads that
+// aren't part of it.
+static thread_local int threadIndex = -1;
+
+/*
+Work stealing pool. Every thread owns a deque: it pushes and pops its own
+tasks at the back, so nested fork-join work stays depth first and cache warm,
+while idle threads steal from the front of the others, where the oldest and
+usually biggest tasks are. The thread that calls ParallelInit() is thread 0
+and runs tasks whenever it waits on a group.
+*/
+class ThreadPool {
+ public:
+  ThreadPool(int nThreads) : queues(nThreads) {
+    threadIndex = 0;
+    for (int i = 1; i < nThreads; ++i) {
+      threads.emplace_back([this, i]() {
+        threadIndex = i;
+        workerLoop(i);
+      });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      shutdown = true;
+    }
+    sleepCV.notify_all();
+    for (std::thread& t : threads) t.join();
+    threadIndex = -1;
+  }
+
+  int ThreadCount() const {
+    return queues.size();
+  }
+
+  void Push(std::function<void()> func, TaskGroup* group) {
+    group->pending++;
+    Queue& q = queues[threadIndex < 0 ? 0 : threadIndex];
+    {
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.push_back(Task{move(func), group});
+    }
+    queued++;
+    wake(false);
+  }
+
+  void Wait(TaskGroup* group) {
+    const int self = threadIndex < 0 ? 0 : threadIndex;
+    while (group->pending > 0) {
+      Task task;
+      if (pop(self, &task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      sleepCV.wait(lock, [&]() { return group->pending == 0 || queued > 0; });
+    }
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(int self) {
+    while (true) {
+      Task task;
+      if (pop(self, &task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      sleepCV.wait(lock, [this]() { return shutdown || queued > 0; });
+      if (shutdown) return;
+    }
+  }
+
+  // Takes the newest task of our own deque, or steals the oldest task of
+  // another thread, starting after ourselves so thieves spread out.
+  bool pop(int self, Task* task) {
+    {
+      Queue& q = queues[self];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (!q.tasks.empty()) {
+        *task = move(q.tasks.back());
+        q.tasks.pop_back();
+        queued--;
+        return true;
+      }
+    }
+    const int n = queues.size();
+    for (int i = 1; i < n; ++i) {
+      Queue& q = queues[(self + i) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (!q.tasks.empty()) {
+        *task = move(q.tasks.front());
+        q.tasks.pop_front();
+        queued--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(Task& task) {
+    task.func();
+    if (--task.group->pending == 0) wake(true);
+  }
+
+  // Taking the lock orders the wake up after a sleeper's predicate check, so
+  // it can't be lost.
+  void wake(bool all) {
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    if (all) {
+      sleepCV.notify_all();
+    } else {
+      sleepCV.notify_one();
+    }
+  }
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> threads;
+  std::atomic<int> queued{0};
+
+  std::mutex sleepMutex;
+  std::condition_variable sleepCV;
+  bool shutdown = false;
+};
+
+static unique_ptr<ThreadPool> pool;
+
+int NumSystemCores() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  return 1;
+#else
+  return max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+void ParallelInit(int nThreads) {
+  CHECK(!pool);
+  if (nThreads <= 0) nThreads = NumSystemCores();
+  pool.reset(new ThreadPool(nThreads));
+  DVLOG(1) << "Thread pool running with " << nThreads << " threads";
+}
+
+void ParallelCleanup() {
+  pool.reset();
+}
+
+int ParallelThreadCount() {
+  return pool ? pool->ThreadCount() : 1;
+}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+  if (!pool || pool->ThreadCount() == 1) {
+    task();
+    return;
+  }
+  pool->Push(move(task), this);
+}
+
+void TaskGroup::Wait() {
+  if (pool) pool->Wait(this);
+}
+
+void ParallelFor(const std::function<void(int64_t)>& func,
+                 int64_t count,
+                 int chunkSize) {
+  if (ParallelThreadCount() == 1 || count <= chunkSize) {
+    for (int64_t i = 0; i < count; ++i) func(i);
+    return;
+  }
+
+  TaskGroup group;
+  for (int64_t start = 0; start < count; start += chunkSize) {
+    int64_t end = min(start + chunkSize, count);
+    group.Run([&func, start, end]() {
+      for (int64_t i = start; i < end; ++i) func(i);
+    });
+  }
+  group.Wait();
+}
+
+}  // namespace skirt
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+int NumSystemCores();
+
+// Starts the worker pool. With nThreads <= 0 every core is used. The calling
+// thread counts as one of the threads, since it runs tasks while waiting.
+void ParallelInit(int nThreads = 0);
+void ParallelCleanup();
+
+// Number of threads that may run tasks, 1 when the pool isn't running.
+int ParallelThreadCount();
+
+/*
+Fork-join group of tasks. Run() queues a task on the calling thread's deque
+(or runs it right away if there is no pool) and Wait() blocks until every task
+in the group is done, running or stealing queued tasks in the meantime, so
+groups can be nested freely.
+*/
+class TaskGroup {
+ public:
+  TaskGroup() {}
+  ~TaskGroup();
+
+  void Run(std::function<void()> task);
+  void Wait();
+
+ private:
+  friend class ThreadPool;
+  std::atomic<int> pending{0};
+
+  DISALLOW_COPY_AND_ASSIGN(TaskGroup);
+};
+
+/*
+Float that can be added to from many threads at once. C++17 has no atomic
+floating point arithmetic, so Add() retries a compare and swap on the bits.
+*/
+class AtomicFloat {
+ public:
+  explicit AtomicFloat(float v = 0) : bits(FloatToBits(v)) {}
+
+  INLINE operator float() const {
+    return BitsToFloat(bits.load(std::memory_order_relaxed));
+  }
+
+  INLINE AtomicFloat& operator=(float v) {
+    bits.store(FloatToBits(v), std::memory_order_relaxed);
+    return *this;
+  }
+
+  INLINE void Add(float v) {
+    uint32_t old = bits.load(std::memory_order_relaxed);
+    while (!bits.compare_exchange_weak(old, FloatToBits(BitsToFloat(old) + v),
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> bits;
+};
+
+// Double counterpart of AtomicFloat, where std::atomic<double> only lacks the
+// addition.
+class AtomicDouble {
+ public:
+  explicit AtomicDouble(double v = 0) : value(v) {}
+
+  INLINE operator double() const {
+    return value.load(std::memory_order_relaxed);
+  }
+
+  INLINE void Add(double v) {
+    double old = value.load(std::memory_order_relaxed);
+    while (!value.compare_exchange_weak(old, old + v,
+                                        std::memory_order_relaxed)) {
+    }
+  }
+
+ private:
+  std::atomic<double> value;
+};
+
+// Calls func(i) for i in [0, count), in chunks of chunkSize indices per task.
+void ParallelFor(const std::function<void(int64_t)>& func,
+                 int64_t count,
+                 int chunkSize = 1);
+
+}  // namespace skirt
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+#include "core/skirt.h"
+
+#include "core/AABB.h"
+#include "core/Element.h"
+#include "core/Hit.h"
+#include "core/Ray.h"
+
+namespace skirt {
+
+/*
+Reference to the index-th primitive of an Element, which is what accelerator
+leaves hold. A mesh is one Element however many triangles it has, and each
+triangle is a Primitive pointing back to it.
+*/
+struct Primitive {
+  Primitive() {}
+  Primitive(const Element* element, int32_t index)
+      : element(element), index(index) {}
+
+  INLINE const AABB Bound() const {
+    return element->PrimitiveBound(index);
+  }
+  INLINE optional<Hit> Intersect(const Ray& r) const {
+    return element->IntersectPrimitive(r, index);
+  }
+  INLINE bool IntersectP(const Ray& r) const {
+    return element->IntersectPrimitiveP(r, index);
+  }
+
+  const Element* element = nullptr;
+  int32_t index = 0;
+};
+
+}  // namespace skirt
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+static constexpr float OneMinusEpsilon = 0x1.fffffep-1;
+
+/*
+PCG32 random number generator (http://www.pcg-random.org). Every sequence is
+an independent stream, and Advance() skips ahead in O(log n), so a pixel can
+use its own sequence and get the same samples no matter which tile or pass
+renders them.
+*/
+class RNG {
+ public:
+  RNG() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+  explicit RNG(uint64_t sequence) {
+    SetSequence(sequence);
+  }
+
+  INLINE void SetSequence(uint64_t sequence) {
+    state = 0u;
+    inc = (sequence << 1u) | 1u;
+    UniformUInt32();
+    state += 0x853c49e6748fea9bULL;
+    UniformUInt32();
+  }
+
+  INLINE uint32_t UniformUInt32() {
+    uint64_t old = state;
+    state = old * mult + inc;
+    uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = uint32_t(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+  }
+
+  // Uniform in [0, 1).
+  INLINE float UniformFloat() {
+    return min(OneMinusEpsilon, float(UniformUInt32()) * 0x1p-32f);
+  }
+
+  INLINE void Advance(int64_t delta) {
+    uint64_t curMult = mult, curPlus = inc, accMult = 1u, accPlus = 0u;
+    while (delta > 0) {
+      if (delta & 1) {
+        accMult *= curMult;
+        accPlus = accPlus * curMult + curPlus;
+      }
+      curPlus = (curMult + 1) * curPlus;
+      curMult *= curMult;
+      delta /= 2;
+    }
+    state = accMult * state + accPlus;
+  }
+
+ private:
+  static constexpr uint64_t mult = 0x5851f42d4c957f2dULL;
+
+  uint64_t state, inc;
+};
+
+}  // namespace skirt
@@ -25,6 +25,27 @@ class Ray {
   float maxT;
 };
 
+/*
+Ray with what box tests need precomputed: the reciprocal of the direction and
+whether each direction component is negative, taken from the reciprocal so -0
+counts as negative. A zero component inverts to +-inf, which is exact for
+slabs away from the origin; for a slab plane through the origin it gives
+0 * inf = NaN, and box tests must order their min/max so that NaN is dropped.
+*/
+class TraversalRay : public Ray {
+ public:
+  TraversalRay() {}
+  explicit TraversalRay(const Ray& r)
+      : Ray(r),
+        invDir(1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z),
+        dirIsNeg{std::signbit(invDir.x),
+                 std::signbit(invDir.y),
+                 std::signbit(invDir.z)} {}
+
+  Vector3 invDir;
+  int dirIsNeg[3];
+};
+
 INLINE std::ostream& operator<<(std::ostream& os, const Ray& r) {
   os << "Ray[o=" << r.origin << ", d=" << r.direction << "]";
   return os;
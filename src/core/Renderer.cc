@@ -0,0 +1,200 @@
+#include "core/Renderer.h"
+
+#include <atomic>
+
+#include "core/Integrator.h"
+#include "core/Parallel.h"
+#include "core/skirt.h"
+
+namespace skirt {
+
+void Renderer::Render(Film* film) {
+  CHECK_GT(tileSize, 0);
+  CHECK_GT(pixelSamples, 0);
+  const int nTilesX = (film->width + tileSize - 1) / tileSize;
+  const int nTilesY = (film->height + tileSize - 1) / tileSize;
+  const std::vector<int> tiles = OrderTiles(nTilesX, nTilesY, tileOrder);
+  const int perPass = passSamples > 0 ? min(passSamples, pixelSamples)
+                                      : pixelSamples;
+  DVLOG(1) << "Rendering " << nTilesX << "x" << nTilesY << " tiles in "
+           << TileOrderName(tileOrder) << " order, in passes of " << perPass
+           << " samples";
+
+  stats = RenderStats();
+  stats.order = tileOrder;
+  stats.pixels = int64_t(film->width) * film->height;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (timeBudget > 0) {
+    deadline = start + std::chrono::duration_cast<
+                           std::chrono::steady_clock::duration>(
+                           std::chrono::duration<double>(timeBudget));
+  }
+
+  // Pixels still being sampled. Those that converge are never sampled again,
+  // so every active pixel has had the same number of samples.
+  std::vector<uint8_t> active(film->width * film->height, 1);
+
+  // Time spent in onPass, which isn't rendering.
+  std::chrono::steady_clock::duration callbacks(0);
+
+  for (int pass = 0;; ++pass) {
+    const int firstSample = pass * perPass;
+    int nSamples = perPass;
+    if (timeBudget <= 0) {
+      if (firstSample >= pixelSamples) break;
+      nSamples = min(perPass, pixelSamples - firstSample);
+    }
+
+    // The first pass is always finished, so no pixel is left without samples.
+    const int64_t tilesBefore = stats.tiles;
+    const bool complete =
+        renderPass(film, tiles, nTilesX, active, firstSample, nSamples,
+                   pass == 0 ? std::chrono::steady_clock::time_point::max()
+                             : deadline);
+    if (stats.tiles == tilesBefore) {
+      DVLOG(1) << "Time budget spent after pass " << pass - 1;
+      break;
+    }
+    film->Resolve();
+    stats.passes++;
+    if (onPass) {
+      auto called = std::chrono::steady_clock::now();
+      onPass(film, pass);
+      callbacks += std::chrono::steady_clock::now() - called;
+    }
+
+    if (!complete) {
+      DVLOG(1) << "Time budget spent during pass " << pass;
+      break;
+    }
+    if (errorThreshold > 0 && firstSample + nSamples >= minSamples &&
+        (timeBudget > 0 || firstSample + nSamples < pixelSamples) &&
+        updateActive(*film, &active) == 0) {
+      DVLOG(1) << "Converged after " << stats.passes << " passes";
+      break;
+    }
+  }
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start - callbacks)
+                      .count();
+  DVLOG(1) << "Rendered " << stats.tiles << " tiles, mean tile step "
+           << stats.MeanTileStep() << ", " << stats.convergedPixels
+           << " pixels converged";
+  LOG(INFO) << StringPrintf("Rendered %.1f spp in %.2fs, %.0f rays/s",
+                            stats.SamplesPerPixel(), stats.seconds,
+                            stats.RaysPerSecond());
+}
+
+// Clears the active flag of the pixels that, along with their 8 neighbours,
+// are under errorThreshold, and returns how many pixels are left.
+int64_t Renderer::updateActive(const Film& film,
+                               std::vector<uint8_t>* active) {
+  const int w = film.width, h = film.height;
+  std::vector<uint8_t> over(w * h);
+  ParallelFor(
+      [&](int64_t y) {
+        for (int x = 0; x < w; ++x) {
+          over[x + y * w] = (*active)[x + y * w] &&
+                            !(film.RelativeError(x, y) < errorThreshold);
+        }
+      },
+      h, 16);
+
+  std::atomic<int64_t> converged(0), left(0);
+  ParallelFor(
+      [&](int64_t row) {
+        const int y = row;
+        int64_t c = 0, l = 0;
+        for (int x = 0; x < w; ++x) {
+          uint8_t& a = (*active)[x + y * w];
+          if (!a) continue;
+          bool keep = false;
+          for (int ny = max(0, y - 1); ny <= min(h - 1, y + 1); ++ny) {
+            for (int nx = max(0, x - 1); nx <= min(w - 1, x + 1); ++nx) {
+              keep |= over[nx + ny * w];
+            }
+          }
+          if (keep) {
+            l++;
+          } else {
+            a = 0;
+            c++;
+          }
+        }
+        converged += c;
+        left += l;
+      },
+      h, 16);
+  stats.convergedPixels += converged;
+  return left;
+}
+
+bool Renderer::renderPass(Film* film,
+                          const std::vector<int>& tiles,
+                          int nTilesX,
+                          const std::vector<uint8_t>& active,
+                          int firstSample,
+                          int nSamples,
+                          std::chrono::steady_clock::time_point deadline) {
+  const int nWorkers = min<int>(ParallelThreadCount(), tiles.size());
+  std::atomic<int> next(0);
+  std::atomic<int64_t> nTiles(0), samples(0), rays(0), steps(0),
+      stepLength(0);
+  std::atomic<bool> late(false);
+
+  // One loop per thread, each taking tiles from the shared cursor, so tiles
+  // start in order however long each of them takes.
+  ParallelFor(
+      [&](int64_t) {
+        int prevX = -1, prevY = -1;
+        for (int i = next++; i < int(tiles.size()); i = next++) {
+          if (std::chrono::steady_clock::now() >= deadline) {
+            late = true;
+            break;
+          }
+          const int tx = tiles[i] % nTilesX;
+          const int ty = tiles[i] / nTilesX;
+          const int x = tx * tileSize;
+          const int y = ty * tileSize;
+          FilmTile tile(x, y, min(tileSize, film->width - x),
+                        min(tileSize, film->height - y), film->width);
+
+          int64_t nActive = 0;
+          tile.active.resize(tile.width * tile.height);
+          for (int j = 0; j < tile.height; ++j) {
+            for (int k = 0; k < tile.width; ++k) {
+              uint8_t a = active[(x + k) + (y + j) * film->width];
+              tile.active[k + j * tile.width] = a;
+              nActive += a;
+            }
+          }
+          if (nActive == 0) continue;
+
+          if (prevX >= 0) {
+            steps++;
+            stepLength += abs(tx - prevX) + abs(ty - prevY);
+          }
+          prevX = tx;
+          prevY = ty;
+
+          unique_ptr<Integrator> integrator = scene->MakeIntegrator();
+          integrator->Render(&tile, firstSample, nSamples);
+          nTiles++;
+          samples += nActive * nSamples;
+          rays += integrator->rays;
+          film->AccumulateTile(tile);
+        }
+      },
+      nWorkers);
+
+  stats.tileSteps += steps;
+  stats.tileStepLength += stepLength;
+  stats.tiles += nTiles;
+  stats.samples += samples;
+  stats.rays += rays;
+  return !late;
+}
+
+}  // namespace skirt
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "core/skirt.h"
+
+#include "core/Film.h"
+#include "core/Scene.h"
+#include "core/TileOrder.h"
+
+namespace skirt {
+
+// Counters of the last Renderer::Render() call.
+struct RenderStats {
+  TileOrder order = TileOrder::Scanline;
+  int passes = 0;
+  int64_t tiles = 0;
+  int64_t pixels = 0;
+  int64_t samples = 0;
+  int64_t rays = 0;
+  // Pixels that reached errorThreshold before pixelSamples.
+  int64_t convergedPixels = 0;
+  // Time spent rendering, which leaves out the onPass calls.
+  double seconds = 0;
+
+  // Number of times a thread went from one tile to the next, and the sum of
+  // the distances, in tiles, it moved.
+  int64_t tileSteps = 0;
+  int64_t tileStepLength = 0;
+
+  // Mean distance between consecutive tiles rendered by the same thread. The
+  // smaller it is the more of the BVH a thread finds in its caches.
+  double MeanTileStep() const {
+    return tileSteps ? double(tileStepLength) / tileSteps : 0;
+  }
+
+  double SamplesPerPixel() const {
+    return pixels ? double(samples) / pixels : 0;
+  }
+  double RaysPerSecond() const {
+    return seconds > 0 ? rays / seconds : 0;
+  }
+};
+
+/*
+Drives the rendering of a baked Scene into a Film. The film is split in
+square tiles, which are handed out in tileOrder to the worker pool (see
+core/Parallel.h). Every thread takes the next tile as soon as it's done with
+the previous one, renders it with its own Integrator and accumulates it into
+the film with atomic additions, so no thread waits on another.
+
+Rendering is progressive: pixelSamples samples per pixel are taken in passes
+of passSamples each, and after every pass the film is resolved and onPass is
+called, so a partial image can be saved or shown.
+
+With a non zero errorThreshold sampling is adaptive. After each pass, a pixel
+stops being sampled once it has at least minSamples and its relative error
+(see Film::RelativeError()) is under the threshold, as is that of all its
+neighbours. Waiting for the neighbours keeps sampling thin features that only
+some pixels caught. Tiles without any pixel left are skipped, and rendering
+ends as soon as the whole frame has converged.
+
+With a non zero timeBudget, in seconds, passes go on past pixelSamples until
+the budget is spent: from then on no tile is started, the tiles in flight are
+finished and the last, partial, pass is resolved like the others. The first
+pass is always finished, however long it takes, so every pixel has samples.
+*/
+class Renderer {
+ public:
+  Renderer(const Scene* scene,
+           int tileSize = 16,
+           TileOrder tileOrder = TileOrder::Hilbert)
+      : scene(scene), tileSize(tileSize), tileOrder(tileOrder) {}
+
+  void Render(Film* film);
+
+  const Scene* scene;
+  const int tileSize;
+  const TileOrder tileOrder;
+
+  int pixelSamples = 1;
+  // Samples per pixel of each pass, 0 to take them all in a single pass.
+  int passSamples = 0;
+  float errorThreshold = 0;
+  double timeBudget = 0;
+  // Samples a pixel takes before its error is trusted, so an edge that the
+  // first few samples all miss isn't taken as converged.
+  int minSamples = 16;
+  std::function<void(Film* film, int pass)> onPass;
+
+  RenderStats stats;
+
+ private:
+  // Returns false if it stopped at the deadline before rendering every tile.
+  bool renderPass(Film* film,
+                  const std::vector<int>& tiles,
+                  int nTilesX,
+                  const std::vector<uint8_t>& active,
+                  int firstSample,
+                  int nSamples,
+                  std::chrono::steady_clock::time_point deadline);
+  int64_t updateActive(const Film& film, std::vector<uint8_t>* active);
+
+  DISALLOW_COPY_AND_ASSIGN(Renderer);
+};
+
+}  // namespace skirt
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+// Direction on the +z hemisphere with density cos(theta) / PI, from two
+// uniform values in [0, 1).
+INLINE Vector3 CosineSampleHemisphere(float u1, float u2) {
+  float r = std::sqrt(u1);
+  float phi = TAU * u2;
+  return Vector3(r * std::cos(phi), r * std::sin(phi),
+                 std::sqrt(max(0.f, 1 - u1)));
+}
+
+// Cosine weighted direction around the unit normal n.
+INLINE Vector3 CosineSampleAround(const Vector3& n, float u1, float u2) {
+  Vector3 s, t;
+  CoordinateSystem(n, &s, &t);
+  Vector3 d = CosineSampleHemisphere(u1, u2);
+  return d.x * s + d.y * t + d.z * n;
+}
+
+}  // namespace skirt
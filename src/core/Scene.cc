@@ -1,20 +1,113 @@
 #include "core/Scene.h"
 
+#include <unordered_map>
+
+#include "accelerators/BVH.h"
+#include "accelerators/BVHCache.h"
+#include "accelerators/WideBVH.h"
+#include "core/WavefrontIntegrator.h"
+
 namespace skirt {
 
-const Scene* Scene::Bake(unique_ptr<Scene>&& scene) {
+Scene* Scene::Bake(unique_ptr<Scene>&& scene) {
+  scene->makeInstances();
+  scene->accel = scene->MakeAccelerator(scene->elements);
   return scene.release();
 }
 
+void Scene::Refit(bool rotate) {
+  for (const unique_ptr<Accelerator>& a : objectAccels) a->Refit(rotate);
+  if (accel) accel->Refit(rotate);
+}
+
+// Shapes with many primitives that are placed more than once, or through a
+// transform, are built once in object space and shared by their elements.
+// The others stay flattened into the scene accelerator, where their
+// primitives are sorted together with everything else.
+void Scene::makeInstances() {
+  std::unordered_map<const Shape*, int> uses;
+  for (const shared_ptr<Element>& e : elements) uses[e->GetShape()]++;
+
+  std::unordered_map<const Shape*, const Accelerator*> built;
+  int instances = 0;
+  for (const shared_ptr<Element>& e : elements) {
+    const Shape* shape = e->GetShape();
+    if (shape->PrimitiveCount() <= 1) continue;
+    if (!e->HasTransform() && uses[shape] == 1) continue;
+
+    const Accelerator*& accel = built[shape];
+    if (!accel) {
+      objectAccels.push_back(MakeAccelerator(
+          {shared_ptr<Element>(new Element(e->GetSharedShape()))}));
+      accel = objectAccels.back().get();
+    }
+    e->SetInstance(accel);
+    instances++;
+  }
+  DVLOG(1) << instances << " instances of " << objectAccels.size()
+           << " shapes";
+}
+
+unique_ptr<Accelerator> Scene::MakeAccelerator(
+    const std::vector<shared_ptr<Element>>& elements) const {
+  Description defaults;
+  const Description& d = desc ? *desc : defaults;
+
+  BVH::SplitMethod split = BVH::SplitMethod::SAH;
+  if (d.acceleratorType == "lbvh") {
+    split = BVH::SplitMethod::LBVH;
+  } else if (d.acceleratorType == "sbvh") {
+    split = BVH::SplitMethod::SBVH;
+  } else if (d.acceleratorType != "" && d.acceleratorType != "bvh") {
+    LOG(ERROR) << "Unknown accelerator: " << d.acceleratorType
+               << ", using bvh";
+  }
+
+  unique_ptr<BVH> bvh;
+  if (d.acceleratorCache.empty()) {
+    bvh.reset(new BVH(elements, d.maxPrimsInNode, split, d.duplicationBudget));
+  } else {
+    const uint64_t key = BVHCacheKey(elements, d.maxPrimsInNode, split,
+                                     d.duplicationBudget);
+    const string filename = StringPrintf(
+        "%s.%016llx.bvh", d.acceleratorCache.c_str(), (unsigned long long)key);
+    bvh = ReadBVHCache(elements, key, filename);
+    if (!bvh) {
+      bvh.reset(
+          new BVH(elements, d.maxPrimsInNode, split, d.duplicationBudget));
+      WriteBVHCache(*bvh, key, filename);
+    }
+  }
+
+  switch (d.acceleratorWidth) {
+    case 2:
+      LOG_IF(ERROR, d.compressNodes) << "Only wide BVHs can be compressed";
+      return bvh;
+    case 4:
+      return unique_ptr<Accelerator>(new BVH4(*bvh, d.compressNodes));
+    case 8:
+      return unique_ptr<Accelerator>(new BVH8(*bvh, d.compressNodes));
+  }
+  LOG(ERROR) << "Invalid accelerator width: " << d.acceleratorWidth
+             << ", using 2";
+  return bvh;
+}
+
 Film Scene::MakeFilm() const {
   Film f(200, 100, "test.exr");
   return f;
 }
 
 unique_ptr<Integrator> Scene::MakeIntegrator() const {
-  unique_ptr<SamplerIntegrator> in(new SamplerIntegrator(this));
+  if (desc && desc->integratorType == "wavefront") {
+    return unique_ptr<Integrator>(
+        new WavefrontIntegrator(this, desc->maxDepth, desc->sortRays));
+  }
+
+  unique_ptr<SamplerIntegrator> in(
+      new SamplerIntegrator(this, desc ? desc->packetSize : 16));
 
-  return move(in);
+  return in;
 }
 
 }  // namespace skirt
@@ -1,15 +1,21 @@
 #pragma once
 
+#include <vector>
+
 #include "core/skirt.h"
 
+#include "core/Accelerator.h"
 #include "core/Element.h"
 #include "core/Film.h"
 #include "core/Integrator.h"
+#include "core/TileOrder.h"
 
 #include "loader/Loader.h"
 
 namespace skirt {
 
+// Fields are stored in compiled scenes in the order describe() in
+// loader/CompiledScene.cc lists them, which must list them all.
 struct Description {
   Vector3 lookAtFrom;
   Vector3 lookAtTo;
@@ -19,7 +25,26 @@ struct Description {
   float cameraAperture;
   float cameraFocusDistance;
 
+  string samplerType;
+  int pixelSamples = 1;
+  float errorThreshold = 0;
+
   string integratorType;
+  int tileSize = 16;
+  int packetSize = 16;
+  TileOrder tileOrder = TileOrder::Hilbert;
+  int passSamples = 0;
+  float timeBudget = 0;
+  int maxDepth = 5;
+  bool sortRays = false;
+
+  string acceleratorType;
+  int maxPrimsInNode = 4;
+  int acceleratorWidth = 2;
+  float duplicationBudget = 0.3;
+  bool compressNodes = false;
+  // Path and prefix of the BVH cache files, or empty to always build.
+  string acceleratorCache;
 
   string filmType;
   string filmFilename;
@@ -29,7 +54,8 @@ struct Description {
 
 /*
 A scene is modifiable during construction.
-Once Bake() is called. The whole scene is const.
+Once Bake() is called. The whole scene is const, but for Refit(), which
+animations call on the handle Bake() returns while nothing renders the scene.
 */
 class Scene {
  public:
@@ -38,17 +64,47 @@ class Scene {
   Film MakeFilm() const;
   unique_ptr<Integrator> MakeIntegrator() const;
 
-  const Scene* Bake(unique_ptr<Scene>&& scene);
+  Scene* Bake(unique_ptr<Scene>&& scene);
+
+  // Updates the baked accelerators after elements moved or meshes deformed,
+  // in time linear in the size of the scene rather than rebuilding them.
+  // Elements are still moved through their shared pointers, and this only
+  // changes the bounds the accelerators keep. The scene can't be rendered
+  // while this runs, and elements can't be added or removed. Meshes meant to
+  // move should have a transform before Bake(), so they are instanced rather
+  // than flattened into the scene accelerator.
+  void Refit(bool rotate = false);
+  unique_ptr<Accelerator> MakeAccelerator(
+      const std::vector<shared_ptr<Element>>& elements) const;
+
+  INLINE void AddElement(shared_ptr<Element> element) {
+    elements.push_back(element);
+  }
+
+  INLINE optional<Hit> Intersect(const Ray& r) const {
+    return accel->Intersect(r);
+  }
+
+  INLINE bool IntersectP(const Ray& r) const {
+    return accel->IntersectP(r);
+  }
 
-  INLINE void SetRootElement(shared_ptr<Element> root) {
-    this->root = root;
+  INLINE void IntersectPacket(const Ray* rays,
+                              int count,
+                              optional<Hit>* hits) const {
+    accel->IntersectPacket(rays, count, hits);
   }
 
-  shared_ptr<Element> root;
+  std::vector<shared_ptr<Element>> elements;
+  unique_ptr<Accelerator> accel;
+  // Object space accelerators of the instanced shapes.
+  std::vector<unique_ptr<Accelerator>> objectAccels;
 
   unique_ptr<Description> desc;
 
  private:
+  void makeInstances();
+
   DISALLOW_COPY_AND_ASSIGN(Scene);
 };
 
@@ -14,6 +14,28 @@ class Shape {
   virtual const AABB Bound() const = 0;
   virtual optional<Hit> Intersect(const Ray& r) const = 0;
 
+  // Whether r hits the shape at all between minT and maxT. Shapes should
+  // override it to stop at the first hit without working out where it is.
+  virtual bool IntersectP(const Ray& r) const {
+    return Intersect(r).has_value();
+  }
+
+  // Shapes made of many independent parts, like triangle meshes, split into
+  // primitives that accelerators bound and intersect one by one. Other
+  // shapes are a single primitive.
+  virtual int PrimitiveCount() const {
+    return 1;
+  }
+  virtual const AABB PrimitiveBound(int i) const {
+    return Bound();
+  }
+  virtual optional<Hit> IntersectPrimitive(const Ray& r, int i) const {
+    return Intersect(r);
+  }
+  virtual bool IntersectPrimitiveP(const Ray& r, int i) const {
+    return IntersectP(r);
+  }
+
   virtual float Area() const = 0;
 };
 
@@ -0,0 +1,107 @@
+#include "core/TileOrder.h"
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+bool ParseTileOrder(const string& name, TileOrder* order) {
+  if (name == "scanline") {
+    *order = TileOrder::Scanline;
+  } else if (name == "spiral") {
+    *order = TileOrder::Spiral;
+  } else if (name == "hilbert") {
+    *order = TileOrder::Hilbert;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* TileOrderName(TileOrder order) {
+  switch (order) {
+    case TileOrder::Scanline:
+      return "scanline";
+    case TileOrder::Spiral:
+      return "spiral";
+    case TileOrder::Hilbert:
+      return "hilbert";
+  }
+  return "unknown";
+}
+
+namespace {
+
+// Position of the d-th cell along the Hilbert curve that covers a n by n grid,
+// with n a power of two.
+void hilbertToXY(int n, int d, int* x, int* y) {
+  *x = *y = 0;
+  for (int s = 1; s < n; s *= 2) {
+    const int rx = 1 & (d / 2);
+    const int ry = 1 & (d ^ rx);
+    if (ry == 0) {
+      if (rx == 1) {
+        *x = s - 1 - *x;
+        *y = s - 1 - *y;
+      }
+      std::swap(*x, *y);
+    }
+    *x += s * rx;
+    *y += s * ry;
+    d /= 4;
+  }
+}
+
+}  // namespace
+
+std::vector<int> OrderTiles(int nTilesX, int nTilesY, TileOrder order) {
+  const int count = nTilesX * nTilesY;
+  std::vector<int> tiles;
+  if (count == 0) return tiles;
+  tiles.reserve(count);
+
+  switch (order) {
+    case TileOrder::Scanline:
+      for (int i = 0; i < count; ++i) tiles.push_back(i);
+      break;
+
+    case TileOrder::Spiral: {
+      // Walks right, down, left and up around the center tile, with the run
+      // length growing every two turns, skipping tiles outside the grid.
+      const int dx[4] = {1, 0, -1, 0};
+      const int dy[4] = {0, 1, 0, -1};
+      int x = (nTilesX - 1) / 2, y = (nTilesY - 1) / 2;
+      int dir = 0, run = 1;
+      tiles.push_back(x + y * nTilesX);
+      while (int(tiles.size()) < count) {
+        for (int turn = 0; turn < 2; ++turn) {
+          for (int i = 0; i < run; ++i) {
+            x += dx[dir];
+            y += dy[dir];
+            if (x >= 0 && x < nTilesX && y >= 0 && y < nTilesY) {
+              tiles.push_back(x + y * nTilesX);
+            }
+          }
+          dir = (dir + 1) % 4;
+        }
+        run++;
+      }
+      break;
+    }
+
+    case TileOrder::Hilbert: {
+      int n = 1;
+      while (n < nTilesX || n < nTilesY) n *= 2;
+      for (int d = 0; d < n * n; ++d) {
+        int x, y;
+        hilbertToXY(n, d, &x, &y);
+        if (x < nTilesX && y < nTilesY) tiles.push_back(x + y * nTilesX);
+      }
+      break;
+    }
+  }
+
+  DCHECK_EQ(int(tiles.size()), count);
+  return tiles;
+}
+
+}  // namespace skirt
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+/*
+Order in which the Renderer hands tiles out to the worker threads. Scanline
+goes row by row, Spiral starts at the center of the image and walks outwards,
+and Hilbert follows a Hilbert curve, so consecutive tiles are always
+neighbours and nearby tiles are rendered close together in time, sharing the
+BVH nodes they touch.
+*/
+enum class TileOrder { Scanline, Spiral, Hilbert };
+
+// Parses "scanline", "spiral" or "hilbert". Returns false on other names.
+bool ParseTileOrder(const string& name, TileOrder* order);
+const char* TileOrderName(TileOrder order);
+
+// Indices (x + y * nTilesX) of every tile of a nTilesX by nTilesY grid, in
+// the given order.
+std::vector<int> OrderTiles(int nTilesX, int nTilesY, TileOrder order);
+
+}  // namespace skirt
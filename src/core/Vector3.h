@@ -120,6 +120,22 @@ INLINE Vector3 max(const Vector3& a, const Vector3& b) {
   return Vector3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
 }
 
+INLINE Vector3 Abs(const Vector3& v) {
+  return Vector3(std::abs(v.x), std::abs(v.y), std::abs(v.z));
+}
+
+INLINE float MaxComponent(const Vector3& v) {
+  return std::max(v.x, std::max(v.y, v.z));
+}
+
+INLINE int MaxDimension(const Vector3& v) {
+  return (v.x > v.y) ? ((v.x > v.z) ? 0 : 2) : ((v.y > v.z) ? 1 : 2);
+}
+
+INLINE Vector3 Permute(const Vector3& v, int x, int y, int z) {
+  return Vector3(v[x], v[y], v[z]);
+}
+
 INLINE float Distance(const Vector3& a, const Vector3& b) {
   return (b - a).Length();
 }
@@ -137,6 +153,16 @@ INLINE Vector3 Normalize(const Vector3& v) {
   return v / v.Length();
 }
 
+// Two unit vectors that, with the unit vector v1, form an orthonormal basis.
+INLINE void CoordinateSystem(const Vector3& v1, Vector3* v2, Vector3* v3) {
+  if (std::abs(v1.x) > std::abs(v1.y)) {
+    *v2 = Vector3(-v1.z, 0, v1.x) / std::sqrt(v1.x * v1.x + v1.z * v1.z);
+  } else {
+    *v2 = Vector3(0, v1.z, -v1.y) / std::sqrt(v1.y * v1.y + v1.z * v1.z);
+  }
+  *v3 = Cross(v1, *v2);
+}
+
 INLINE Vector3 Reflect(const Vector3& v, const Vector3& n) {
   return v - (2 * Dot(v, n)) * n;
 }
@@ -0,0 +1,179 @@
+#include "core/WavefrontIntegrator.h"
+
+#include <algorithm>
+
+#include "core/Hit.h"
+#include "core/Morton.h"
+#include "core/Sampling.h"
+#include "core/Scene.h"
+#include "core/skirt.h"
+
+namespace skirt {
+
+void RayQueue::Clear() {
+  ox.clear();
+  oy.clear();
+  oz.clear();
+  dx.clear();
+  dy.clear();
+  dz.clear();
+  path.clear();
+  beta.clear();
+}
+
+void RayQueue::Reserve(int n) {
+  ox.reserve(n);
+  oy.reserve(n);
+  oz.reserve(n);
+  dx.reserve(n);
+  dy.reserve(n);
+  dz.reserve(n);
+  path.reserve(n);
+  beta.reserve(n);
+}
+
+void WavefrontIntegrator::Render(FilmTile* tile,
+                                 int firstSample,
+                                 int nSamples) {
+  generate(*tile, firstSample, nSamples);
+
+  for (int depth = 0; depth < maxDepth && rayQueue.Size() > 0; ++depth) {
+    // Camera rays are coherent already.
+    if (sortRays && depth > 0) sortQueue();
+    extend();
+    shade(depth);
+    traceShadows();
+    std::swap(rayQueue, nextQueue);
+  }
+
+  for (size_t p = 0; p < radiance.size(); ++p) {
+    tile->AddSample(pixel[p] % tile->width, pixel[p] / tile->width,
+                    radiance[p]);
+  }
+}
+
+void WavefrontIntegrator::generate(const FilmTile& tile,
+                                   int firstSample,
+                                   int nSamples) {
+  // Random values per sample: 2 for the camera, 4 for each bounce.
+  const int dimensions = 2 + 4 * maxDepth;
+
+  rngs.clear();
+  radiance.clear();
+  pixel.clear();
+  rayQueue.Clear();
+  rayQueue.Reserve(tile.width * tile.height * nSamples);
+
+  for (int j = 0; j < tile.height; ++j) {
+    for (int i = 0; i < tile.width; ++i) {
+      if (!tile.IsActive(i, j)) continue;
+      const int x = tile.x + i;
+      const int y = tile.y + j;
+      for (int s = 0; s < nSamples; ++s) {
+        RNG rng(x + y * tile.filmWidth);
+        rng.Advance(int64_t(dimensions) * (firstSample + s));
+        float u = x + rng.UniformFloat();
+        float v = y + rng.UniformFloat();
+        Ray r = cameraRay(u, v);
+
+        rayQueue.Push(r.origin, r.direction, rngs.size(), 1);
+        rngs.push_back(rng);
+        radiance.push_back(Vector3(0, 0, 0));
+        pixel.push_back(i + j * tile.width);
+      }
+    }
+  }
+}
+
+void WavefrontIntegrator::sortQueue() {
+  const int n = rayQueue.Size();
+  const AABB bounds = scene->accel->Bound();
+
+  // Octant in bits 61 to 63, Morton code of the origin in bits 31 to 60 and
+  // the ray index below, so sorting the keys sorts the rays.
+  sortKeys.resize(n);
+  for (int i = 0; i < n; ++i) {
+    Vector3 cell = 1024 * bounds.Offset(
+                              Vector3(rayQueue.ox[i], rayQueue.oy[i],
+                                      rayQueue.oz[i]));
+    cell = min(max(cell, Vector3(0, 0, 0)), Vector3(1023, 1023, 1023));
+    uint64_t octant = (rayQueue.dx[i] < 0) | (rayQueue.dy[i] < 0) << 1 |
+                      (rayQueue.dz[i] < 0) << 2;
+    sortKeys[i] = octant << 61 | uint64_t(EncodeMorton3(cell)) << 31 | i;
+  }
+  std::sort(sortKeys.begin(), sortKeys.end());
+
+  sortedQueue.Clear();
+  sortedQueue.Reserve(n);
+  for (int k = 0; k < n; ++k) {
+    const int i = sortKeys[k] & 0x7fffffff;
+    sortedQueue.Push(Vector3(rayQueue.ox[i], rayQueue.oy[i], rayQueue.oz[i]),
+                     Vector3(rayQueue.dx[i], rayQueue.dy[i], rayQueue.dz[i]),
+                     rayQueue.path[i], rayQueue.beta[i]);
+  }
+  std::swap(rayQueue, sortedQueue);
+}
+
+void WavefrontIntegrator::extend() {
+  const int n = rayQueue.Size();
+  hitT.resize(n);
+  hitP.resize(n);
+  hitN.resize(n);
+  for (int i = 0; i < n; ++i) {
+    optional<Hit> hit = scene->Intersect(rayQueue.GetRay(i, ShadowEpsilon));
+    if (hit) {
+      hitT[i] = hit->t;
+      hitP[i] = hit->p;
+      hitN[i] = hit->normal;
+    } else {
+      hitT[i] = Infinity;
+    }
+  }
+  rays += n;
+}
+
+void WavefrontIntegrator::shade(int depth) {
+  const int n = rayQueue.Size();
+  nextQueue.Clear();
+  shadowQueue.Clear();
+  shadowLight.clear();
+
+  for (int i = 0; i < n; ++i) {
+    const int p = rayQueue.path[i];
+    const float beta = rayQueue.beta[i];
+    const Vector3 d(rayQueue.dx[i], rayQueue.dy[i], rayQueue.dz[i]);
+
+    if (hitT[i] == Infinity) {
+      if (depth == 0) radiance[p] += beta * background(d);
+      continue;
+    }
+
+    Vector3 normal = Normalize(hitN[i]);
+    if (Dot(normal, d) > 0) normal = -normal;
+
+    RNG& rng = rngs[p];
+    float u1 = rng.UniformFloat(), u2 = rng.UniformFloat();
+    Vector3 light = CosineSampleAround(normal, u1, u2);
+    shadowQueue.Push(hitP[i], light, p, beta);
+    shadowLight.push_back(beta * albedo * background(light));
+
+    u1 = rng.UniformFloat();
+    u2 = rng.UniformFloat();
+    if (depth + 1 < maxDepth) {
+      nextQueue.Push(hitP[i], CosineSampleAround(normal, u1, u2), p,
+                     beta * albedo);
+    }
+  }
+}
+
+void WavefrontIntegrator::traceShadows() {
+  const int n = shadowQueue.Size();
+  for (int i = 0; i < n; ++i) {
+    if (!scene->IntersectP(shadowQueue.GetRay(i, ShadowEpsilon))) {
+      radiance[shadowQueue.path[i]] += shadowLight[i];
+    }
+  }
+  rays += n;
+}
+
+}  // namespace skirt
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "core/Integrator.h"
+#include "core/Random.h"
+
+namespace skirt {
+
+/*
+Structure of arrays queue of rays, each belonging to a path.
+*/
+struct RayQueue {
+  INLINE int Size() const {
+    return path.size();
+  }
+
+  void Clear();
+  void Reserve(int n);
+  INLINE void Push(const Vector3& o, const Vector3& d, int p, float b) {
+    ox.push_back(o.x);
+    oy.push_back(o.y);
+    oz.push_back(o.z);
+    dx.push_back(d.x);
+    dy.push_back(d.y);
+    dz.push_back(d.z);
+    path.push_back(p);
+    beta.push_back(b);
+  }
+
+  INLINE Ray GetRay(int i, float minT = 0, float maxT = Infinity) const {
+    return Ray(Vector3(ox[i], oy[i], oz[i]), Vector3(dx[i], dy[i], dz[i]),
+               minT, maxT);
+  }
+
+  std::vector<float> ox, oy, oz;
+  std::vector<float> dx, dy, dz;
+  std::vector<int32_t> path;
+  // Path throughput of the ray.
+  std::vector<float> beta;
+};
+
+/*
+Path tracer that moves every sample of a tile through the same stage at once,
+instead of following one path to its end before starting the next:
+
+  generate: a camera ray for each sample of each active pixel.
+  extend:   intersect every ray of the queue with the scene.
+  shade:    rays that missed add the sky if they came from the camera; hits
+            queue a shadow ray and a bounce ray into the next queue.
+  shadow:   unoccluded shadow rays add their light to their path.
+
+extend and shade repeat on the bounce queue until paths have maxDepth surface
+hits or no rays are left. Each stage is a tight loop over the queue's arrays,
+which keeps traversal and shading code hot.
+
+With sortRays, bounce rays are reordered before each extend stage by
+direction octant and then by the Morton code of their origin in the scene
+bounds, so consecutive rays start close together going the same way and
+mostly visit the same BVH nodes.
+
+Surfaces are Lambertian with a grey albedo, lit by the sky (see
+Integrator::background()). Direct light comes only from the shadow rays, whose
+directions are cosine sampled, so it is albedo * sky along the direction when
+unoccluded, and bounce rays that escape add nothing.
+*/
+class WavefrontIntegrator : public Integrator {
+ public:
+  WavefrontIntegrator(const Scene* scene,
+                      int maxDepth = 5,
+                      bool sortRays = false)
+      : Integrator(scene), maxDepth(maxDepth), sortRays(sortRays) {}
+  virtual void Render(FilmTile* tile, int firstSample, int nSamples) final;
+
+  const int maxDepth;
+  const bool sortRays;
+  static constexpr float albedo = 0.5;
+
+ private:
+  void generate(const FilmTile& tile, int firstSample, int nSamples);
+  void sortQueue();
+  void extend();
+  void shade(int depth);
+  void traceShadows();
+
+  // Per path state.
+  std::vector<RNG> rngs;
+  std::vector<Vector3> radiance;
+  std::vector<int32_t> pixel;
+
+  RayQueue rayQueue, nextQueue, shadowQueue, sortedQueue;
+  std::vector<uint64_t> sortKeys;
+  // Light each shadow ray carries if unoccluded.
+  std::vector<Vector3> shadowLight;
+
+  // Hits of the extend stage: t is Infinity on a miss.
+  std::vector<float> hitT;
+  std::vector<Vector3> hitP, hitN;
+
+  DISALLOW_COPY_AND_ASSIGN(WavefrontIntegrator);
+};
+
+}  // namespace skirt
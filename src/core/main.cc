@@ -8,39 +8,51 @@
 
 #include "core/AABB.h"
 #include "core/Matrix4.h"
+#include "core/Parallel.h"
+#include "core/Renderer.h"
 #include "core/Scene.h"
 
 #include "core/Film.h"
 #include "core/Integrator.h"
 
 #include "core/EFloat.h"
-#include "shapes/Sphere.h"
 
 namespace skirt {
 
-int mainShared(UNUSED int argc, UNUSED char** argv) {
-  unique_ptr<Scene> scene(LoadSceneFile("data/example.scene"));
-  // unique_ptr<Scene> scene(new Scene());
-
-  shared_ptr<Shape> sphere(new Sphere(0.5));
-  shared_ptr<Element> obj(new Element(sphere));
-
-  scene->SetRootElement(obj);
+// skirt [--compile] [scene]
+//
+// With --compile the scene is loaded from the compiled copy next to it when
+// that's up to date, and the copy is written otherwise (see
+// loader/CompiledScene.h).
+int mainShared(int argc, char** argv) {
+  ParallelInit();
+
+  string filename = "data/example.scene";
+  bool compile = false;
+  for (int i = 1; i < argc; ++i) {
+    if (string(argv[i]) == "--compile") {
+      compile = true;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  unique_ptr<Scene> scene(LoadSceneFile(filename, compile));
 
   unique_ptr<const Scene> final(scene->Bake(move(scene)));
 
-  // Main thread
   Film film = final->MakeFilm();
 
-  // // Multi thread
-  unique_ptr<Integrator> integrator = final->MakeIntegrator();
-  int x = 0, y = 0, width = 200, height = 100;
-  FilmTile tile = integrator->Render(x, y, width, height);
-
-  // // Main thread
-  film.MergeTile(tile);
-  film.SaveImage();
+  Renderer renderer(final.get(), final->desc->tileSize,
+                    final->desc->tileOrder);
+  renderer.pixelSamples = final->desc->pixelSamples;
+  renderer.passSamples = final->desc->passSamples;
+  renderer.errorThreshold = final->desc->errorThreshold;
+  renderer.timeBudget = final->desc->timeBudget;
+  renderer.onPass = [](Film* film, int) { film->SaveImage(); };
+  renderer.Render(&film);
 
+  ParallelCleanup();
   return 0;
 }
 
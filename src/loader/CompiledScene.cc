@@ -0,0 +1,439 @@
+#include "loader/CompiledScene.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+
+#include "core/skirt.h"
+
+#include "core/Element.h"
+#include "core/Matrix4.h"
+#include "core/Parallel.h"
+#include "core/Vector3.h"
+#include "loader/MappedFile.h"
+#include "shapes/Sphere.h"
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+namespace {
+
+constexpr char magic[8] = {'S', 'K', 'I', 'R', 'T', 'S', 'C', 'N'};
+constexpr uint32_t version = 1;
+// Written as is, so files from a machine of the other byte order don't match.
+constexpr uint32_t byteOrder = 0x01020304;
+// Arrays start aligned to cache lines.
+constexpr uint64_t alignment = 64;
+
+enum ShapeType : uint32_t { SphereShape = 0, MeshShape = 1 };
+
+// Offsets are from the start of the file.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint64_t descriptionOffset, descriptionSize;
+  uint64_t sourceCount, sourcesOffset;
+  uint64_t shapeCount, shapesOffset;
+  uint64_t transformCount, transformsOffset;
+  uint64_t elementCount, elementsOffset;
+};
+
+// A file the scene was loaded from, as it was then.
+struct Source {
+  int64_t size;
+  int64_t time;
+  uint64_t pathOffset, pathSize;
+};
+
+// Mesh arrays hold vertexCount floats, or indexCount indices, and are at
+// offset 0 when the mesh doesn't have them.
+struct ShapeRecord {
+  uint32_t type;
+  float radius;
+  uint64_t vertexCount, indexCount;
+  uint64_t px, py, pz;
+  uint64_t nx, ny, nz;
+  uint64_t tu, tv;
+  uint64_t indices;
+};
+
+struct TransformRecord {
+  Matrix4 objectToWorld, worldToObject;
+};
+static_assert(std::is_trivially_copyable<Matrix4>::value,
+              "Matrix4 is stored as is");
+
+struct ElementRecord {
+  int32_t shape;
+  int32_t transform;  // -1 for none
+};
+
+// Calls f on every field of the Description, in the order they are stored.
+template <typename D, typename F>
+void describe(D& d, F& f) {
+  f(d.lookAtFrom);
+  f(d.lookAtTo);
+  f(d.cameraType);
+  f(d.cameraFOV);
+  f(d.cameraAperture);
+  f(d.cameraFocusDistance);
+  f(d.samplerType);
+  f(d.pixelSamples);
+  f(d.errorThreshold);
+  f(d.integratorType);
+  f(d.tileSize);
+  f(d.packetSize);
+  f(d.tileOrder);
+  f(d.passSamples);
+  f(d.timeBudget);
+  f(d.maxDepth);
+  f(d.sortRays);
+  f(d.acceleratorType);
+  f(d.maxPrimsInNode);
+  f(d.acceleratorWidth);
+  f(d.duplicationBudget);
+  f(d.compressNodes);
+  f(d.acceleratorCache);
+  f(d.filmType);
+  f(d.filmFilename);
+  f(d.width);
+  f(d.height);
+}
+
+struct DescriptionWriter {
+  template <typename T>
+  void operator()(const T& v) {
+    static_assert(std::is_trivially_copyable<T>::value, "Stored as is");
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+  void operator()(const Vector3& v) {
+    (*this)(v.x);
+    (*this)(v.y);
+    (*this)(v.z);
+  }
+  void operator()(const string& s) {
+    (*this)(uint32_t(s.size()));
+    out.append(s);
+  }
+
+  string out;
+};
+
+struct DescriptionReader {
+  template <typename T>
+  void operator()(T& v) {
+    if (size_t(end - p) < sizeof(T)) {
+      valid = false;
+      return;
+    }
+    static_assert(std::is_trivially_copyable<T>::value, "Stored as is");
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+  }
+  void operator()(Vector3& v) {
+    (*this)(v.x);
+    (*this)(v.y);
+    (*this)(v.z);
+  }
+  void operator()(string& s) {
+    uint32_t size = 0;
+    (*this)(size);
+    if (!valid || size_t(end - p) < size) {
+      valid = false;
+      return;
+    }
+    s.assign(p, size);
+    p += size;
+  }
+
+  const char* p;
+  const char* end;
+  bool valid = true;
+};
+
+bool fileStamp(const string& path, int64_t* size, int64_t* time) {
+  std::error_code error;
+  *size = std::filesystem::file_size(path, error);
+  if (error) return false;
+  *time = std::filesystem::last_write_time(path, error)
+              .time_since_epoch()
+              .count();
+  return !error;
+}
+
+// Appends aligned arrays to a file, keeping track of where they go.
+class Writer {
+ public:
+  explicit Writer(const string& filename)
+      : out(filename, std::ios::binary) {}
+
+  template <typename T>
+  uint64_t Write(const T* data, size_t count) {
+    if (count == 0) return 0;
+    const char zeros[alignment] = {};
+    const uint64_t start = (offset + alignment - 1) & ~(alignment - 1);
+    out.write(zeros, start - offset);
+    out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+    offset = start + count * sizeof(T);
+    return start;
+  }
+  template <typename T>
+  uint64_t Write(const std::vector<T>& v) {
+    return Write(v.data(), v.size());
+  }
+
+  std::ofstream out;
+  uint64_t offset = 0;
+};
+
+}  // namespace
+
+bool WriteCompiledScene(const Scene& scene,
+                        const std::vector<string>& sources,
+                        const string& filename) {
+  // Shapes are stored once, in the order elements first use them.
+  std::unordered_map<const Shape*, int32_t> shapeIndex;
+  std::vector<const Shape*> shapes;
+  std::vector<TransformRecord> transforms;
+  std::vector<ElementRecord> elements(scene.elements.size());
+  for (size_t i = 0; i < scene.elements.size(); ++i) {
+    const Element& e = *scene.elements[i];
+    auto shape = shapeIndex.emplace(e.GetShape(), shapes.size());
+    if (shape.second) shapes.push_back(e.GetShape());
+    elements[i].shape = shape.first->second;
+    elements[i].transform = -1;
+    if (e.HasTransform()) {
+      elements[i].transform = transforms.size();
+      transforms.push_back({e.ObjectToWorld(), e.WorldToObject()});
+    }
+  }
+
+  const string temp = StringPrintf("%s.%d.tmp", filename.c_str(), getpid());
+  Writer w(temp);
+  Header h = {};
+  w.Write(&h, 1);
+
+  const Description defaults{};
+  DescriptionWriter desc;
+  describe(scene.desc ? *scene.desc : defaults, desc);
+  h.descriptionOffset = w.Write(desc.out.data(), desc.out.size());
+  h.descriptionSize = desc.out.size();
+
+  std::vector<Source> stamps(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (!fileStamp(sources[i], &stamps[i].size, &stamps[i].time)) {
+      LOG(ERROR) << "Can't compile scene, " << sources[i] << " is missing";
+      std::remove(temp.c_str());
+      return false;
+    }
+    stamps[i].pathOffset = w.Write(sources[i].data(), sources[i].size());
+    stamps[i].pathSize = sources[i].size();
+  }
+  h.sourceCount = stamps.size();
+  h.sourcesOffset = w.Write(stamps);
+
+  std::vector<ShapeRecord> records(shapes.size());
+  for (size_t i = 0; i < shapes.size(); ++i) {
+    ShapeRecord& r = records[i];
+    r = {};
+    if (const Sphere* s = dynamic_cast<const Sphere*>(shapes[i])) {
+      r.type = SphereShape;
+      r.radius = s->radius;
+    } else if (const TriangleMesh* m =
+                   dynamic_cast<const TriangleMesh*>(shapes[i])) {
+      r.type = MeshShape;
+      r.vertexCount = m->VertexCount();
+      r.indexCount = m->indices.size();
+      r.px = w.Write(m->px);
+      r.py = w.Write(m->py);
+      r.pz = w.Write(m->pz);
+      r.nx = w.Write(m->nx);
+      r.ny = w.Write(m->ny);
+      r.nz = w.Write(m->nz);
+      r.tu = w.Write(m->tu);
+      r.tv = w.Write(m->tv);
+      r.indices = w.Write(m->indices);
+    } else {
+      LOG(ERROR) << "Can't compile scene, it has a shape other than spheres "
+                    "and triangle meshes";
+      w.out.close();
+      std::remove(temp.c_str());
+      return false;
+    }
+  }
+  h.shapeCount = records.size();
+  h.shapesOffset = w.Write(records);
+  h.transformCount = transforms.size();
+  h.transformsOffset = w.Write(transforms);
+  h.elementCount = elements.size();
+  h.elementsOffset = w.Write(elements);
+
+  memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.byteOrder = byteOrder;
+  w.out.seekp(0);
+  w.out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  w.out.close();
+
+  if (!w.out || std::rename(temp.c_str(), filename.c_str()) != 0) {
+    LOG(ERROR) << "Can't write compiled scene " << filename << ": "
+               << strerror(errno);
+    std::remove(temp.c_str());
+    return false;
+  }
+  DVLOG(1) << "Scene compiled to " << filename;
+  return true;
+}
+
+unique_ptr<Scene> ReadCompiledScene(const string& filename) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename, error)) return nullptr;
+
+  MappedFile file(filename);
+  if (!file.IsValid()) return nullptr;
+
+  Header h;
+  if (file.size < sizeof(h)) {
+    LOG(WARNING) << "Ignoring truncated compiled scene " << filename;
+    return nullptr;
+  }
+  memcpy(&h, file.data, sizeof(h));
+  if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+      h.byteOrder != byteOrder) {
+    LOG(WARNING) << "Ignoring compiled scene " << filename
+                 << " written by another version";
+    return nullptr;
+  }
+
+  // Whether count items of size bytes from offset are all in the file, at
+  // the alignment Writer gives them.
+  auto inFile = [&](uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % alignment == 0 && offset <= file.size &&
+           count <= (file.size - offset) / size;
+  };
+  if (!inFile(h.descriptionOffset, h.descriptionSize, 1) ||
+      !inFile(h.sourcesOffset, h.sourceCount, sizeof(Source)) ||
+      !inFile(h.shapesOffset, h.shapeCount, sizeof(ShapeRecord)) ||
+      !inFile(h.transformsOffset, h.transformCount, sizeof(TransformRecord)) ||
+      !inFile(h.elementsOffset, h.elementCount, sizeof(ElementRecord))) {
+    LOG(WARNING) << "Ignoring truncated compiled scene " << filename;
+    return nullptr;
+  }
+
+  const Source* sources =
+      reinterpret_cast<const Source*>(file.data + h.sourcesOffset);
+  for (uint64_t i = 0; i < h.sourceCount; ++i) {
+    const Source& s = sources[i];
+    if (!inFile(s.pathOffset, s.pathSize, 1)) return nullptr;
+    const string path(file.data + s.pathOffset, s.pathSize);
+    int64_t size, time;
+    if (!fileStamp(path, &size, &time) || size != s.size || time != s.time) {
+      DVLOG(1) << "Not loading " << filename << ", " << path << " changed";
+      return nullptr;
+    }
+  }
+
+  unique_ptr<Scene> scene(new Scene());
+  scene->desc.reset(new Description);
+  DescriptionReader desc{file.data + h.descriptionOffset,
+                         file.data + h.descriptionOffset + h.descriptionSize};
+  describe(*scene->desc, desc);
+  if (!desc.valid || desc.p != desc.end) {
+    LOG(WARNING) << "Ignoring compiled scene " << filename
+                 << " with a bad description";
+    return nullptr;
+  }
+
+  const ShapeRecord* records =
+      reinterpret_cast<const ShapeRecord*>(file.data + h.shapesOffset);
+  std::vector<shared_ptr<Shape>> shapes(h.shapeCount);
+  for (uint64_t i = 0; i < h.shapeCount; ++i) {
+    const ShapeRecord& r = records[i];
+    if (r.type == SphereShape) {
+      shapes[i].reset(new Sphere(r.radius));
+      continue;
+    }
+
+    shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+    bool valid = r.type == MeshShape && r.indexCount % 3 == 0;
+    auto copy = [&](uint64_t offset, uint64_t count, auto* v) {
+      typedef typename std::remove_pointer<decltype(v)>::type::value_type T;
+      if (offset == 0) return;
+      if (!inFile(offset, count, sizeof(T))) {
+        valid = false;
+        return;
+      }
+      const T* data = reinterpret_cast<const T*>(file.data + offset);
+      v->assign(data, data + count);
+    };
+    copy(r.px, r.vertexCount, &mesh->px);
+    copy(r.py, r.vertexCount, &mesh->py);
+    copy(r.pz, r.vertexCount, &mesh->pz);
+    copy(r.nx, r.vertexCount, &mesh->nx);
+    copy(r.ny, r.vertexCount, &mesh->ny);
+    copy(r.nz, r.vertexCount, &mesh->nz);
+    copy(r.tu, r.vertexCount, &mesh->tu);
+    copy(r.tv, r.vertexCount, &mesh->tv);
+    copy(r.indices, r.indexCount, &mesh->indices);
+    // Every vertex has a position, and either all or none of the normal and
+    // uv components, and triangles only use vertices the mesh has.
+    const uint64_t n = r.vertexCount;
+    valid = valid && mesh->px.size() == n && mesh->py.size() == n &&
+            mesh->pz.size() == n && mesh->ny.size() == mesh->nx.size() &&
+            mesh->nz.size() == mesh->nx.size() &&
+            mesh->tv.size() == mesh->tu.size() &&
+            std::all_of(mesh->indices.begin(), mesh->indices.end(),
+                        [n](uint32_t index) { return index < n; });
+    if (!valid) {
+      LOG(WARNING) << "Ignoring compiled scene " << filename
+                   << " with a bad shape";
+      return nullptr;
+    }
+    shapes[i] = mesh;
+  }
+
+  // Elements are made in parallel, as there may be millions of them.
+  const TransformRecord* transforms = reinterpret_cast<const TransformRecord*>(
+      file.data + h.transformsOffset);
+  const ElementRecord* elements =
+      reinterpret_cast<const ElementRecord*>(file.data + h.elementsOffset);
+  std::atomic<bool> valid(true);
+  scene->elements.resize(h.elementCount);
+  ParallelFor(
+      [&](int64_t i) {
+        const ElementRecord& r = elements[i];
+        if (r.shape < 0 || uint64_t(r.shape) >= h.shapeCount ||
+            r.transform < -1 || r.transform >= int64_t(h.transformCount)) {
+          valid = false;
+          return;
+        }
+        if (r.transform < 0) {
+          scene->elements[i].reset(new Element(shapes[r.shape]));
+        } else {
+          const TransformRecord& t = transforms[r.transform];
+          scene->elements[i].reset(
+              new Element(shapes[r.shape], t.objectToWorld, t.worldToObject));
+        }
+      },
+      h.elementCount,
+      16 * 1024);
+  if (!valid) {
+    LOG(WARNING) << "Ignoring compiled scene " << filename
+                 << " with a bad element";
+    return nullptr;
+  }
+
+  DVLOG(1) << "Scene loaded from " << filename << " with "
+           << scene->elements.size() << " elements and " << shapes.size()
+           << " shapes";
+  return scene;
+}
+
+}  // namespace skirt
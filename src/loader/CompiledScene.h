@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "core/Scene.h"
+
+namespace skirt {
+
+/*
+Binary copy of a loaded scene, so it can be loaded again without parsing YAML
+or mesh files: the Description, the shapes with their vertex and index arrays,
+and the elements with their transforms, each stored as a flat array at an
+offset in the file. Loading maps the file and copies the arrays out in bulk.
+
+It also records the size and modification time of the files the scene was
+loaded from, and isn't loaded once any of them changed. Only spheres and
+triangle meshes, the shapes scene files can make, are stored.
+*/
+
+// Writes scene, loaded from sources, to filename. Returns false, after
+// logging why, when it can't.
+bool WriteCompiledScene(const Scene& scene,
+                        const std::vector<string>& sources,
+                        const string& filename);
+
+// Loads the scene in filename. Returns nullptr when there's no such file, it
+// was written by another version, or its sources changed.
+unique_ptr<Scene> ReadCompiledScene(const string& filename);
+
+}  // namespace skirt
@@ -1,23 +1,145 @@
 // loader
 
+#include <filesystem>
+#include <unordered_map>
+
 #include <yaml-cpp/yaml.h>
 
 #include "core/skirt.h"
 
+#include "core/Matrix4.h"
 #include "core/Scene.h"
+#include "loader/CompiledScene.h"
 #include "loader/Loader.h"
+#include "loader/MeshLoader.h"
+#include "shapes/Sphere.h"
 
 #include "loader/parser.h"
 
 namespace skirt {
 
 Description* desc;
+Scene* currentScene;
+// Where relative file names in the scene are looked up.
+std::filesystem::path sceneDirectory;
+// Files the scene is read from, for the compiled copy to check.
+std::vector<string> sources;
 bool loaderError = false;
 
-void evalWorld(const YAML::Node& node) {
-  assertSequence(node);
+string scenePath(const string& filename) {
+  return (sceneDirectory / filename).string();
+}
+
+// Meshes already loaded, by path, so placing the same file many times shares
+// a single shape.
+std::unordered_map<string, shared_ptr<Shape>> meshes;
+
+shared_ptr<Shape> evalShape(const string& type, const YAML::Node& node) {
+  assertMap(node);
+
+  if (type == "sphere") {
+    float radius = 1;
+    for (const auto& child : node) {
+      const string key = lower(child.first.as<string>());
+      if (key == "radius") {
+        radius = parseFloat(child.second);
+      } else {
+        error("Invalid key", child.first);
+      }
+    }
+    return shared_ptr<Shape>(new Sphere(radius));
+  }
+
+  if (type == "plymesh" || type == "objmesh") {
+    string filename;
+    for (const auto& child : node) {
+      const string key = lower(child.first.as<string>());
+      if (key == "filename") {
+        filename = parseString(child.second);
+      } else {
+        error("Invalid key", child.first);
+      }
+    }
+    if (filename.empty()) {
+      error("Missing filename", node);
+      return nullptr;
+    }
+
+    const string path = scenePath(filename);
+    shared_ptr<Shape>& mesh = meshes[type + ":" + path];
+    if (!mesh) {
+      mesh = type == "plymesh" ? LoadPLYMesh(path) : LoadOBJMesh(path);
+      sources.push_back(std::filesystem::absolute(path).string());
+    }
+    if (!mesh) error("Can't load mesh " + filename, node);
+    return mesh;
+  }
+
+  error("Invalid shape type " + type, node);
+  return nullptr;
+}
+
+// Transform steps, applied to the shape in reverse order: the last one
+// listed is the first applied to it, as when composing matrices.
+Matrix4 evalTransform(const YAML::Node& node) {
+  assertMap(node);
+  Matrix4 m;
   for (const auto& child : node) {
     const string key = lower(child.first.as<string>());
+
+    if (key == "translate") {
+      m.Translate(parseVector3(child.second));
+    } else if (key == "scale") {
+      if (child.second.IsSequence()) {
+        m.Scale(parseVector3(child.second));
+      } else {
+        m.Scale(parseFloat(child.second));
+      }
+    } else if (key == "rotate") {
+      // [degrees, axis x, axis y, axis z]
+      assertSequence(child.second, 4);
+      const float degrees = parseFloat(child.second[0]);
+      const Vector3 axis(parseFloat(child.second[1]),
+                         parseFloat(child.second[2]),
+                         parseFloat(child.second[3]));
+      m.Rotate(axis, degrees * PI / 180);
+    } else {
+      error("Invalid key", child.first);
+    }
+  }
+  return m;
+}
+
+void evalWorld(const YAML::Node& node) {
+  assertSequence(node);
+  for (const auto& item : node) {
+    assertMap(item);
+    shared_ptr<Shape> shape;
+    optional<Matrix4> transform;
+
+    for (const auto& child : item) {
+      const string key = child.first.as<string>();
+      const int dot = key.find('.');
+      const string command = lower(key.substr(0, dot));
+      const string type = dot == -1 ? "" : lower(key.substr(dot + 1));
+
+      // There are no materials yet, every element is a bare shape.
+      if (command == "shape") {
+        shape = evalShape(type, child.second);
+      } else if (command == "transform") {
+        transform = evalTransform(child.second);
+      } else if (command != "element" && command != "material") {
+        error("Invalid key", child.first);
+      }
+      if (loaderError) return;
+    }
+
+    if (!shape) {
+      error("Element without shape", item);
+      return;
+    }
+    currentScene->AddElement(shared_ptr<Element>(
+        transform ? new Element(shape, *transform) : new Element(shape)));
   }
 }
 
@@ -54,10 +176,70 @@ void evalCamera(const string& type, const YAML::Node& node) {
   }
 }
 
+void evalSampler(const string& type, const YAML::Node& node) {
+  desc->samplerType = type;
+  for (const auto& child : node) {
+    const string key = lower(child.first.as<string>());
+
+    if (key == "pixelsamples") {
+      desc->pixelSamples = parseInt(child.second);
+    } else if (key == "errorthreshold") {
+      desc->errorThreshold = parseFloat(child.second);
+    } else {
+      error("Invalid key", child.first);
+    }
+  }
+}
+
 void evalIntegrator(const string& type, const YAML::Node& node) {
   desc->integratorType = type;
   for (const auto& child : node) {
-    error("Invalid key", child.first);
+    const string key = lower(child.first.as<string>());
+
+    if (key == "tilesize") {
+      desc->tileSize = parseInt(child.second);
+    } else if (key == "tileorder") {
+      if (!ParseTileOrder(lower(parseString(child.second)), &desc->tileOrder)) {
+        error("Invalid tile order", child.second);
+      }
+    } else if (key == "passsamples") {
+      desc->passSamples = parseInt(child.second);
+    } else if (key == "timebudget") {
+      desc->timeBudget = parseFloat(child.second);
+    } else if (key == "packetsize") {
+      desc->packetSize = parseInt(child.second);
+      if (desc->packetSize < 1 ||
+          desc->packetSize > Accelerator::MaxPacketSize) {
+        error("Invalid packet size", child.second);
+      }
+    } else if (key == "maxdepth") {
+      desc->maxDepth = parseInt(child.second);
+    } else if (key == "sortrays") {
+      desc->sortRays = parseBool(child.second);
+    } else {
+      error("Invalid key", child.first);
+    }
+  }
+}
+
+void evalAccelerator(const string& type, const YAML::Node& node) {
+  desc->acceleratorType = type;
+  for (const auto& child : node) {
+    const string key = lower(child.first.as<string>());
+
+    if (key == "maxprimsinnode") {
+      desc->maxPrimsInNode = parseInt(child.second);
+    } else if (key == "width") {
+      desc->acceleratorWidth = parseInt(child.second);
+    } else if (key == "duplicationbudget") {
+      desc->duplicationBudget = parseFloat(child.second);
+    } else if (key == "compressed") {
+      desc->compressNodes = parseBool(child.second);
+    } else if (key == "cache") {
+      desc->acceleratorCache = scenePath(parseString(child.second));
+    } else {
+      error("Invalid key", child.first);
+    }
   }
 }
 
@@ -85,6 +267,7 @@ unique_ptr<Scene> LoadScene(YAML::Node root) {
   unique_ptr<Scene> scene(new Scene());
   scene->desc.reset(new Description);
   desc = scene->desc.get();
+  currentScene = scene.get();
   loaderError = false;
 
   for (const auto& child : root) {
@@ -101,8 +284,12 @@ unique_ptr<Scene> LoadScene(YAML::Node root) {
       evalLookAt(child.second);
     } else if (command == "camera") {
       evalCamera(type, child.second);
+    } else if (command == "sampler") {
+      evalSampler(type, child.second);
     } else if (command == "integrator") {
       evalIntegrator(type, child.second);
+    } else if (command == "accelerator") {
+      evalAccelerator(type, child.second);
     } else if (command == "film") {
       evalFilm(type, child.second);
     } else if (command == "world") {
@@ -112,15 +299,28 @@ unique_ptr<Scene> LoadScene(YAML::Node root) {
     if (loaderError) break;
   }
 
+  meshes.clear();
   if (loaderError) return nullptr;
 
   desc = nullptr;
+  currentScene = nullptr;
   return scene;
 }
 
-unique_ptr<Scene> LoadSceneFile(const string& filename) {
+unique_ptr<Scene> LoadSceneFile(const string& filename, bool compile) {
+  const string compiled = filename + ".compiled";
+  unique_ptr<Scene> scene;
+  if (compile) scene = ReadCompiledScene(compiled);
+  if (scene) return scene;
+
   YAML::Node root = YAML::LoadFile(filename);
-  return LoadScene(std::move(root));
+  sceneDirectory = std::filesystem::path(filename).parent_path();
+  sources = {std::filesystem::absolute(filename).string()};
+  scene = LoadScene(std::move(root));
+  if (scene && compile) WriteCompiledScene(*scene, sources, compiled);
+  sceneDirectory.clear();
+  sources.clear();
+  return scene;
 }
 
 unique_ptr<Scene> LoadSceneString(const string& data) {
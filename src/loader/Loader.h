@@ -6,7 +6,10 @@
 
 namespace skirt {
 
-unique_ptr<Scene> LoadSceneFile(const string& filename);
+// With compile, loads the compiled copy next to filename, <filename>.compiled,
+// when it's up to date, and otherwise parses filename and writes the copy for
+// next time. The directory has to be writable for that.
+unique_ptr<Scene> LoadSceneFile(const string& filename, bool compile = false);
 unique_ptr<Scene> LoadSceneString(const string& data);
 
 }  // namespace skirt
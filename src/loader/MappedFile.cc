@@ -0,0 +1,54 @@
+#include "loader/MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+MappedFile::MappedFile(const string& filename, bool sequential) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Can't open " << filename << ": " << strerror(errno);
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    size = st.st_size;
+    if (size == 0) {
+      valid = true;
+      close(fd);
+      return;
+    }
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+      data = static_cast<const char*>(p);
+      mapped = valid = true;
+    }
+  }
+  close(fd);
+  if (mapped) return;
+
+  DVLOG(1) << "Can't map " << filename << ", reading it instead";
+  std::ifstream in(filename, std::ios::binary);
+  buffer.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  if (in.good()) {
+    data = buffer.data();
+    size = buffer.size();
+    valid = true;
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (mapped) munmap(const_cast<char*>(data), size);
+}
+
+}  // namespace skirt
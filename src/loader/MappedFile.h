@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+/*
+Read-only view of a whole file, mapped into memory so parsers can read it in
+place, from many threads, without copying it into buffers first. Where the
+file can't be mapped it is read into memory instead.
+
+Files read once front to back are mapped as sequential, so the kernel can
+read ahead and drop pages already read. Others are read ahead whole.
+*/
+class MappedFile {
+ public:
+  explicit MappedFile(const string& filename, bool sequential = true);
+  ~MappedFile();
+
+  INLINE bool IsValid() const {
+    return valid;
+  }
+
+  const char* data = nullptr;
+  size_t size = 0;
+
+ private:
+  bool valid = false;
+  bool mapped = false;
+  std::vector<char> buffer;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace skirt
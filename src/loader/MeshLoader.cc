@@ -0,0 +1,789 @@
+#include "loader/MeshLoader.h"
+
+#include <atomic>
+#include <sstream>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "core/Parallel.h"
+#include "loader/MappedFile.h"
+
+namespace skirt {
+
+namespace {
+
+// Not config.h's BIG_ENDIAN: <endian.h> defines that name on glibc too.
+constexpr bool littleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+// Vertices copied by each task of a parallel PLY copy.
+constexpr int vertexChunk = 64 * 1024;
+
+// Bytes of OBJ text parsed by each task.
+constexpr size_t objChunk = 4 << 20;
+
+// Text scanning for ascii PLY and OBJ. Mapped files aren't null terminated,
+// so every scan is bounded by end.
+
+INLINE bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+INLINE void skipSpaces(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+}
+
+INLINE void skipWhitespace(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    ++p;
+  }
+}
+
+INLINE const char* endOfLine(const char* p, const char* end) {
+  const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+bool scanInt(const char*& p, const char* end, int64_t* v) {
+  bool neg = false;
+  if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+  if (p == end || !isDigit(*p)) return false;
+  int64_t r = 0;
+  while (p < end && isDigit(*p)) r = r * 10 + (*p++ - '0');
+  *v = neg ? -r : r;
+  return true;
+}
+
+// Decimal number with optional fraction and exponent. Digits past the 19th
+// significant one are dropped, far below float precision.
+bool scanFloat(const char*& p, const char* end, float* v) {
+  bool neg = false;
+  if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false;
+  for (; p < end && isDigit(*p); ++p) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa > 0;
+    } else {
+      exponent++;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && isDigit(*p); ++p) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa > 0;
+        exponent--;
+      }
+    }
+  }
+  if (!any) return false;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    int64_t e;
+    if (scanInt(q, end, &e)) {
+      exponent += clamp<int64_t>(e, -400, 400);
+      p = q;
+    }
+  }
+
+  // Powers of 10 up to 22 are exact doubles, so this rounds once for most
+  // inputs.
+  double r = mantissa;
+  if (exponent > 0) r *= std::pow(10.0, exponent);
+  if (exponent < 0) r /= std::pow(10.0, -exponent);
+  *v = neg ? -r : r;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PLY
+
+enum class PlyType {
+  None,
+  Int8,
+  UInt8,
+  Int16,
+  UInt16,
+  Int32,
+  UInt32,
+  F32,
+  F64
+};
+
+PlyType plyType(const string& s) {
+  if (s == "char" || s == "int8") return PlyType::Int8;
+  if (s == "uchar" || s == "uint8") return PlyType::UInt8;
+  if (s == "short" || s == "int16") return PlyType::Int16;
+  if (s == "ushort" || s == "uint16") return PlyType::UInt16;
+  if (s == "int" || s == "int32") return PlyType::Int32;
+  if (s == "uint" || s == "uint32") return PlyType::UInt32;
+  if (s == "float" || s == "float32") return PlyType::F32;
+  if (s == "double" || s == "float64") return PlyType::F64;
+  return PlyType::None;
+}
+
+int plySize(PlyType t) {
+  switch (t) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+      return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::F32:
+      return 4;
+    case PlyType::F64:
+      return 8;
+    case PlyType::None:
+      break;
+  }
+  return 0;
+}
+
+template <typename T>
+INLINE T loadRaw(const char* p, bool swap) {
+  char bytes[sizeof(T)];
+  if (swap) {
+    for (size_t i = 0; i < sizeof(T); ++i) bytes[i] = p[sizeof(T) - 1 - i];
+    p = bytes;
+  }
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+INLINE double readBinary(PlyType t, const char* p, bool swap) {
+  switch (t) {
+    case PlyType::Int8:
+      return int8_t(*p);
+    case PlyType::UInt8:
+      return uint8_t(*p);
+    case PlyType::Int16:
+      return loadRaw<int16_t>(p, swap);
+    case PlyType::UInt16:
+      return loadRaw<uint16_t>(p, swap);
+    case PlyType::Int32:
+      return loadRaw<int32_t>(p, swap);
+    case PlyType::UInt32:
+      return loadRaw<uint32_t>(p, swap);
+    case PlyType::F32:
+      return loadRaw<float>(p, swap);
+    case PlyType::F64:
+      return loadRaw<double>(p, swap);
+    case PlyType::None:
+      break;
+  }
+  return 0;
+}
+
+struct PlyProperty {
+  string name;
+  PlyType type = PlyType::None;
+  PlyType countType = PlyType::None;  // set for lists
+
+  bool IsList() const {
+    return countType != PlyType::None;
+  }
+};
+
+struct PlyElement {
+  string name;
+  int64_t count = 0;
+  std::vector<PlyProperty> properties;
+
+  // Bytes per item in binary files, or 0 when the items have lists.
+  int Stride() const {
+    int stride = 0;
+    for (const PlyProperty& p : properties) {
+      if (p.IsList()) return 0;
+      stride += plySize(p.type);
+    }
+    return stride;
+  }
+
+  int Find(const string& name) const {
+    for (size_t i = 0; i < properties.size(); ++i) {
+      if (properties[i].name == name) return i;
+    }
+    return -1;
+  }
+};
+
+/*
+Reads the body of a PLY file, element by element, into a TriangleMesh.
+Binary vertices have a fixed size, so they are copied straight from the
+mapped file into the mesh arrays in parallel; faces have a vertex count each
+and are read in order.
+*/
+class PlyReader {
+ public:
+  PlyReader(const MappedFile& file, const string& filename)
+      : filename(filename), p(file.data), end(file.data + file.size) {}
+
+  shared_ptr<TriangleMesh> Read();
+
+ private:
+  bool fail(const string& why) {
+    LOG(ERROR) << filename << ": " << why;
+    return false;
+  }
+
+  bool readHeader();
+  bool readVertices(const PlyElement& e);
+  bool readFaces(const PlyElement& e);
+  bool skip(const PlyElement& e);
+
+  // One value of the body, as text or binary.
+  bool value(PlyType type, double* v);
+
+  const string& filename;
+  const char* p;
+  const char* end;
+  bool ascii = false, swap = false;
+  std::vector<PlyElement> elements;
+  shared_ptr<TriangleMesh> mesh;
+};
+
+bool PlyReader::readHeader() {
+  const char* eol = endOfLine(p, end);
+  if (string(p, eol - p) != "ply" && string(p, eol - p) != "ply\r") {
+    return fail("Not a PLY file");
+  }
+
+  bool hasFormat = false;
+  while (eol < end) {
+    p = eol + 1;
+    eol = endOfLine(p, end);
+    std::istringstream line(string(p, eol - p));
+    string keyword;
+    line >> keyword;
+
+    if (keyword == "format") {
+      string format;
+      line >> format;
+      if (format == "ascii") {
+        ascii = true;
+      } else if (format == "binary_little_endian") {
+        swap = !littleEndian;
+      } else if (format == "binary_big_endian") {
+        swap = littleEndian;
+      } else {
+        return fail("Unknown format " + format);
+      }
+      hasFormat = true;
+    } else if (keyword == "element") {
+      PlyElement e;
+      if (!(line >> e.name >> e.count) || e.count < 0) {
+        return fail("Bad element");
+      }
+      elements.push_back(e);
+    } else if (keyword == "property") {
+      if (elements.empty()) return fail("Property out of an element");
+      PlyProperty prop;
+      string type;
+      line >> type;
+      if (type == "list") {
+        string countType;
+        line >> countType >> type;
+        prop.countType = plyType(countType);
+        if (prop.countType == PlyType::None) return fail("Bad list type");
+      }
+      prop.type = plyType(type);
+      if (prop.type == PlyType::None || !(line >> prop.name)) {
+        return fail("Bad property");
+      }
+      elements.back().properties.push_back(prop);
+    } else if (keyword == "end_header") {
+      p = eol < end ? eol + 1 : end;
+      if (!hasFormat) return fail("Missing format");
+      return true;
+    } else if (keyword != "comment" && keyword != "obj_info" &&
+               !keyword.empty()) {
+      return fail("Unknown header line " + keyword);
+    }
+  }
+  return fail("Missing end_header");
+}
+
+bool PlyReader::value(PlyType type, double* v) {
+  if (!ascii) {
+    const int size = plySize(type);
+    if (end - p < size) return false;
+    *v = readBinary(type, p, swap);
+    p += size;
+    return true;
+  }
+
+  skipWhitespace(p, end);
+  float f;
+  if (type == PlyType::F32 || type == PlyType::F64) {
+    if (!scanFloat(p, end, &f)) return false;
+    *v = f;
+    return true;
+  }
+  int64_t i;
+  if (!scanInt(p, end, &i)) return false;
+  *v = i;
+  return true;
+}
+
+bool PlyReader::readVertices(const PlyElement& e) {
+  // Destination of each property, null for the ignored ones.
+  std::vector<std::vector<float>*> dst(e.properties.size(), nullptr);
+  auto attribute = [&](std::initializer_list<const char*> names,
+                       std::vector<float>* v) {
+    for (const char* name : names) {
+      int i = e.Find(name);
+      if (i < 0) continue;
+      if (e.properties[i].IsList()) return false;
+      dst[i] = v;
+      v->resize(e.count);
+      return true;
+    }
+    return false;
+  };
+
+  if (!attribute({"x"}, &mesh->px) || !attribute({"y"}, &mesh->py) ||
+      !attribute({"z"}, &mesh->pz)) {
+    return fail("Vertices without x, y and z");
+  }
+  if (attribute({"nx"}, &mesh->nx) + attribute({"ny"}, &mesh->ny) +
+          attribute({"nz"}, &mesh->nz) <
+      3) {
+    mesh->nx.clear();
+    mesh->ny.clear();
+    mesh->nz.clear();
+    std::fill(dst.begin(), dst.end(), nullptr);
+    attribute({"x"}, &mesh->px);
+    attribute({"y"}, &mesh->py);
+    attribute({"z"}, &mesh->pz);
+  }
+  if (!attribute({"u", "s", "texture_u", "texture_s"}, &mesh->tu) ||
+      !attribute({"v", "t", "texture_v", "texture_t"}, &mesh->tv)) {
+    for (size_t i = 0; i < dst.size(); ++i) {
+      if (dst[i] == &mesh->tu || dst[i] == &mesh->tv) dst[i] = nullptr;
+    }
+    mesh->tu.clear();
+    mesh->tv.clear();
+  }
+
+  const int stride = e.Stride();
+  if (!ascii && stride > 0) {
+    if (int64_t(end - p) / stride < e.count) return fail("Truncated vertices");
+    std::vector<int> offsets(e.properties.size());
+    for (size_t i = 1; i < offsets.size(); ++i) {
+      offsets[i] = offsets[i - 1] + plySize(e.properties[i - 1].type);
+    }
+    const char* base = p;
+    ParallelFor(
+        [&](int64_t v) {
+          const char* item = base + v * stride;
+          for (size_t i = 0; i < dst.size(); ++i) {
+            if (!dst[i]) continue;
+            (*dst[i])[v] =
+                readBinary(e.properties[i].type, item + offsets[i], swap);
+          }
+        },
+        e.count, vertexChunk);
+    p += e.count * stride;
+    return true;
+  }
+
+  for (int64_t v = 0; v < e.count; ++v) {
+    for (size_t i = 0; i < dst.size(); ++i) {
+      const PlyProperty& prop = e.properties[i];
+      double x, n = 1;
+      if (prop.IsList() && !value(prop.countType, &n)) {
+        return fail("Truncated vertices");
+      }
+      for (int k = 0; k < int(n); ++k) {
+        if (!value(prop.type, &x)) return fail("Truncated vertices");
+      }
+      if (dst[i]) (*dst[i])[v] = x;
+    }
+  }
+  return true;
+}
+
+bool PlyReader::readFaces(const PlyElement& e) {
+  int indexProperty = e.Find("vertex_indices");
+  if (indexProperty < 0) indexProperty = e.Find("vertex_index");
+  if (indexProperty < 0 || !e.properties[indexProperty].IsList()) {
+    return fail("Faces without vertex_indices");
+  }
+
+  mesh->indices.reserve(mesh->indices.size() + 3 * e.count);
+  for (int64_t f = 0; f < e.count; ++f) {
+    for (int i = 0; i < int(e.properties.size()); ++i) {
+      const PlyProperty& prop = e.properties[i];
+      double n = 1, x;
+      if (prop.IsList() && !value(prop.countType, &n)) {
+        return fail("Truncated faces");
+      }
+      if (i != indexProperty) {
+        for (int k = 0; k < int(n); ++k) {
+          if (!value(prop.type, &x)) return fail("Truncated faces");
+        }
+        continue;
+      }
+
+      // Fan of triangles around the first vertex.
+      double v0 = 0, prev = 0;
+      for (int k = 0; k < int(n); ++k) {
+        if (!value(prop.type, &x)) return fail("Truncated faces");
+        if (x < 0 || x > std::numeric_limits<uint32_t>::max()) {
+          return fail("Bad vertex index");
+        }
+        if (k == 0) v0 = x;
+        if (k >= 2) {
+          mesh->indices.push_back(v0);
+          mesh->indices.push_back(prev);
+          mesh->indices.push_back(x);
+        }
+        prev = x;
+      }
+    }
+  }
+  return true;
+}
+
+bool PlyReader::skip(const PlyElement& e) {
+  const int stride = e.Stride();
+  if (!ascii && stride > 0) {
+    if (int64_t(end - p) / stride < e.count) return fail("Truncated file");
+    p += e.count * stride;
+    return true;
+  }
+  for (int64_t i = 0; i < e.count; ++i) {
+    for (const PlyProperty& prop : e.properties) {
+      double n = 1, x;
+      if (prop.IsList() && !value(prop.countType, &n)) {
+        return fail("Truncated file");
+      }
+      for (int k = 0; k < int(n); ++k) {
+        if (!value(prop.type, &x)) return fail("Truncated file");
+      }
+    }
+  }
+  return true;
+}
+
+shared_ptr<TriangleMesh> PlyReader::Read() {
+  if (!readHeader()) return nullptr;
+
+  mesh.reset(new TriangleMesh());
+  bool hasVertices = false;
+  for (const PlyElement& e : elements) {
+    bool ok;
+    if (e.name == "vertex" && !hasVertices) {
+      ok = readVertices(e);
+      hasVertices = true;
+    } else if (e.name == "face") {
+      ok = readFaces(e);
+    } else {
+      ok = skip(e);
+    }
+    if (!ok) return nullptr;
+  }
+  if (!hasVertices) {
+    fail("No vertex element");
+    return nullptr;
+  }
+  return mesh;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OBJ
+
+// What each chunk of an OBJ file holds, counted before it is parsed so every
+// chunk knows where its vertices go and how to resolve relative indices.
+struct ObjCounts {
+  int64_t lines = 0, v = 0, vt = 0, vn = 0;
+};
+
+INLINE bool isKeyword(const char* p, const char* end, const char* keyword) {
+  for (; *keyword; ++keyword, ++p) {
+    if (p == end || *p != *keyword) return false;
+  }
+  return p < end && (*p == ' ' || *p == '\t');
+}
+
+ObjCounts countObj(const char* p, const char* end) {
+  ObjCounts c;
+  while (p < end) {
+    const char* eol = endOfLine(p, end);
+    c.lines++;
+    skipSpaces(p, eol);
+    // The same tests parseObjChunk() uses, or it writes past the arrays.
+    c.v += isKeyword(p, eol, "v");
+    c.vt += isKeyword(p, eol, "vt");
+    c.vn += isKeyword(p, eol, "vn");
+    p = eol + 1;
+  }
+  return c;
+}
+
+// Index of a face corner, 1 based or negative from the last one read, as
+// 0 based. Returns -1 when missing or out of [0, count).
+INLINE int64_t objIndex(const char*& p, const char* end, int64_t count) {
+  int64_t i;
+  if (!scanInt(p, end, &i) || i == 0) return -1;
+  i = i > 0 ? i - 1 : count + i;
+  return i < count ? i : -1;
+}
+
+struct ObjChunk {
+  const char* begin;
+  const char* end;
+  ObjCounts first;  // counts before the chunk
+
+  std::vector<uint32_t> indices;
+  // Whether every corner had a texture or normal index equal to its position
+  // index, and whether any had one at all.
+  bool uvsMatch = true, normalsMatch = true;
+  bool anyUV = false, anyNormal = false;
+  string error;
+};
+
+// Parses a chunk of whole lines, writing positions, uvs and normals at their
+// place in the full arrays and keeping the chunk's triangles.
+void parseObjChunk(ObjChunk* chunk,
+                   const ObjCounts& total,
+                   TriangleMesh* mesh,
+                   std::vector<float>* objUV,
+                   std::vector<float>* objNormal) {
+  ObjCounts at = chunk->first;
+  std::vector<int64_t> face;
+  const char* p = chunk->begin;
+  while (p < chunk->end && chunk->error.empty()) {
+    const char* eol = endOfLine(p, chunk->end);
+    at.lines++;  // now the 1 based number of this line
+    skipSpaces(p, eol);
+
+    if (isKeyword(p, eol, "v")) {
+      p += 1;
+      float x, y, z;
+      skipSpaces(p, eol);
+      bool ok = scanFloat(p, eol, &x);
+      skipSpaces(p, eol);
+      ok = ok && scanFloat(p, eol, &y);
+      skipSpaces(p, eol);
+      ok = ok && scanFloat(p, eol, &z);
+      if (!ok) {
+        chunk->error = "Bad vertex";
+        continue;
+      }
+      mesh->px[at.v] = x;
+      mesh->py[at.v] = y;
+      mesh->pz[at.v] = z;
+      at.v++;
+    } else if (isKeyword(p, eol, "vt")) {
+      p += 2;
+      float u = 0, v = 0;
+      skipSpaces(p, eol);
+      bool ok = scanFloat(p, eol, &u);
+      skipSpaces(p, eol);
+      if (ok && p < eol) ok = scanFloat(p, eol, &v);
+      if (!ok) {
+        chunk->error = "Bad texture coordinate";
+        continue;
+      }
+      (*objUV)[2 * at.vt] = u;
+      (*objUV)[2 * at.vt + 1] = v;
+      at.vt++;
+    } else if (isKeyword(p, eol, "vn")) {
+      p += 2;
+      float n[3];
+      bool ok = true;
+      for (int k = 0; k < 3; ++k) {
+        skipSpaces(p, eol);
+        ok = ok && scanFloat(p, eol, &n[k]);
+      }
+      if (!ok) {
+        chunk->error = "Bad normal";
+        continue;
+      }
+      for (int k = 0; k < 3; ++k) (*objNormal)[3 * at.vn + k] = n[k];
+      at.vn++;
+    } else if (isKeyword(p, eol, "f")) {
+      p += 1;
+      face.clear();
+      while (true) {
+        skipSpaces(p, eol);
+        if (p == eol) break;
+        int64_t v = objIndex(p, eol, at.v);
+        if (v < 0) {
+          chunk->error = "Bad face index";
+          break;
+        }
+        face.push_back(v);
+
+        bool hasUV = false, hasNormal = false;
+        int64_t vt = -1, vn = -1;
+        if (p < eol && *p == '/') {
+          ++p;
+          if (p < eol && *p != '/') {
+            vt = objIndex(p, eol, at.vt);
+            hasUV = true;
+          }
+          if (p < eol && *p == '/') {
+            ++p;
+            vn = objIndex(p, eol, at.vn);
+            hasNormal = true;
+          }
+        }
+        chunk->anyUV |= hasUV;
+        chunk->anyNormal |= hasNormal;
+        chunk->uvsMatch &= hasUV && vt == v;
+        chunk->normalsMatch &= hasNormal && vn == v;
+        if (p < eol && *p != ' ' && *p != '\t' && *p != '\r') {
+          chunk->error = "Bad face";
+          break;
+        }
+      }
+      if (chunk->error.empty() && face.size() < 3) chunk->error = "Bad face";
+      for (size_t k = 2; k < face.size(); ++k) {
+        chunk->indices.push_back(face[0]);
+        chunk->indices.push_back(face[k - 1]);
+        chunk->indices.push_back(face[k]);
+      }
+    }
+    p = eol + 1;
+  }
+  if (!chunk->error.empty()) {
+    chunk->error += " at line " + std::to_string(at.lines);
+  }
+  DCHECK(!chunk->error.empty() || at.v <= total.v);
+}
+
+}  // namespace
+
+shared_ptr<TriangleMesh> LoadPLYMesh(const string& filename) {
+  MappedFile file(filename);
+  if (!file.IsValid()) return nullptr;
+
+  PlyReader reader(file, filename);
+  shared_ptr<TriangleMesh> mesh = reader.Read();
+  if (!mesh) return nullptr;
+
+  for (uint32_t i : mesh->indices) {
+    if (i >= uint32_t(mesh->VertexCount())) {
+      LOG(ERROR) << filename << ": Vertex index " << i << " out of range";
+      return nullptr;
+    }
+  }
+  DVLOG(1) << "Loaded " << filename << ": " << mesh->VertexCount()
+           << " vertices, " << mesh->TriangleCount() << " triangles";
+  return mesh;
+}
+
+shared_ptr<TriangleMesh> LoadOBJMesh(const string& filename) {
+  MappedFile file(filename);
+  if (!file.IsValid()) return nullptr;
+
+  // Chunks of whole lines.
+  std::vector<ObjChunk> chunks;
+  const char* end = file.data + file.size;
+  for (const char* p = file.data; p < end;) {
+    const char* e = p + min(objChunk, size_t(end - p));
+    e = e < end ? endOfLine(e, end) + 1 : end;
+    chunks.emplace_back();
+    chunks.back().begin = p;
+    chunks.back().end = min(e, end);
+    p = chunks.back().end;
+  }
+
+  std::vector<ObjCounts> counts(chunks.size());
+  ParallelFor(
+      [&](int64_t i) { counts[i] = countObj(chunks[i].begin, chunks[i].end); },
+      chunks.size());
+  ObjCounts total;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].first = total;
+    total.lines += counts[i].lines;
+    total.v += counts[i].v;
+    total.vt += counts[i].vt;
+    total.vn += counts[i].vn;
+  }
+  if (total.v > std::numeric_limits<uint32_t>::max()) {
+    LOG(ERROR) << filename << ": Too many vertices";
+    return nullptr;
+  }
+
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  mesh->px.resize(total.v);
+  mesh->py.resize(total.v);
+  mesh->pz.resize(total.v);
+  std::vector<float> objUV(2 * total.vt), objNormal(3 * total.vn);
+  ParallelFor(
+      [&](int64_t i) {
+        parseObjChunk(&chunks[i], total, mesh.get(), &objUV, &objNormal);
+      },
+      chunks.size());
+
+  std::vector<size_t> firstIndex(chunks.size() + 1, 0);
+  bool uvsMatch = true, normalsMatch = true;
+  bool anyUV = false, anyNormal = false;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (!chunks[i].error.empty()) {
+      LOG(ERROR) << filename << ": " << chunks[i].error;
+      return nullptr;
+    }
+    firstIndex[i + 1] = firstIndex[i] + chunks[i].indices.size();
+    uvsMatch &= chunks[i].uvsMatch;
+    normalsMatch &= chunks[i].normalsMatch;
+    anyUV |= chunks[i].anyUV;
+    anyNormal |= chunks[i].anyNormal;
+  }
+  mesh->indices.resize(firstIndex.back());
+  ParallelFor(
+      [&](int64_t i) {
+        std::copy(chunks[i].indices.begin(), chunks[i].indices.end(),
+                  mesh->indices.begin() + firstIndex[i]);
+        std::vector<uint32_t>().swap(chunks[i].indices);
+      },
+      chunks.size());
+
+  // Per vertex attributes, when the indices allow it. Positions beyond the
+  // uvs or normals read can only be matched by corners that had none.
+  if (anyNormal && normalsMatch && total.vn >= total.v) {
+    mesh->nx.resize(total.v);
+    mesh->ny.resize(total.v);
+    mesh->nz.resize(total.v);
+    for (int64_t i = 0; i < total.v; ++i) {
+      mesh->nx[i] = objNormal[3 * i];
+      mesh->ny[i] = objNormal[3 * i + 1];
+      mesh->nz[i] = objNormal[3 * i + 2];
+    }
+  } else if (anyNormal) {
+    LOG(WARNING) << filename
+                 << ": Normals not indexed like positions, ignoring them";
+  }
+  if (anyUV && uvsMatch && total.vt >= total.v) {
+    mesh->tu.resize(total.v);
+    mesh->tv.resize(total.v);
+    for (int64_t i = 0; i < total.v; ++i) {
+      mesh->tu[i] = objUV[2 * i];
+      mesh->tv[i] = objUV[2 * i + 1];
+    }
+  } else if (anyUV) {
+    LOG(WARNING) << filename
+                 << ": Texture coordinates not indexed like positions, "
+                    "ignoring them";
+  }
+
+  DVLOG(1) << "Loaded " << filename << ": " << mesh->VertexCount()
+           << " vertices, " << mesh->TriangleCount() << " triangles in "
+           << chunks.size() << " chunks";
+  return mesh;
+}
+
+}  // namespace skirt
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "core/skirt.h"
+
+#include "shapes/TriangleMesh.h"
+
+namespace skirt {
+
+// Reads a PLY mesh, binary in either byte order or ascii. Faces with more
+// than 3 vertices are split in fans. Returns nullptr, after logging why, when
+// the file can't be read.
+shared_ptr<TriangleMesh> LoadPLYMesh(const string& filename);
+
+// Reads the vertices and faces of a Wavefront OBJ file, all its objects and
+// groups into one mesh. Normals and texture coordinates are kept only when
+// every face corner uses the same index for them as for its position, since
+// the mesh has a single index per corner. Returns nullptr, after logging why,
+// when the file can't be read.
+shared_ptr<TriangleMesh> LoadOBJMesh(const string& filename);
+
+}  // namespace skirt
@@ -23,6 +23,10 @@ void assertMap(const YAML::Node& node) {
   if (!node.IsMap()) error("Not a map", node);
 }
 
+void assertSequence(const YAML::Node& node) {
+  if (!node.IsSequence()) error("Not a sequence", node);
+}
+
 void assertSequence(const YAML::Node& node, size_t size) {
   if (!node.IsSequence() || node.size() != size) error("Not a vector", node);
 }
@@ -63,6 +67,14 @@ int parseInt(const YAML::Node& node) {
   return node.as<int>();
 }
 
+bool parseBool(const YAML::Node& node) {
+  bool ret = false;
+  if (!node.IsScalar() || !YAML::convert<bool>::decode(node, ret)) {
+    error("Not a boolean", node);
+  }
+  return ret;
+}
+
 string parseString(const YAML::Node& node) {
   assertString(node);
   return node.as<string>();
@@ -10,6 +10,7 @@ string lower(const string& orig);
 
 void error(const string error, const YAML::Node& node);
 
+void assertSequence(const YAML::Node& node);
 void assertSequence(const YAML::Node& node, size_t size);
 void assertNumber(const YAML::Node& node);
 void assertString(const YAML::Node& node);
@@ -19,6 +20,7 @@ void assertInt(const YAML::Node& node);
 Vector3 parseVector3(const YAML::Node& node);
 float parseFloat(const YAML::Node& node);
 int parseInt(const YAML::Node& node);
+bool parseBool(const YAML::Node& node);
 string parseString(const YAML::Node& node);
 
 }  // namespace skirt
@@ -0,0 +1,72 @@
+#include "shapes/Box.h"
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+const AABB Box::Bound() const {
+  return box;
+}
+
+optional<Hit> Box::Intersect(const Ray& r) const {
+  float t0 = r.minT, t1 = r.maxT;
+  int axis0 = -1, axis1 = -1;
+  for (int i = 0; i < 3; ++i) {
+    float invD = 1 / r.direction[i];
+    float tNear = (box.minp[i] - r.origin[i]) * invD;
+    float tFar = (box.maxp[i] - r.origin[i]) * invD;
+    if (tNear > tFar) std::swap(tNear, tFar);
+    if (tNear > t0) {
+      t0 = tNear;
+      axis0 = i;
+    }
+    if (tFar < t1) {
+      t1 = tFar;
+      axis1 = i;
+    }
+    if (t0 > t1) return nullopt;
+  }
+
+  // From inside the box the hit is where the ray leaves it.
+  float t = t0;
+  int axis = axis0;
+  float side = -1;
+  if (axis0 < 0) {
+    if (axis1 < 0) return nullopt;
+    t = t1;
+    axis = axis1;
+    side = 1;
+  }
+
+  // Outwards normal of the face that was hit.
+  Vector3 normal(0, 0, 0);
+  normal[axis] = r.direction[axis] > 0 ? side : -side;
+  return Hit(t, r.pointAt(t), normal);
+}
+
+bool Box::IntersectP(const Ray& r) const {
+  float t0 = r.minT, t1 = r.maxT;
+  bool enters = false, leaves = false;
+  for (int i = 0; i < 3; ++i) {
+    float invD = 1 / r.direction[i];
+    float tNear = (box.minp[i] - r.origin[i]) * invD;
+    float tFar = (box.maxp[i] - r.origin[i]) * invD;
+    if (tNear > tFar) std::swap(tNear, tFar);
+    if (tNear > t0) {
+      t0 = tNear;
+      enters = true;
+    }
+    if (tFar < t1) {
+      t1 = tFar;
+      leaves = true;
+    }
+    if (t0 > t1) return false;
+  }
+  return enters || leaves;
+}
+
+float Box::Area() const {
+  return box.SurfaceArea();
+}
+
+}  // namespace skirt
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "core/skirt.h"
+
+#include "core/AABB.h"
+#include "core/Hit.h"
+#include "core/Shape.h"
+
+namespace skirt {
+
+// Axis aligned box, like the walls and blocks of a Cornell box.
+class Box : public Shape {
+ public:
+  Box(const AABB& box) : box(box) {}
+
+  virtual const AABB Bound() const;
+  virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
+
+  virtual float Area() const;
+
+  AABB box;
+};
+
+}  // namespace skirt
@@ -7,8 +7,9 @@
 namespace skirt {
 
 const AABB Sphere::Bound() const {
-  return AABB(Vector3(-radius, -radius, -radius),
-              Vector3(radius, radius, radius));
+  // Intersect() places the sphere at (0, 0, -1).
+  return AABB(Vector3(-radius, -radius, -1 - radius),
+              Vector3(radius, radius, -1 + radius));
 }
 
 optional<Hit> Sphere::Intersect(const Ray& r) const {
@@ -35,6 +36,21 @@ optional<Hit> Sphere::Intersect(const Ray& r) const {
   return nullopt;
 }
 
+bool Sphere::IntersectP(const Ray& r) const {
+  Vector3 ro = r.origin - Vector3(0, 0, -1);
+  float a = Dot(r.direction, r.direction);
+  float b = Dot(ro, r.direction);
+  float c = Dot(ro, ro) - radius * radius;
+  float disc = b * b - a * c;
+  if (disc <= 0) return false;
+
+  // Both roots, scaled by a to leave out the divisions.
+  float q = sqrt(disc);
+  float t0 = -b - q, t1 = -b + q;
+  float minT = r.minT * a, maxT = r.maxT * a;
+  return (t0 > minT && t0 < maxT) || (t1 > minT && t1 < maxT);
+}
+
 float Sphere::Area() const {
   return 4 * PI * radius * radius;
 }
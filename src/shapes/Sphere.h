@@ -13,6 +13,7 @@ class Sphere : public Shape {
 
   virtual const AABB Bound() const;
   virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
 
   virtual float Area() const;
 
@@ -0,0 +1,191 @@
+#include "shapes/TriangleMesh.h"
+
+#include "core/skirt.h"
+
+namespace skirt {
+
+void TriangleMesh::AddVertex(const Vector3& p) {
+  DCHECK(nx.empty() && tu.empty());
+  px.push_back(p.x);
+  py.push_back(p.y);
+  pz.push_back(p.z);
+}
+
+void TriangleMesh::AddVertex(const Vector3& p,
+                             const Vector3& n,
+                             float u,
+                             float v) {
+  DCHECK_EQ(nx.size(), px.size());
+  px.push_back(p.x);
+  py.push_back(p.y);
+  pz.push_back(p.z);
+  nx.push_back(n.x);
+  ny.push_back(n.y);
+  nz.push_back(n.z);
+  tu.push_back(u);
+  tv.push_back(v);
+}
+
+void TriangleMesh::AddTriangle(uint32_t v0, uint32_t v1, uint32_t v2) {
+  DCHECK_LT(max(v0, max(v1, v2)), px.size());
+  indices.push_back(v0);
+  indices.push_back(v1);
+  indices.push_back(v2);
+}
+
+const AABB TriangleMesh::Bound() const {
+  AABB b;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    b = Union(b, Position(indices[i]));
+  }
+  return b;
+}
+
+const AABB TriangleMesh::PrimitiveBound(int i) const {
+  const uint32_t* v = &indices[3 * i];
+  return Union(Union(AABB(Position(v[0])), Position(v[1])), Position(v[2]));
+}
+
+float TriangleMesh::Area() const {
+  float area = 0;
+  for (int i = 0; i < TriangleCount(); ++i) {
+    const uint32_t* v = &indices[3 * i];
+    Vector3 p0 = Position(v[0]);
+    area += 0.5f * Cross(Position(v[1]) - p0, Position(v[2]) - p0).Length();
+  }
+  return area;
+}
+
+bool TriangleMesh::IntersectTriangle(const Ray& r,
+                                     int i,
+                                     float* tHit,
+                                     float b[3]) const {
+  const uint32_t* v = &indices[3 * i];
+
+  // Move the triangle to the ray's space: origin at the ray origin, and
+  // sheared so the ray goes along +z from there. The largest direction
+  // component becomes z, to keep the shear finite.
+  Vector3 p0t = Position(v[0]) - r.origin;
+  Vector3 p1t = Position(v[1]) - r.origin;
+  Vector3 p2t = Position(v[2]) - r.origin;
+  int kz = MaxDimension(Abs(r.direction));
+  int kx = kz + 1 == 3 ? 0 : kz + 1;
+  int ky = kx + 1 == 3 ? 0 : kx + 1;
+  Vector3 d = Permute(r.direction, kx, ky, kz);
+  p0t = Permute(p0t, kx, ky, kz);
+  p1t = Permute(p1t, kx, ky, kz);
+  p2t = Permute(p2t, kx, ky, kz);
+
+  float sx = -d.x / d.z;
+  float sy = -d.y / d.z;
+  float sz = 1 / d.z;
+  p0t.x += sx * p0t.z;
+  p0t.y += sy * p0t.z;
+  p1t.x += sx * p1t.z;
+  p1t.y += sy * p1t.z;
+  p2t.x += sx * p2t.z;
+  p2t.y += sy * p2t.z;
+
+  // Edge functions of the 2D triangle around the origin, redone in double
+  // when one is exactly zero, so a ray through an edge is decided the same
+  // way for both triangles sharing it.
+  float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+  float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+  float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+  if (e0 == 0 || e1 == 0 || e2 == 0) {
+    e0 = double(p1t.x) * p2t.y - double(p1t.y) * p2t.x;
+    e1 = double(p2t.x) * p0t.y - double(p2t.y) * p0t.x;
+    e2 = double(p0t.x) * p1t.y - double(p0t.y) * p1t.x;
+  }
+  if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) {
+    return false;
+  }
+  float det = e0 + e1 + e2;
+  if (det == 0) return false;
+
+  // Distance, still scaled by det, checked against the ray range before
+  // paying for the division.
+  p0t.z *= sz;
+  p1t.z *= sz;
+  p2t.z *= sz;
+  float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+  if (det < 0 && (tScaled >= r.minT * det || tScaled < r.maxT * det)) {
+    return false;
+  }
+  if (det > 0 && (tScaled <= r.minT * det || tScaled > r.maxT * det)) {
+    return false;
+  }
+
+  float invDet = 1 / det;
+  float t = tScaled * invDet;
+
+  // Reject hits whose distance is within its rounding error of 0.
+  float maxZt = MaxComponent(Abs(Vector3(p0t.z, p1t.z, p2t.z)));
+  float deltaZ = gamma(3) * maxZt;
+  float maxXt = MaxComponent(Abs(Vector3(p0t.x, p1t.x, p2t.x)));
+  float maxYt = MaxComponent(Abs(Vector3(p0t.y, p1t.y, p2t.y)));
+  float deltaX = gamma(5) * (maxXt + maxZt);
+  float deltaY = gamma(5) * (maxYt + maxZt);
+  float deltaE =
+      2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+  float maxE = MaxComponent(Abs(Vector3(e0, e1, e2)));
+  float deltaT =
+      3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+      std::abs(invDet);
+  if (t <= deltaT) return false;
+
+  *tHit = t;
+  b[0] = e0 * invDet;
+  b[1] = e1 * invDet;
+  b[2] = e2 * invDet;
+  return true;
+}
+
+optional<Hit> TriangleMesh::IntersectPrimitive(const Ray& r, int i) const {
+  float t, b[3];
+  if (!IntersectTriangle(r, i, &t, b)) return nullopt;
+  return TriangleHit(i, t, b);
+}
+
+Hit TriangleMesh::TriangleHit(int i, float t, const float b[3]) const {
+  // The barycentric point is closer to the surface than r.pointAt(t).
+  const uint32_t* v = &indices[3 * i];
+  Vector3 p0 = Position(v[0]), p1 = Position(v[1]), p2 = Position(v[2]);
+  Vector3 p = b[0] * p0 + b[1] * p1 + b[2] * p2;
+
+  Vector3 normal;
+  if (HasNormals()) {
+    normal = b[0] * Vector3(nx[v[0]], ny[v[0]], nz[v[0]]) +
+             b[1] * Vector3(nx[v[1]], ny[v[1]], nz[v[1]]) +
+             b[2] * Vector3(nx[v[2]], ny[v[2]], nz[v[2]]);
+  }
+  if (normal.LengthSq() == 0) normal = Cross(p1 - p0, p2 - p0);
+  return Hit(t, p, Normalize(normal));
+}
+
+bool TriangleMesh::IntersectPrimitiveP(const Ray& r, int i) const {
+  float t, b[3];
+  return IntersectTriangle(r, i, &t, b);
+}
+
+optional<Hit> TriangleMesh::Intersect(const Ray& r) const {
+  Ray ray(r);
+  optional<Hit> hit;
+  for (int i = 0; i < TriangleCount(); ++i) {
+    optional<Hit> h = IntersectPrimitive(ray, i);
+    if (h) {
+      ray.maxT = h->t;
+      hit = h;
+    }
+  }
+  return hit;
+}
+
+bool TriangleMesh::IntersectP(const Ray& r) const {
+  for (int i = 0; i < TriangleCount(); ++i) {
+    if (IntersectPrimitiveP(r, i)) return true;
+  }
+  return false;
+}
+
+}  // namespace skirt
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/skirt.h"
+
+#include "core/AABB.h"
+#include "core/Hit.h"
+#include "core/Shape.h"
+
+namespace skirt {
+
+/*
+Triangles sharing a vertex buffer. Vertex attributes are kept as structure of
+arrays, one entry per vertex: positions always, normals and uvs either for
+every vertex or not at all. Each triangle is 3 consecutive 32-bit indices into
+them.
+
+Every triangle is a primitive of its own, so accelerators sort triangles into
+their nodes without an Element or a Shape each. The ray/triangle test is the
+watertight one from Woop et al., "Watertight Ray/Triangle Intersection" (JCGT
+2013): rays through an edge or a vertex shared by two triangles always hit at
+least one of them.
+*/
+class TriangleMesh : public Shape {
+ public:
+  TriangleMesh() {}
+
+  INLINE int TriangleCount() const {
+    return indices.size() / 3;
+  }
+  INLINE int VertexCount() const {
+    return px.size();
+  }
+  INLINE Vector3 Position(uint32_t i) const {
+    return Vector3(px[i], py[i], pz[i]);
+  }
+
+  // Appends a vertex, with a normal and uv when the mesh has them.
+  void AddVertex(const Vector3& p);
+  void AddVertex(const Vector3& p, const Vector3& n, float u, float v);
+  bool HasNormals() const {
+    return !nx.empty();
+  }
+  void AddTriangle(uint32_t v0, uint32_t v1, uint32_t v2);
+
+  virtual const AABB Bound() const;
+  virtual optional<Hit> Intersect(const Ray& r) const;
+  virtual bool IntersectP(const Ray& r) const;
+  virtual float Area() const;
+
+  virtual int PrimitiveCount() const {
+    return TriangleCount();
+  }
+  virtual const AABB PrimitiveBound(int i) const;
+  virtual optional<Hit> IntersectPrimitive(const Ray& r, int i) const;
+  virtual bool IntersectPrimitiveP(const Ray& r, int i) const;
+
+  // Watertight test of triangle i, returning the distance and barycentric
+  // coordinates of the hit.
+  bool IntersectTriangle(const Ray& r, int i, float* t, float b[3]) const;
+  // Hit at distance t on triangle i, at barycentric coordinates b.
+  Hit TriangleHit(int i, float t, const float b[3]) const;
+
+  std::vector<float> px, py, pz;
+  std::vector<float> nx, ny, nz;
+  std::vector<float> tu, tv;  // texture coordinates
+  std::vector<uint32_t> indices;
+};
+
+}  // namespace skirt
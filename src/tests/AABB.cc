@@ -54,3 +54,45 @@ TEST(AABB, Union) {
   AABB e = Union(a, d);
   EXPECT_EQ(AABB(Vector3(-15, -10, 5), Vector3(0, 20, 30)), e);
 }
+
+TEST(AABB, IntersectP) {
+  AABB b(Vector3(0, 0, 0), Vector3(1, 1, 1));
+
+  Vector3 x(1, 0, 0);
+  EXPECT_TRUE(b.IntersectP(TraversalRay(Ray(Vector3(-1, .5, .5), x))));
+  EXPECT_FALSE(b.IntersectP(TraversalRay(Ray(Vector3(-1, .5, .5), -x))));
+  EXPECT_FALSE(b.IntersectP(TraversalRay(Ray(Vector3(-1, 2, .5), x))));
+
+  // Origin inside.
+  float t0;
+  Ray inside(Vector3(.5, .5, .5), Vector3(0, 1, 0));
+  EXPECT_TRUE(b.IntersectP(TraversalRay(inside), &t0));
+  EXPECT_EQ(t0, 0);
+
+  // Beyond maxT.
+  Ray shortRay(Vector3(-3, .5, .5), x, 0, 2);
+  EXPECT_FALSE(b.IntersectP(TraversalRay(shortRay)));
+}
+
+TEST(AABB, IntersectPOnSlabPlane) {
+  AABB b(Vector3(0, 0, 0), Vector3(1, 1, 1));
+
+  // The origin lies on the y = 0 and z = 1 planes and the direction has no
+  // y or z component, so those slabs are 0 * inf = NaN.
+  TraversalRay r(Ray(Vector3(-1, 0, 1), Vector3(1, 0, 0)));
+  EXPECT_TRUE(std::isinf(r.invDir.y));
+  EXPECT_TRUE(b.IntersectP(r));
+
+  TraversalRay neg(Ray(Vector3(2, 1, 0), Vector3(-1, -0.f, -0.f)));
+  EXPECT_EQ(neg.dirIsNeg[1], 1);
+  EXPECT_TRUE(b.IntersectP(neg));
+}
+
+RC_GTEST_PROP(AABB, IntersectPTowardsCenter, (Vector3 o)) {
+  AABB b(Vector3(-1, -2, -3), Vector3(4, 5, 6));
+  Vector3 center = 0.5f * b.minp + 0.5f * b.maxp;
+  RC_PRE(o != center);
+  RC_ASSERT(b.IntersectP(TraversalRay(Ray(o, center - o))));
+  RC_ASSERT(!Inside(b, o) ==
+            !b.IntersectP(TraversalRay(Ray(o, o - center))));
+}
@@ -0,0 +1,491 @@
+#include "test.h"
+
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "accelerators/BVH.h"
+#include "accelerators/WideBVH.h"
+#include "core/Parallel.h"
+#include "core/skirt.h"
+#include "shapes/Box.h"
+
+using namespace skirt;
+
+namespace {
+
+std::vector<shared_ptr<Element>> RandomBoxes(int count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> pos(-10, 10);
+  std::uniform_real_distribution<float> size(0.01, 0.5);
+  std::vector<shared_ptr<Element>> elements;
+  for (int i = 0; i < count; ++i) {
+    Vector3 p(pos(rng), pos(rng), pos(rng));
+    Vector3 s(size(rng), size(rng), size(rng));
+    shared_ptr<Shape> shape(new Box(AABB(p, p + s)));
+    elements.emplace_back(new Element(shape));
+  }
+  return elements;
+}
+
+// Moves every box by up to 4 in each direction, as an animation would.
+void MoveBoxes(const std::vector<shared_ptr<Element>>& elements,
+               std::mt19937& rng) {
+  std::uniform_real_distribution<float> move(-4, 4);
+  for (const auto& e : elements) {
+    AABB& box = std::static_pointer_cast<Box>(e->GetSharedShape())->box;
+    Vector3 d(move(rng), move(rng), move(rng));
+    box = AABB(box.minp + d, box.maxp + d);
+  }
+}
+
+// count boxes along the diagonal from 2^first on, each twice as far as the
+// previous one. The surface area of the scene is soon too large for a float,
+// and the SAH only peels off a few boxes at a time.
+std::vector<shared_ptr<Element>> HugeBoxes(int first, int count) {
+  std::vector<shared_ptr<Element>> elements;
+  for (int i = first; i < first + count; ++i) {
+    const float x = std::ldexp(1.0f, i);
+    shared_ptr<Shape> shape(
+        new Box(AABB(Vector3(x, x, x), Vector3(x, x, x) * 1.0001f)));
+    elements.emplace_back(new Element(shape));
+  }
+  return elements;
+}
+
+// A ray down the z axis through the middle of each box in turn.
+std::function<Ray()> RaysThrough(
+    const std::vector<shared_ptr<Element>>& elements) {
+  int i = 0;
+  return [&elements, i]() mutable {
+    const AABB b = elements[i++ % elements.size()]->Bound();
+    const Vector3 c = 0.5f * b.minp + 0.5f * b.maxp;
+    return Ray(Vector3(c.x, c.y, b.maxp.z * 2), Vector3(0, 0, -1));
+  };
+}
+
+// Depth of the deepest leaf, with the root at 0.
+int Depth(const BVH& bvh) {
+  std::vector<int> depth(bvh.nodes.size(), 0);
+  int deepest = 0;
+  for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+    const LinearBVHNode& node = bvh.nodes[i];
+    deepest = max(deepest, depth[i]);
+    if (node.nPrimitives > 0) continue;
+    depth[i + 1] = depth[node.secondChildOffset] = depth[i] + 1;
+  }
+  return deepest;
+}
+
+float InteriorArea(const BVH& bvh) {
+  float area = 0;
+  for (const LinearBVHNode& node : bvh.nodes) {
+    if (node.nPrimitives == 0) area += node.bounds.SurfaceArea();
+  }
+  return area;
+}
+
+Ray RandomRay(std::mt19937& rng) {
+  std::uniform_real_distribution<float> pos(-12, 12);
+  std::uniform_real_distribution<float> dir(-1, 1);
+  Vector3 o(pos(rng), pos(rng), pos(rng));
+  Vector3 d(dir(rng), dir(rng), dir(rng));
+  if (d.LengthSq() == 0) d = Vector3(0, 0, 1);
+  return Ray(o, d);
+}
+
+optional<Hit> BruteForce(const std::vector<shared_ptr<Element>>& elements,
+                         const Ray& r) {
+  Ray ray(r);
+  optional<Hit> hit;
+  for (const auto& e : elements) {
+    optional<Hit> h = e->Intersect(ray);
+    if (h) {
+      ray.maxT = h->t;
+      hit = h;
+    }
+  }
+  return hit;
+}
+
+// BruteForce() over elements, as the reference for ExpectSameHits().
+auto BruteForce(const std::vector<shared_ptr<Element>>& elements) {
+  return [&elements](const Ray& r) { return BruteForce(elements, r); };
+}
+
+}  // namespace
+
+TEST(BVH, Empty) {
+  BVH bvh({});
+  EXPECT_TRUE(bvh.nodes.empty());
+  EXPECT_FALSE(bvh.Intersect(Ray(Vector3(0, 0, 0), Vector3(0, 0, 1))));
+}
+
+class BVHSplitTest : public ::testing::TestWithParam<BVH::SplitMethod> {};
+
+INSTANTIATE_TEST_SUITE_P(BVH,
+                         BVHSplitTest,
+                         ::testing::Values(BVH::SplitMethod::SAH,
+                                           BVH::SplitMethod::LBVH));
+
+TEST_P(BVHSplitTest, Structure) {
+  std::mt19937 rng(7);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(1000, rng);
+  BVH bvh(elements, 4, GetParam());
+
+  ASSERT_EQ(bvh.elements.size(), elements.size());
+  ASSERT_EQ(bvh.primitives.size(), elements.size());
+  EXPECT_EQ(bvh.Bound(), bvh.nodes[0].bounds);
+
+  // Every primitive must be in exactly one leaf, inside that leaf's bounds.
+  std::vector<int> seen(bvh.primitives.size(), 0);
+  for (const LinearBVHNode& node : bvh.nodes) {
+    if (node.nPrimitives == 0) continue;
+    EXPECT_LE(node.nPrimitives, 4);
+    for (int i = 0; i < node.nPrimitives; ++i) {
+      int p = node.primitivesOffset + i;
+      seen[p]++;
+      EXPECT_EQ(Union(node.bounds, bvh.primitives[p].Bound()), node.bounds);
+    }
+  }
+  for (int s : seen) EXPECT_EQ(s, 1);
+}
+
+TEST_P(BVHSplitTest, IntersectMatchesBruteForce) {
+  std::mt19937 rng(42);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+  BVH bvh(elements, 4, GetParam());
+
+  int hits = ExpectSameHits(
+      2000, [&] { return RandomRay(rng); }, BruteForce(elements), bvh);
+  EXPECT_GT(hits, 0);
+}
+
+TEST_P(BVHSplitTest, IntersectPMatchesIntersect) {
+  std::mt19937 rng(13);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+  BVH bvh(elements, 4, GetParam());
+
+  std::uniform_real_distribution<float> maxT(0, 2);
+  for (int i = 0; i < 2000; ++i) {
+    Ray r = RandomRay(rng);
+    if (i % 2) r.maxT = maxT(rng);
+    ASSERT_EQ(bool(bvh.Intersect(r)), bvh.IntersectP(r)) << r;
+  }
+}
+
+TEST_P(BVHSplitTest, CoincidentCentroids) {
+  std::vector<shared_ptr<Element>> elements;
+  for (int i = 0; i < 100; ++i) {
+    shared_ptr<Shape> shape(
+        new Box(AABB(Vector3(-1, -1, -1), Vector3(1, 1, 1))));
+    elements.emplace_back(new Element(shape));
+  }
+  BVH bvh(elements, 4, GetParam());
+  for (const LinearBVHNode& node : bvh.nodes) {
+    EXPECT_LE(node.nPrimitives, 4);
+  }
+  EXPECT_TRUE(bvh.Intersect(Ray(Vector3(0, 0, -5), Vector3(0, 0, 1))));
+}
+
+TEST_P(BVHSplitTest, HugeExtent) {
+  std::vector<shared_ptr<Element>> elements = HugeBoxes(0, 70);
+  BVH bvh(elements, 4, GetParam());
+  std::function<Ray()> rays = RaysThrough(elements);
+  EXPECT_EQ(ExpectSameHits(70, rays, BruteForce(elements), bvh), 70);
+}
+
+TEST_P(BVHSplitTest, DepthLimit) {
+  std::vector<shared_ptr<Element>> elements = HugeBoxes(-100, 220);
+  BVH bvh(elements, 4, GetParam());
+  EXPECT_LE(Depth(bvh), BVH::maxDepth);
+  std::function<Ray()> rays = RaysThrough(elements);
+  EXPECT_EQ(ExpectSameHits(220, rays, BruteForce(elements), bvh), 220);
+}
+
+TEST_P(BVHSplitTest, ParallelBuildMatchesSerial) {
+  std::mt19937 rng(3);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(60000, rng);
+
+  BVH serial(elements, 4, GetParam());
+  ParallelInit(4);
+  BVH parallel(elements, 4, GetParam());
+  ParallelCleanup();
+
+  ASSERT_EQ(serial.nodes.size(), parallel.nodes.size());
+  for (size_t i = 0; i < serial.nodes.size(); ++i) {
+    const LinearBVHNode& a = serial.nodes[i];
+    const LinearBVHNode& b = parallel.nodes[i];
+    ASSERT_EQ(a.bounds, b.bounds) << i;
+    ASSERT_EQ(a.nPrimitives, b.nPrimitives) << i;
+    if (a.nPrimitives) {
+      ASSERT_EQ(a.primitivesOffset, b.primitivesOffset) << i;
+    } else {
+      ASSERT_EQ(a.secondChildOffset, b.secondChildOffset) << i;
+      ASSERT_EQ(a.axis, b.axis) << i;
+    }
+  }
+  EXPECT_EQ(serial.elements, parallel.elements);
+}
+
+TEST_P(BVHSplitTest, IntersectPacketMatchesSingleRays) {
+  std::mt19937 rng(17);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+  BVH bvh(elements, 4, GetParam());
+
+  std::uniform_real_distribution<float> jitter(-0.05, 0.05);
+  int hits = 0;
+  for (int p = 0; p < 300; ++p) {
+    // Coherent packets from one origin, except every third packet which
+    // spreads over every octant, and every fifth which is axis aligned.
+    Ray center = RandomRay(rng);
+    const int count = 1 + p % Accelerator::MaxPacketSize;
+    Ray rays[Accelerator::MaxPacketSize];
+    for (int i = 0; i < count; ++i) {
+      Vector3 d = center.direction;
+      if (p % 3 == 0) {
+        d = RandomRay(rng).direction;
+      } else if (p % 5 == 0) {
+        d = Vector3(0, 0, 1);
+      } else {
+        d += Vector3(jitter(rng), jitter(rng), jitter(rng));
+      }
+      rays[i] = Ray(center.origin, d);
+    }
+
+    optional<Hit> got[Accelerator::MaxPacketSize];
+    bvh.IntersectPacket(rays, count, got);
+    for (int i = 0; i < count; ++i) {
+      optional<Hit> expected = bvh.Intersect(rays[i]);
+      ASSERT_EQ(bool(expected), bool(got[i])) << rays[i];
+      if (expected) {
+        EXPECT_EQ(expected->t, got[i]->t) << rays[i];
+        hits++;
+      }
+    }
+  }
+  EXPECT_GT(hits, 0);
+}
+
+// After the boxes move, a refit tree must hold every primitive and child
+// within its bounds again, and find the same hits as a new tree would.
+TEST_P(BVHSplitTest, Refit) {
+  for (bool rotate : {false, true}) {
+    std::mt19937 rng(21);
+    std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+    BVH bvh(elements, 4, GetParam());
+    const size_t nodeCount = bvh.nodes.size();
+    MoveBoxes(elements, rng);
+    bvh.Refit(rotate);
+
+    ASSERT_EQ(bvh.nodes.size(), nodeCount);
+    std::vector<int> seen(bvh.primitives.size(), 0);
+    for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+      const LinearBVHNode& node = bvh.nodes[i];
+      if (node.nPrimitives == 0) {
+        EXPECT_EQ(Union(bvh.nodes[i + 1].bounds,
+                        bvh.nodes[node.secondChildOffset].bounds),
+                  node.bounds);
+        continue;
+      }
+      for (int j = 0; j < node.nPrimitives; ++j) {
+        int p = node.primitivesOffset + j;
+        seen[p]++;
+        EXPECT_EQ(Union(node.bounds, bvh.primitives[p].Bound()), node.bounds);
+      }
+    }
+    for (int n : seen) ASSERT_EQ(n, 1);
+
+    ExpectSameHits(
+        2000, [&] { return RandomRay(rng); }, BruteForce(elements), bvh);
+  }
+}
+
+// Rotations only take swaps that shrink a node, so the tree of moved boxes
+// must get smaller than refitting alone leaves it.
+TEST_P(BVHSplitTest, RefitRotationsShrinkTree) {
+  std::mt19937 rng(22);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+  BVH bvh(elements, 4, GetParam());
+  MoveBoxes(elements, rng);
+
+  bvh.Refit(false);
+  const float refit = InteriorArea(bvh);
+  bvh.Refit(true);
+  const float rotated = InteriorArea(bvh);
+  EXPECT_LT(rotated, refit);
+  bvh.Refit(true);
+  EXPECT_LE(InteriorArea(bvh), rotated);
+}
+
+// Boxes are clipped by their bounds, and may end up in several leaves.
+TEST(SBVH, MatchesBruteForce) {
+  std::mt19937 rng(26);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(2000, rng);
+  // A few long boxes across the others give spatial splits something to do.
+  for (int i = 0; i < 20; ++i) {
+    Vector3 p(-10, i - 10, i % 7 - 3);
+    shared_ptr<Shape> box(new Box(AABB(p, p + Vector3(20, 0.1, 0.1))));
+    elements.emplace_back(new Element(box));
+  }
+  BVH bvh(elements, 4, BVH::SplitMethod::SBVH, 0.5);
+
+  EXPECT_GT(bvh.primitives.size(), elements.size());
+  EXPECT_LE(bvh.primitives.size(), elements.size() * 3 / 2);
+  std::vector<int> seen(elements.size(), 0);
+  for (const Primitive& p : bvh.primitives) {
+    for (size_t i = 0; i < elements.size(); ++i) {
+      if (elements[i].get() == p.element) seen[i]++;
+    }
+  }
+  for (int n : seen) ASSERT_GE(n, 1);
+
+  ExpectSameHits(
+      2000, [&] { return RandomRay(rng); }, BruteForce(elements), bvh);
+}
+
+TEST(SBVH, HugeExtent) {
+  std::vector<shared_ptr<Element>> elements = HugeBoxes(0, 70);
+  BVH bvh(elements, 4, BVH::SplitMethod::SBVH, 0.5);
+  std::function<Ray()> rays = RaysThrough(elements);
+  EXPECT_EQ(ExpectSameHits(70, rays, BruteForce(elements), bvh), 70);
+}
+
+TEST(SBVH, DepthLimit) {
+  std::vector<shared_ptr<Element>> elements = HugeBoxes(-100, 220);
+  BVH bvh(elements, 4, BVH::SplitMethod::SBVH, 0.5);
+  EXPECT_LE(Depth(bvh), BVH::maxDepth);
+  std::function<Ray()> rays = RaysThrough(elements);
+  EXPECT_EQ(ExpectSameHits(220, rays, BruteForce(elements), bvh), 220);
+}
+
+TEST(SBVH, NoBudgetNoDuplicates) {
+  std::mt19937 rng(27);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(1000, rng);
+  BVH bvh(elements, 4, BVH::SplitMethod::SBVH, 0);
+  EXPECT_EQ(bvh.primitives.size(), elements.size());
+}
+
+template <typename T>
+class WideBVHTest : public ::testing::Test {};
+
+typedef ::testing::Types<BVH4, BVH8> WideBVHTypes;
+TYPED_TEST_SUITE(WideBVHTest, WideBVHTypes);
+
+TYPED_TEST(WideBVHTest, IntersectMatchesBruteForce) {
+  std::mt19937 rng(11);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(3000, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+
+  EXPECT_EQ(wide.Bound(), bvh.Bound());
+  EXPECT_LT(wide.nodes.size(), bvh.nodes.size());
+
+  int hits = ExpectSameHits(
+      2000, [&] { return RandomRay(rng); }, BruteForce(elements), wide);
+  EXPECT_GT(hits, 0);
+}
+
+TYPED_TEST(WideBVHTest, IntersectPMatchesIntersect) {
+  std::mt19937 rng(17);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(3000, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+
+  std::uniform_real_distribution<float> maxT(0, 2);
+  for (int i = 0; i < 2000; ++i) {
+    Ray r = RandomRay(rng);
+    if (i % 2) r.maxT = maxT(rng);
+    ASSERT_EQ(bool(wide.Intersect(r)), wide.IntersectP(r)) << r;
+  }
+}
+
+TYPED_TEST(WideBVHTest, AxisAlignedRays) {
+  std::mt19937 rng(5);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(500, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+
+  std::uniform_real_distribution<float> pos(-10, 10);
+  auto ray = [&] {
+    return Ray(Vector3(pos(rng), pos(rng), -20), Vector3(0, 0, 1));
+  };
+  ExpectSameHits(300, ray, BruteForce(elements), wide);
+}
+
+TYPED_TEST(WideBVHTest, SingleLeaf) {
+  std::mt19937 rng(1);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(1, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+  ASSERT_EQ(wide.nodes.size(), 1u);
+
+  const AABB b = elements[0]->Bound();
+  Vector3 target = 0.5f * b.minp + 0.5f * b.maxp;
+  Vector3 o(0, 0, 20);
+  EXPECT_TRUE(wide.Intersect(Ray(o, target - o)));
+}
+
+TYPED_TEST(WideBVHTest, Refit) {
+  std::mt19937 rng(23);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(3000, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+  MoveBoxes(elements, rng);
+  wide.Refit(true);
+
+  AABB all;
+  for (const auto& e : elements) all = Union(all, e->Bound());
+  EXPECT_EQ(wide.Bound(), all);
+
+  ExpectSameHits(
+      2000, [&] { return RandomRay(rng); }, BruteForce(elements), wide);
+}
+
+// Decoded bounds of every compressed slot contain the exact ones, and the
+// compressed tree finds the same hits.
+TYPED_TEST(WideBVHTest, Compressed) {
+  std::mt19937 rng(29);
+  std::vector<shared_ptr<Element>> elements = RandomBoxes(3000, rng);
+  BVH bvh(elements);
+  TypeParam wide(bvh);
+  TypeParam compressed(bvh, true);
+  ASSERT_TRUE(compressed.IsCompressed());
+  ASSERT_TRUE(compressed.nodes.empty());
+  ASSERT_EQ(compressed.compressedNodes.size(), wide.nodes.size());
+  EXPECT_LT(sizeof(compressed.compressedNodes[0]), sizeof(wide.nodes[0]));
+
+  constexpr int N = sizeof(wide.nodes[0].child) / sizeof(int32_t);
+  for (size_t i = 0; i < wide.nodes.size(); ++i) {
+    const auto& node = wide.nodes[i];
+    const auto& q = compressed.compressedNodes[i];
+    const float* lo[3] = {node.minX, node.minY, node.minZ};
+    const float* hi[3] = {node.maxX, node.maxY, node.maxZ};
+    for (int slot = 0; slot < N; ++slot) {
+      ASSERT_EQ(node.child[slot] >= 0, bool(q.mask & (1 << slot)));
+      if (node.child[slot] < 0) continue;
+      EXPECT_EQ(node.child[slot], q.child[slot]);
+      for (int a = 0; a < 3; ++a) {
+        const float s = std::ldexp(1.0f, q.exponent[a] - 127);
+        EXPECT_LE(q.origin[a] + q.lo[a][slot] * s, lo[a][slot]);
+        EXPECT_GE(q.origin[a] + q.hi[a][slot] * s, hi[a][slot]);
+      }
+    }
+  }
+
+  std::uniform_real_distribution<float> maxT(0, 2);
+  int rays = 0;
+  auto ray = [&] {
+    Ray r = RandomRay(rng);
+    if (rays++ % 4 == 0) r.maxT = maxT(rng);
+    return r;
+  };
+  ExpectSameHits(
+      2000, ray, [&](const Ray& r) { return wide.Intersect(r); }, compressed);
+
+  MoveBoxes(elements, rng);
+  compressed.Refit(false);
+  ASSERT_TRUE(compressed.IsCompressed());
+  ExpectSameHits(
+      2000, [&] { return RandomRay(rng); }, BruteForce(elements), compressed);
+}
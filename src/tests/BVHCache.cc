@@ -0,0 +1,262 @@
+#include "test.h"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+
+#include "accelerators/BVH.h"
+#include "accelerators/BVHCache.h"
+#include "accelerators/WideBVH.h"
+#include "core/Scene.h"
+#include "core/skirt.h"
+#include "shapes/Sphere.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+namespace {
+
+// A soup of small triangles and a few spheres, so the cache holds references
+// to more than one element.
+std::vector<shared_ptr<Element>> Geometry(std::mt19937* rng) {
+  std::uniform_real_distribution<float> pos(-1, 1);
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  for (int i = 0; i < 2000; ++i) {
+    Vector3 c(pos(*rng), pos(*rng), pos(*rng) - 4);
+    for (int k = 0; k < 3; ++k) {
+      mesh->AddVertex(c + Vector3(pos(*rng), pos(*rng), pos(*rng)) * 0.1);
+    }
+    mesh->AddTriangle(3 * i, 3 * i + 1, 3 * i + 2);
+  }
+
+  std::vector<shared_ptr<Element>> elements;
+  shared_ptr<Shape> sphere(new Sphere(0.3));
+  for (int i = 0; i < 5; ++i) {
+    Matrix4 m;
+    m.Translate(2 * i - 4, 2, -2);
+    elements.emplace_back(new Element(sphere, m));
+  }
+  elements.emplace_back(new Element(mesh));
+  return elements;
+}
+
+uint64_t Key(const std::vector<shared_ptr<Element>>& elements) {
+  return BVHCacheKey(elements, 4, BVH::SplitMethod::SAH, 0.3);
+}
+
+Ray RandomRay(std::mt19937* rng) {
+  std::uniform_real_distribution<float> pos(-5, 5);
+  Vector3 o(pos(*rng), pos(*rng), 5);
+  return Ray(o, Vector3(pos(*rng), pos(*rng), -4) - o);
+}
+
+}  // namespace
+
+TEST(BVHCache, Key) {
+  std::mt19937 rng(30);
+  std::vector<shared_ptr<Element>> elements = Geometry(&rng);
+  const uint64_t key = Key(elements);
+  EXPECT_EQ(Key(elements), key);
+
+  EXPECT_NE(BVHCacheKey(elements, 8, BVH::SplitMethod::SAH, 0.3), key);
+  EXPECT_NE(BVHCacheKey(elements, 4, BVH::SplitMethod::LBVH, 0.3), key);
+  // Only spatial splits use the budget.
+  EXPECT_EQ(BVHCacheKey(elements, 4, BVH::SplitMethod::SAH, 1), key);
+  EXPECT_NE(BVHCacheKey(elements, 4, BVH::SplitMethod::SBVH, 1),
+            BVHCacheKey(elements, 4, BVH::SplitMethod::SBVH, 0.3));
+
+  TriangleMesh* mesh =
+      const_cast<TriangleMesh*>(dynamic_cast<const TriangleMesh*>(
+          elements.back()->GetShape()));
+  mesh->px[1234] += 0.01;
+  EXPECT_NE(Key(elements), key);
+  mesh->px[1234] -= 0.01;
+  EXPECT_EQ(Key(elements), key);
+
+  Matrix4 m;
+  m.Translate(0, 0, 1);
+  elements[0]->SetTransform(m);
+  EXPECT_NE(Key(elements), key);
+
+  std::swap(elements[0], elements.back());
+  EXPECT_NE(Key(elements), key);
+}
+
+// A tree read back is the same tree, traversed from the mapped file.
+TEST(BVHCache, RoundTrip) {
+  std::mt19937 rng(31);
+  std::vector<shared_ptr<Element>> elements = Geometry(&rng);
+  const string filename = testing::TempDir() + "roundtrip.bvh";
+  BVH bvh(elements);
+  ASSERT_TRUE(WriteBVHCache(bvh, Key(elements), filename));
+
+  unique_ptr<BVH> cached = ReadBVHCache(elements, Key(elements), filename);
+  ASSERT_TRUE(cached);
+  EXPECT_TRUE(cached->nodes.IsView());
+  EXPECT_EQ(cached->maxPrimsInNode, bvh.maxPrimsInNode);
+  ASSERT_EQ(cached->nodes.size(), bvh.nodes.size());
+  EXPECT_EQ(memcmp(cached->nodes.data(), bvh.nodes.data(),
+                   bvh.nodes.size() * sizeof(LinearBVHNode)),
+            0);
+  ASSERT_EQ(cached->primitives.size(), bvh.primitives.size());
+  for (size_t i = 0; i < bvh.primitives.size(); ++i) {
+    ASSERT_EQ(cached->primitives[i].element, bvh.primitives[i].element);
+    ASSERT_EQ(cached->primitives[i].index, bvh.primitives[i].index);
+  }
+
+  BVH4 wide(*cached);
+  auto ray = [&] { return RandomRay(&rng); };
+  auto reference = [&](const Ray& r) { return bvh.Intersect(r); };
+  ExpectSameHits(1000, ray, reference, *cached);
+  ExpectSameHits(1000, ray, reference, wide);
+}
+
+TEST(BVHCache, Mismatch) {
+  std::mt19937 rng(32);
+  std::vector<shared_ptr<Element>> elements = Geometry(&rng);
+  const string filename = testing::TempDir() + "mismatch.bvh";
+  BVH bvh(elements);
+  ASSERT_TRUE(WriteBVHCache(bvh, Key(elements), filename));
+
+  EXPECT_FALSE(ReadBVHCache(elements, Key(elements) + 1, filename));
+  EXPECT_FALSE(ReadBVHCache(elements, Key(elements),
+                            testing::TempDir() + "missing.bvh"));
+  // References to primitives the elements don't have.
+  std::vector<shared_ptr<Element>> fewer(elements.begin(), elements.end() - 1);
+  EXPECT_FALSE(ReadBVHCache(fewer, Key(elements), filename));
+
+  std::ifstream in(filename, std::ios::binary);
+  string data((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  std::ofstream(filename, std::ios::binary) << data.substr(0, data.size() / 2);
+  EXPECT_FALSE(ReadBVHCache(elements, Key(elements), filename));
+  std::ofstream(filename, std::ios::binary) << data.substr(0, 16);
+  EXPECT_FALSE(ReadBVHCache(elements, Key(elements), filename));
+}
+
+// Nodes are checked before anything traverses them.
+TEST(BVHCache, Corrupt) {
+  std::mt19937 rng(36);
+  std::vector<shared_ptr<Element>> elements = Geometry(&rng);
+  const string filename = testing::TempDir() + "corrupt.bvh";
+  BVH bvh(elements);
+  ASSERT_TRUE(WriteBVHCache(bvh, Key(elements), filename));
+  std::ifstream in(filename, std::ios::binary);
+  const string data((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+
+  // Header fields past the key, as WriteBVHCache lays them out.
+  const size_t splitMethodAt = 32, nodeCountAt = 40, nodesOffsetAt = 48;
+  uint64_t nodesOffset;
+  memcpy(&nodesOffset, data.data() + nodesOffsetAt, sizeof(nodesOffset));
+  const int nodeCount = bvh.nodes.size();
+  ASSERT_GT(nodeCount, 2 * BVH::maxDepth);
+  ASSERT_GT(bvh.nodes[nodeCount - 1].nPrimitives, 0);
+
+  auto read = [&](const std::function<void(char* header,
+                                           LinearBVHNode* nodes)>& edit) {
+    string copy = data;
+    edit(&copy[0], reinterpret_cast<LinearBVHNode*>(&copy[nodesOffset]));
+    std::ofstream(filename, std::ios::binary) << copy;
+    return ReadBVHCache(elements, Key(elements), filename);
+  };
+
+  EXPECT_TRUE(read([](char*, LinearBVHNode*) {}));
+  EXPECT_FALSE(read([&](char* header, LinearBVHNode*) {
+    int32_t splitMethod = 3;
+    memcpy(header + splitMethodAt, &splitMethod, sizeof(splitMethod));
+  }));
+  // So large that multiplying it by the node size wraps around.
+  EXPECT_FALSE(read([&](char* header, LinearBVHNode*) {
+    uint64_t count = (~uint64_t(0)) / sizeof(LinearBVHNode) + 2;
+    memcpy(header + nodeCountAt, &count, sizeof(count));
+  }));
+  EXPECT_FALSE(read([](char*, LinearBVHNode* nodes) { nodes[0].axis = 3; }));
+  EXPECT_FALSE(read([](char*, LinearBVHNode* nodes) {
+    nodes[0].secondChildOffset = 0;
+  }));
+  EXPECT_FALSE(read([&](char*, LinearBVHNode* nodes) {
+    nodes[0].secondChildOffset = nodeCount;
+  }));
+  EXPECT_FALSE(read([&](char*, LinearBVHNode* nodes) {
+    nodes[nodeCount - 1].primitivesOffset = bvh.primitives.size() - 1;
+    nodes[nodeCount - 1].nPrimitives = 2;
+  }));
+  EXPECT_FALSE(read([&](char*, LinearBVHNode* nodes) {
+    nodes[nodeCount - 1].primitivesOffset = -1;
+  }));
+  // A chain of interior nodes deeper than the traversal stack.
+  auto chain = [&](int depth) {
+    return read([&](char*, LinearBVHNode* nodes) {
+      for (int i = 0; i < depth; ++i) {
+        nodes[i].nPrimitives = 0;
+        nodes[i].axis = 0;
+        nodes[i].secondChildOffset = nodeCount - 1;
+      }
+      nodes[depth].nPrimitives = 1;
+      nodes[depth].primitivesOffset = 0;
+    });
+  };
+  EXPECT_TRUE(chain(BVH::maxDepth));
+  EXPECT_FALSE(chain(BVH::maxDepth + 1));
+}
+
+// Refit works on a copy of the nodes, leaving the file as it was.
+TEST(BVHCache, Refit) {
+  std::mt19937 rng(33);
+  std::vector<shared_ptr<Element>> elements = Geometry(&rng);
+  const string filename = testing::TempDir() + "refit.bvh";
+  const uint64_t key = Key(elements);
+  BVH bvh(elements);
+  ASSERT_TRUE(WriteBVHCache(bvh, key, filename));
+
+  unique_ptr<BVH> cached = ReadBVHCache(elements, key, filename);
+  ASSERT_TRUE(cached);
+  Matrix4 m;
+  m.Translate(0, -3, 0);
+  elements[2]->SetTransform(m);
+  cached->Refit(true);
+  EXPECT_FALSE(cached->nodes.IsView());
+  EXPECT_EQ(cached->Bound(), Union(bvh.Bound(), elements[2]->Bound()));
+
+  unique_ptr<BVH> again = ReadBVHCache(elements, key, filename);
+  ASSERT_TRUE(again);
+  EXPECT_EQ(again->Bound(), bvh.Bound());
+}
+
+// The first bake writes a cache file for each accelerator, and the next one
+// maps them instead of building.
+TEST(BVHCache, SceneBake) {
+  const string prefix = testing::TempDir() + "bake";
+  for (const auto& f :
+       std::filesystem::directory_iterator(testing::TempDir())) {
+    if (f.path().filename().string().rfind("bake.", 0) == 0) {
+      std::filesystem::remove(f.path());
+    }
+  }
+  auto bake = [&]() {
+    std::mt19937 rng(34);
+    unique_ptr<Scene> scene(new Scene());
+    scene->desc.reset(new Description());
+    scene->desc->acceleratorCache = prefix;
+    for (const shared_ptr<Element>& e : Geometry(&rng)) scene->AddElement(e);
+    return unique_ptr<const Scene>(scene->Bake(move(scene)));
+  };
+
+  unique_ptr<const Scene> first = bake();
+  const BVH* built = dynamic_cast<const BVH*>(first->accel.get());
+  ASSERT_TRUE(built);
+  EXPECT_FALSE(built->nodes.IsView());
+
+  unique_ptr<const Scene> second = bake();
+  const BVH* mapped = dynamic_cast<const BVH*>(second->accel.get());
+  ASSERT_TRUE(mapped);
+  EXPECT_TRUE(mapped->nodes.IsView());
+  ASSERT_EQ(mapped->nodes.size(), built->nodes.size());
+
+  std::mt19937 rng(35);
+  ExpectSameHits(
+      500, [&] { return RandomRay(&rng); },
+      [&](const Ray& r) { return first->Intersect(r); }, *second);
+}
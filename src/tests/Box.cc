@@ -0,0 +1,41 @@
+#include "test.h"
+
+#include "core/skirt.h"
+#include "shapes/Box.h"
+
+using namespace skirt;
+
+TEST(Box, HitFromOutside) {
+  Box box(AABB(Vector3(-1, -1, -1), Vector3(1, 1, 1)));
+  optional<Hit> hit = box.Intersect(Ray(Vector3(0, 0, -5), Vector3(0, 0, 1)));
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 4);
+  EXPECT_EQ(hit->normal, Vector3(0, 0, -1));
+}
+
+TEST(Box, HitFromInside) {
+  Box box(AABB(Vector3(-1, -1, -1), Vector3(1, 1, 1)));
+  optional<Hit> hit = box.Intersect(Ray(Vector3(0, 0, 0), Vector3(0, 2, 0)));
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 0.5);
+  EXPECT_EQ(hit->normal, Vector3(0, 1, 0));
+}
+
+TEST(Box, Miss) {
+  Box box(AABB(Vector3(-1, -1, -1), Vector3(1, 1, 1)));
+  EXPECT_FALSE(box.Intersect(Ray(Vector3(0, 3, -5), Vector3(0, 0, 1))));
+  EXPECT_FALSE(box.Intersect(Ray(Vector3(0, 0, -5), Vector3(0, 0, -1))));
+  EXPECT_FALSE(
+      box.Intersect(Ray(Vector3(0, 0, -5), Vector3(0, 0, 1), 0, 3.5)));
+}
+
+TEST(Box, IntersectP) {
+  Box box(AABB(Vector3(-1, -1, -1), Vector3(1, 1, 1)));
+  EXPECT_TRUE(box.IntersectP(Ray(Vector3(0, 0, -5), Vector3(0, 0, 1))));
+  EXPECT_TRUE(box.IntersectP(Ray(Vector3(0, 0, 0), Vector3(0, 2, 0))));
+  EXPECT_FALSE(box.IntersectP(Ray(Vector3(0, 3, -5), Vector3(0, 0, 1))));
+  EXPECT_FALSE(
+      box.IntersectP(Ray(Vector3(0, 0, -5), Vector3(0, 0, 1), 0, 3.5)));
+  EXPECT_FALSE(
+      box.IntersectP(Ray(Vector3(0, 0, 0), Vector3(0, 0, 1), 0, 0.5)));
+}
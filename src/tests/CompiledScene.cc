@@ -0,0 +1,250 @@
+#include "test.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+
+#include "core/Matrix4.h"
+#include "core/Scene.h"
+#include "core/skirt.h"
+#include "loader/CompiledScene.h"
+#include "loader/Loader.h"
+#include "shapes/Sphere.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+namespace {
+
+const char* sceneData = R"""(
+LookAt:
+  from: [0, 0, 5]
+  to: [0, 0, 0]
+Camera.perspective:
+  fov: 30
+Accelerator.bvh:
+  maxPrimsInNode: 2
+Film.image:
+  filename: "compiled.pmf"
+  resolution: [64, 48]
+World:
+  - Element:
+    Shape.sphere:
+      radius: 0.5
+  - Element:
+    Transform:
+      translate: [1, 0, 0]
+      rotate: [30, 0, 1, 0]
+    Shape.objmesh: {filename: "compiled.obj"}
+  - Element:
+    Transform:
+      translate: [-1, 0, 0]
+    Shape.objmesh: {filename: "compiled.obj"}
+)""";
+
+void WriteMesh(const string& filename, float size) {
+  std::ofstream(filename) << "v 0 0 0\nv " << size << " 0 0\nv 0 " << size
+                          << " 0\nv 0 0 " << size << "\nf 1 2 3\nf 1 3 4\n";
+}
+
+void ExpectSameScene(const Scene& a, const Scene& b) {
+  EXPECT_EQ(a.desc->lookAtFrom, b.desc->lookAtFrom);
+  EXPECT_EQ(a.desc->cameraType, b.desc->cameraType);
+  EXPECT_EQ(a.desc->cameraFOV, b.desc->cameraFOV);
+  EXPECT_EQ(a.desc->maxPrimsInNode, b.desc->maxPrimsInNode);
+  EXPECT_EQ(a.desc->filmFilename, b.desc->filmFilename);
+  EXPECT_EQ(a.desc->width, b.desc->width);
+  EXPECT_EQ(a.desc->height, b.desc->height);
+
+  ASSERT_EQ(a.elements.size(), b.elements.size());
+  for (size_t i = 0; i < a.elements.size(); ++i) {
+    const Element& x = *a.elements[i];
+    const Element& y = *b.elements[i];
+    EXPECT_EQ(x.Bound(), y.Bound());
+    EXPECT_EQ(x.PrimitiveCount(), y.PrimitiveCount());
+    ASSERT_EQ(x.HasTransform(), y.HasTransform());
+    if (!x.HasTransform()) continue;
+    EXPECT_EQ(memcmp(&x.ObjectToWorld(), &y.ObjectToWorld(), sizeof(Matrix4)),
+              0);
+    EXPECT_EQ(memcmp(&x.WorldToObject(), &y.WorldToObject(), sizeof(Matrix4)),
+              0);
+  }
+}
+
+}  // namespace
+
+// The first load parses the scene and compiles it, the next one reads the
+// compiled copy, and a changed mesh makes it parse again. Without compile
+// there's no copy.
+TEST(CompiledScene, LoadSceneFile) {
+  const string filename = testing::TempDir() + "compiled.scene";
+  const string compiled = filename + ".compiled";
+  std::remove(compiled.c_str());
+  std::ofstream(filename) << sceneData;
+  WriteMesh(testing::TempDir() + "compiled.obj", 1);
+
+  ASSERT_TRUE(LoadSceneFile(filename));
+  EXPECT_FALSE(std::filesystem::exists(compiled));
+
+  unique_ptr<Scene> parsed = LoadSceneFile(filename, true);
+  ASSERT_TRUE(parsed);
+  ASSERT_TRUE(ReadCompiledScene(compiled));
+
+  unique_ptr<Scene> loaded = LoadSceneFile(filename, true);
+  ASSERT_TRUE(loaded);
+  ExpectSameScene(*parsed, *loaded);
+  // Both elements placing the mesh still share it.
+  EXPECT_EQ(loaded->elements[1]->GetShape(), loaded->elements[2]->GetShape());
+  EXPECT_NE(loaded->elements[0]->GetShape(), loaded->elements[1]->GetShape());
+
+  unique_ptr<const Scene> a(parsed->Bake(move(parsed)));
+  unique_ptr<const Scene> b(loaded->Bake(move(loaded)));
+  std::mt19937 rng(40);
+  std::uniform_real_distribution<float> pos(-2, 2);
+  auto ray = [&] {
+    return Ray(Vector3(pos(rng), pos(rng), 5), Vector3(pos(rng), pos(rng), -5));
+  };
+  ExpectSameHits(
+      500, ray, [&](const Ray& r) { return a->Intersect(r); }, *b);
+
+  WriteMesh(testing::TempDir() + "compiled.obj", 10);
+  EXPECT_FALSE(ReadCompiledScene(compiled));
+  unique_ptr<Scene> changed = LoadSceneFile(filename, true);
+  ASSERT_TRUE(changed);
+  EXPECT_EQ(changed->elements[2]->Bound().maxp.y, 10);
+  ASSERT_TRUE(ReadCompiledScene(compiled));
+  EXPECT_EQ(ReadCompiledScene(compiled)->elements[2]->Bound().maxp.y, 10);
+}
+
+TEST(CompiledScene, Description) {
+  Scene scene;
+  scene.desc.reset(new Description());
+  Description& d = *scene.desc;
+  d.lookAtFrom = Vector3(1, 2, 3);
+  d.lookAtTo = Vector3(4, 5, 6);
+  d.cameraType = "perspective";
+  d.cameraFOV = 35;
+  d.cameraAperture = 0.1;
+  d.cameraFocusDistance = 7;
+  d.samplerType = "adaptive";
+  d.pixelSamples = 64;
+  d.errorThreshold = 0.01;
+  d.integratorType = "path";
+  d.tileSize = 32;
+  d.packetSize = 8;
+  d.tileOrder = TileOrder::Spiral;
+  d.passSamples = 4;
+  d.timeBudget = 2.5;
+  d.maxDepth = 9;
+  d.sortRays = true;
+  d.acceleratorType = "bvh";
+  d.maxPrimsInNode = 2;
+  d.acceleratorWidth = 8;
+  d.duplicationBudget = 0.5;
+  d.compressNodes = true;
+  d.acceleratorCache = "cache/scene";
+  d.filmType = "image";
+  d.filmFilename = "out.pmf";
+  d.width = 320;
+  d.height = 200;
+
+  const string filename = testing::TempDir() + "description.compiled";
+  ASSERT_TRUE(WriteCompiledScene(scene, {}, filename));
+  unique_ptr<Scene> loaded = ReadCompiledScene(filename);
+  ASSERT_TRUE(loaded);
+  EXPECT_TRUE(loaded->elements.empty());
+
+  const Description& e = *loaded->desc;
+  EXPECT_EQ(e.lookAtFrom, d.lookAtFrom);
+  EXPECT_EQ(e.lookAtTo, d.lookAtTo);
+  EXPECT_EQ(e.cameraType, d.cameraType);
+  EXPECT_EQ(e.cameraFOV, d.cameraFOV);
+  EXPECT_EQ(e.cameraAperture, d.cameraAperture);
+  EXPECT_EQ(e.cameraFocusDistance, d.cameraFocusDistance);
+  EXPECT_EQ(e.samplerType, d.samplerType);
+  EXPECT_EQ(e.pixelSamples, d.pixelSamples);
+  EXPECT_EQ(e.errorThreshold, d.errorThreshold);
+  EXPECT_EQ(e.integratorType, d.integratorType);
+  EXPECT_EQ(e.tileSize, d.tileSize);
+  EXPECT_EQ(e.packetSize, d.packetSize);
+  EXPECT_EQ(e.tileOrder, d.tileOrder);
+  EXPECT_EQ(e.passSamples, d.passSamples);
+  EXPECT_EQ(e.timeBudget, d.timeBudget);
+  EXPECT_EQ(e.maxDepth, d.maxDepth);
+  EXPECT_EQ(e.sortRays, d.sortRays);
+  EXPECT_EQ(e.acceleratorType, d.acceleratorType);
+  EXPECT_EQ(e.maxPrimsInNode, d.maxPrimsInNode);
+  EXPECT_EQ(e.acceleratorWidth, d.acceleratorWidth);
+  EXPECT_EQ(e.duplicationBudget, d.duplicationBudget);
+  EXPECT_EQ(e.compressNodes, d.compressNodes);
+  EXPECT_EQ(e.acceleratorCache, d.acceleratorCache);
+  EXPECT_EQ(e.filmType, d.filmType);
+  EXPECT_EQ(e.filmFilename, d.filmFilename);
+  EXPECT_EQ(e.width, d.width);
+  EXPECT_EQ(e.height, d.height);
+}
+
+TEST(CompiledScene, Invalid) {
+  Scene scene;
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  for (int i = 0; i < 300; ++i) {
+    mesh->AddVertex(Vector3(i, i % 7, 0));
+    if (i >= 2) mesh->AddTriangle(i - 2, i - 1, i);
+  }
+  Matrix4 m;
+  m.Translate(1, 2, 3);
+  scene.AddElement(shared_ptr<Element>(new Element(mesh, m)));
+  scene.AddElement(shared_ptr<Element>(new Element(mesh)));
+
+  const string filename = testing::TempDir() + "invalid.compiled";
+  ASSERT_TRUE(WriteCompiledScene(scene, {}, filename));
+  ASSERT_TRUE(ReadCompiledScene(filename));
+  EXPECT_FALSE(ReadCompiledScene(testing::TempDir() + "missing.compiled"));
+
+  std::ifstream in(filename, std::ios::binary);
+  string data((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  std::ofstream(filename, std::ios::binary) << data.substr(0, data.size() / 2);
+  EXPECT_FALSE(ReadCompiledScene(filename));
+  std::ofstream(filename, std::ios::binary) << data.substr(0, 16);
+  EXPECT_FALSE(ReadCompiledScene(filename));
+  std::ofstream(filename, std::ios::binary) << string(data.size(), 'x');
+  EXPECT_FALSE(ReadCompiledScene(filename));
+  // Transforms moved off their alignment, as WriteCompiledScene lays out the
+  // header.
+  const size_t transformsOffsetAt = 72;
+  string unaligned = data;
+  uint64_t transformsOffset;
+  memcpy(&transformsOffset, &unaligned[transformsOffsetAt], 8);
+  transformsOffset += 16;
+  memcpy(&unaligned[transformsOffsetAt], &transformsOffset, 8);
+  std::ofstream(filename, std::ios::binary) << unaligned;
+  EXPECT_FALSE(ReadCompiledScene(filename));
+
+  // Meshes that don't hold together.
+  auto badMesh = [&](const std::function<void(TriangleMesh*)>& edit) {
+    shared_ptr<TriangleMesh> bad(new TriangleMesh(*mesh));
+    edit(bad.get());
+    Scene scene;
+    scene.AddElement(shared_ptr<Element>(new Element(bad)));
+    EXPECT_TRUE(WriteCompiledScene(scene, {}, filename));
+    return ReadCompiledScene(filename);
+  };
+  EXPECT_TRUE(badMesh([](TriangleMesh*) {}));
+  EXPECT_FALSE(badMesh([](TriangleMesh* m) { m->indices.back() = 300; }));
+  EXPECT_FALSE(badMesh([](TriangleMesh* m) { m->pz.clear(); }));
+  EXPECT_FALSE(badMesh([](TriangleMesh* m) {
+    m->px.clear();
+    m->py.clear();
+    m->pz.clear();
+  }));
+  EXPECT_FALSE(badMesh([](TriangleMesh* m) { m->nx = m->px; }));
+  EXPECT_FALSE(badMesh([](TriangleMesh* m) { m->tu = m->px; }));
+
+  // Sources that no longer exist.
+  ASSERT_TRUE(WriteCompiledScene(scene, {filename}, filename + ".2"));
+  std::remove(filename.c_str());
+  EXPECT_FALSE(ReadCompiledScene(filename + ".2"));
+}
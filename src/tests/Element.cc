@@ -0,0 +1,64 @@
+#include "test.h"
+
+#include <random>
+
+#include "core/Element.h"
+#include "core/Matrix4.h"
+#include "core/skirt.h"
+#include "shapes/Sphere.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+TEST(Element, TransformedSphere) {
+  Matrix4 m;
+  m.Translate(0, 0, -5).Scale(2, 1, 1);
+  Element e(shared_ptr<Shape>(new Sphere(1)), m);
+  ASSERT_TRUE(e.HasTransform());
+
+  // Spheres are centered at (0, 0, -1) in object space.
+  EXPECT_EQ(e.Bound(), AABB(Vector3(-2, -1, -7), Vector3(2, 1, -5)));
+
+  optional<Hit> hit = e.Intersect(Ray(Vector3(0, 0, 0), Vector3(0, 0, -1)));
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 5);
+  EXPECT_FLOAT_EQ(hit->p.z, -5);
+  EXPECT_NEAR(hit->normal.z, 1, 1e-6);
+
+  // Stretching along x halves the x of normals: the object space hit at
+  // (0.6, 0.3) has normal (0.6, 0.3, z), which becomes (0.3, 0.3, z).
+  const float z = std::sqrt(1 - 0.6f * 0.6f - 0.3f * 0.3f);
+  hit = e.Intersect(Ray(Vector3(1.2, 0.3, 0), Vector3(0, 0, -1)));
+  ASSERT_TRUE(hit);
+  EXPECT_NEAR(hit->p.z, -6 + z, 1e-5);
+  EXPECT_NEAR(Dot(hit->normal, Normalize(Vector3(0.3, 0.3, z))), 1, 1e-5);
+
+  EXPECT_TRUE(e.IntersectP(Ray(Vector3(1.9, 0, 0), Vector3(0, 0, -1))));
+  EXPECT_FALSE(e.IntersectP(Ray(Vector3(0, 1.1, 0), Vector3(0, 0, -1))));
+}
+
+TEST(Element, TransformedMeshPrimitives) {
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  mesh->AddVertex(Vector3(0, 0, 0));
+  mesh->AddVertex(Vector3(1, 0, 0));
+  mesh->AddVertex(Vector3(0, 1, 0));
+  mesh->AddTriangle(0, 1, 2);
+
+  Matrix4 m;
+  m.Translate(10, 0, 0).Rotate(Vector3(0, 0, 1), PI / 2);
+  Element e(mesh, m);
+
+  const AABB b = e.PrimitiveBound(0);
+  EXPECT_NEAR(b.minp.x, 9, 1e-6);
+  EXPECT_NEAR(b.maxp.x, 10, 1e-6);
+  EXPECT_NEAR(b.maxp.y, 1, 1e-6);
+
+  Ray r(Vector3(9.75, 0.5, 1), Vector3(0, 0, -1));
+  optional<Hit> hit = e.IntersectPrimitive(r, 0);
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 1);
+  EXPECT_NEAR(hit->p.x, 9.75, 1e-6);
+  EXPECT_TRUE(e.IntersectPrimitiveP(r, 0));
+  EXPECT_FALSE(
+      e.IntersectPrimitiveP(Ray(Vector3(10.25, 0.5, 1), {0, 0, -1}), 0));
+}
@@ -0,0 +1,84 @@
+#include "test.h"
+
+#include "core/Film.h"
+#include "core/Parallel.h"
+#include "core/skirt.h"
+
+using namespace skirt;
+
+TEST(Film, MergeTile) {
+  Film film(8, 4, "out.exr");
+  FilmTile tile(2, 1, 3, 2, film.width);
+  tile.WritePixel(1, 1, Vector3(1, 2, 3));
+  film.MergeTile(tile);
+  EXPECT_EQ(film.data[3 + 2 * 8], Vector3(1, 2, 3));
+  EXPECT_EQ(film.data[2 + 1 * 8], Vector3(0, 0, 0));
+}
+
+TEST(Film, AccumulateTile) {
+  Film film(4, 4, "out.exr");
+  FilmTile a(0, 0, 2, 2, film.width);
+  a.AddSample(0, 0, Vector3(1, 1, 1));
+  a.AddSample(0, 0, Vector3(3, 3, 3));
+  FilmTile b(0, 0, 2, 2, film.width);
+  b.AddSample(0, 0, Vector3(6, 6, 6), 2);
+  film.AccumulateTile(a);
+  film.AccumulateTile(b);
+  film.Resolve();
+
+  EXPECT_EQ(film.data[0], Vector3(4, 4, 4));
+  // Pixels without samples keep their value.
+  EXPECT_EQ(film.data[1], Vector3(0, 0, 0));
+}
+
+TEST(Film, ConcurrentPasses) {
+  ParallelInit(4);
+  Film film(32, 32, "out.exr");
+  const int passes = 64;
+  ParallelFor(
+      [&](int64_t pass) {
+        FilmTile tile(0, 0, film.width, film.height, film.width);
+        for (int y = 0; y < tile.height; ++y) {
+          for (int x = 0; x < tile.width; ++x) {
+            tile.AddSample(x, y, Vector3(pass % 2, 1, 0));
+          }
+        }
+        film.AccumulateTile(tile);
+      },
+      passes);
+  film.Resolve();
+  ParallelCleanup();
+
+  for (int i = 0; i < film.width * film.height; ++i) {
+    ASSERT_EQ(film.weights[i], passes) << i;
+    ASSERT_EQ(film.data[i], Vector3(0.5, 1, 0)) << i;
+    // Red is 0 in half of the passes and 1 in the others.
+    ASSERT_NEAR(film.RelativeError(i % film.width, i / film.width),
+                std::sqrt(16 / 63.0 / passes) / 0.5, 1e-5)
+        << i;
+  }
+}
+
+TEST(Film, VarianceEstimator) {
+  VarianceEstimator v;
+  for (float x : {1, 4, 2, 8, 5, 7}) v.Add(x);
+  EXPECT_EQ(v.Count(), 6);
+  EXPECT_DOUBLE_EQ(v.Mean(), 4.5);
+  EXPECT_DOUBLE_EQ(v.Variance(), 7.5);
+}
+
+TEST(Film, RelativeError) {
+  Film film(2, 1, "out.exr");
+  FilmTile tile(0, 0, 2, 1, film.width);
+  tile.AddSample(0, 0, Vector3(1, 1, 1));
+  EXPECT_EQ(film.RelativeError(0, 0), Infinity);
+  for (int i = 0; i < 4; ++i) {
+    tile.AddSample(0, 0, Vector3(1, 1, 1));
+    tile.AddSample(1, 0, Vector3(i % 2, i % 2, i % 2));
+  }
+  film.AccumulateTile(tile);
+
+  EXPECT_EQ(film.RelativeError(0, 0), 0);
+  // Values 0, 1, 0, 1: sample variance 1/3, mean 0.5.
+  EXPECT_NEAR(film.RelativeError(1, 0), std::sqrt(1 / 12.0f) / 0.5, 1e-5);
+}
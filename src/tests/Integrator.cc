@@ -0,0 +1,98 @@
+#include "test.h"
+
+#include "core/Integrator.h"
+#include "core/Renderer.h"
+#include "core/Scene.h"
+#include "core/WavefrontIntegrator.h"
+#include "core/skirt.h"
+#include "shapes/Box.h"
+#include "shapes/Sphere.h"
+
+using namespace skirt;
+
+class WavefrontTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    unique_ptr<Scene> s(new Scene());
+    shared_ptr<Shape> sphere(new Sphere(0.5));
+    s->AddElement(shared_ptr<Element>(new Element(sphere)));
+    s->desc.reset(new Description);
+    s->desc->integratorType = "wavefront";
+    scene.reset(s->Bake(move(s)));
+    filmWidth = scene->MakeFilm().width;
+  }
+
+  // Mean radiance of nSamples paths through film pixel (x, y).
+  Vector3 pixel(int maxDepth, int x, int y, int nSamples) {
+    WavefrontIntegrator integrator(scene.get(), maxDepth);
+    FilmTile tile(x, y, 1, 1, filmWidth);
+    integrator.Render(&tile, 0, nSamples);
+    EXPECT_EQ(tile.weights[0], nSamples);
+    return tile.data[0] / tile.weights[0];
+  }
+
+  unique_ptr<const Scene> scene;
+  int filmWidth;
+};
+
+TEST_F(WavefrontTest, Sky) {
+  // Camera rays that miss see the sky, which only depends on their height.
+  Vector3 c = pixel(5, 10, 90, 16);
+  EXPECT_GT(c.z, c.x);
+  EXPECT_NEAR(c.z, 1, 0.01);
+}
+
+TEST_F(WavefrontTest, DirectLight) {
+  // The center of the film sees the front of the sphere, lit by the whole
+  // upper hemisphere around +z. On average over it the sky is the mean of
+  // its top and bottom colors, scaled by the albedo.
+  Vector3 c = pixel(1, 100, 50, 8192);
+  const float albedo = WavefrontIntegrator::albedo;
+  EXPECT_NEAR(c.x, albedo * 0.75, 0.01);
+  EXPECT_NEAR(c.y, albedo * 0.85, 0.01);
+  EXPECT_NEAR(c.z, albedo * 1.0, 0.01);
+}
+
+TEST_F(WavefrontTest, ConvexSceneHasNoIndirectLight) {
+  // Bounce rays leave a lone sphere without hitting anything, and escaped
+  // bounces add nothing, so only the direct light is left.
+  Vector3 direct = pixel(1, 90, 40, 4096);
+  Vector3 all = pixel(5, 90, 40, 4096);
+  for (int c = 0; c < 3; ++c) EXPECT_NEAR(all[c], direct[c], 0.01);
+}
+
+TEST_F(WavefrontTest, Renders) {
+  Film film = scene->MakeFilm();
+  Renderer renderer(scene.get());
+  renderer.pixelSamples = 2;
+  renderer.Render(&film);
+
+  EXPECT_EQ(renderer.stats.samples, 2 * film.width * film.height);
+  EXPECT_GT(renderer.stats.rays, renderer.stats.samples);
+  for (const Vector3& c : film.data) {
+    ASSERT_FALSE(c.HasNaNs());
+    ASSERT_GE(c.x, 0);
+    ASSERT_LE(c.z, 1);
+  }
+}
+
+TEST(Wavefront, SortedRaysGiveTheSameImage) {
+  // A floor and a back wall, so bounce rays go on to hit something.
+  unique_ptr<Scene> s(new Scene());
+  s->AddElement(shared_ptr<Element>(new Element(shared_ptr<Shape>(
+      new Box(AABB(Vector3(-3, -1.1, -4), Vector3(3, -1, 1)))))));
+  s->AddElement(shared_ptr<Element>(new Element(shared_ptr<Shape>(
+      new Box(AABB(Vector3(-3, -1, -4), Vector3(3, 2, -3.9)))))));
+  s->AddElement(shared_ptr<Element>(new Element(shared_ptr<Shape>(
+      new Sphere(0.5)))));
+  unique_ptr<const Scene> scene(s->Bake(move(s)));
+
+  const int filmWidth = scene->MakeFilm().width;
+  FilmTile unsorted(60, 20, 32, 32, filmWidth),
+      sorted(60, 20, 32, 32, filmWidth);
+  WavefrontIntegrator(scene.get(), 4, false).Render(&unsorted, 0, 4);
+  WavefrontIntegrator(scene.get(), 4, true).Render(&sorted, 0, 4);
+  for (size_t i = 0; i < sorted.data.size(); ++i) {
+    ASSERT_EQ(sorted.data[i], unsorted.data[i]) << i;
+  }
+}
@@ -1,7 +1,11 @@
 #include "test.h"
 
+#include <fstream>
+
+#include "core/Matrix4.h"
 #include "core/skirt.h"
 #include "loader/Loader.h"
+#include "shapes/Sphere.h"
 
 using namespace skirt;
 
@@ -41,6 +45,18 @@ Camera.perspective:
   EXPECT_FLOAT_EQ(desc->cameraFocusDistance, 5.196152422706632);
 }
 
+TEST_F(LoaderTest, Sampler) {
+  LoadScene(R"""(
+Sampler.random:
+  pixelsamples: 100
+  errorThreshold: 0.05
+)""");
+
+  EXPECT_EQ(desc->samplerType, "random");
+  EXPECT_EQ(desc->pixelSamples, 100);
+  EXPECT_FLOAT_EQ(desc->errorThreshold, 0.05);
+}
+
 TEST_F(LoaderTest, Integrator) {
   LoadScene(R"""(
 Integrator.sampler:
@@ -49,6 +65,77 @@ Integrator.sampler:
   EXPECT_EQ(desc->integratorType, "sampler");
 }
 
+TEST_F(LoaderTest, IntegratorTileSize) {
+  LoadScene(R"""(
+Integrator.sampler:
+  tileSize: 32
+  tileOrder: spiral
+  passSamples: 4
+  packetSize: 8
+  timeBudget: 30
+)""");
+
+  EXPECT_EQ(desc->tileSize, 32);
+  EXPECT_EQ(desc->tileOrder, TileOrder::Spiral);
+  EXPECT_EQ(desc->passSamples, 4);
+  EXPECT_EQ(desc->packetSize, 8);
+  EXPECT_FLOAT_EQ(desc->timeBudget, 30);
+}
+
+TEST_F(LoaderTest, WavefrontIntegrator) {
+  LoadScene(R"""(
+Integrator.wavefront:
+  maxDepth: 3
+  sortRays: true
+)""");
+
+  EXPECT_EQ(desc->integratorType, "wavefront");
+  EXPECT_EQ(desc->maxDepth, 3);
+  EXPECT_TRUE(desc->sortRays);
+}
+
+TEST_F(LoaderTest, Accelerator) {
+  LoadScene(R"""(
+Accelerator.lbvh:
+  maxPrimsInNode: 8
+  width: 4
+)""");
+
+  EXPECT_EQ(desc->acceleratorType, "lbvh");
+  EXPECT_EQ(desc->maxPrimsInNode, 8);
+  EXPECT_EQ(desc->acceleratorWidth, 4);
+}
+
+TEST_F(LoaderTest, SpatialSplitAccelerator) {
+  LoadScene(R"""(
+Accelerator.sbvh:
+  duplicationBudget: 0.5
+)""");
+
+  EXPECT_EQ(desc->acceleratorType, "sbvh");
+  EXPECT_FLOAT_EQ(desc->duplicationBudget, 0.5);
+}
+
+TEST_F(LoaderTest, CompressedAccelerator) {
+  LoadScene(R"""(
+Accelerator.bvh:
+  width: 8
+  compressed: true
+)""");
+
+  EXPECT_EQ(desc->acceleratorWidth, 8);
+  EXPECT_TRUE(desc->compressNodes);
+}
+
+TEST_F(LoaderTest, AcceleratorCache) {
+  LoadScene(R"""(
+Accelerator.bvh:
+  cache: scene
+)""");
+
+  EXPECT_EQ(desc->acceleratorCache, "scene");
+}
+
 TEST_F(LoaderTest, Film) {
   LoadScene(R"""(
 Film.image:
@@ -61,3 +148,64 @@ Film.image:
   EXPECT_EQ(desc->width, 123);
   EXPECT_EQ(desc->height, 456);
 }
+
+TEST_F(LoaderTest, World) {
+  const string ply = testing::TempDir() + "world.ply";
+  std::ofstream(ply) << R"""(ply
+format ascii 1.0
+element vertex 3
+property float x
+property float y
+property float z
+element face 1
+property list uchar int vertex_indices
+end_header
+0 0 0
+1 0 0
+0 1 0
+3 0 1 2
+)""";
+
+  LoadScene(R"""(
+World:
+  - Element:
+    Material.lambertian: [0.1, 0.2, 0.5]
+    Shape.sphere:
+      radius: 0.5
+  - Element:
+    Shape.plymesh:
+      filename: ")""" + ply + R"""("
+)""");
+
+  ASSERT_EQ(scene->elements.size(), 2u);
+  EXPECT_EQ(scene->elements[0]->Bound(), Sphere(0.5).Bound());
+  EXPECT_EQ(scene->elements[1]->PrimitiveCount(), 1);
+}
+
+TEST_F(LoaderTest, WorldInstances) {
+  const string obj = testing::TempDir() + "instance.obj";
+  std::ofstream(obj) << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+
+  LoadScene(R"""(
+World:
+  - Element:
+    Transform:
+      translate: [1, 2, 3]
+      rotate: [90, 0, 0, 1]
+      scale: 2
+    Shape.objmesh: {filename: ")""" + obj + R"""("}
+  - Element:
+    Shape.objmesh: {filename: ")""" + obj + R"""("}
+    Transform:
+      scale: [1, 1, 3]
+)""");
+
+  ASSERT_EQ(scene->elements.size(), 2u);
+  EXPECT_EQ(scene->elements[0]->GetShape(), scene->elements[1]->GetShape());
+  ASSERT_TRUE(scene->elements[0]->HasTransform());
+
+  const Vector3 p = Transform(scene->elements[0]->ObjectToWorld(), {1, 0, 0});
+  EXPECT_NEAR(p.x, 1, 1e-6);
+  EXPECT_NEAR(p.y, 4, 1e-6);
+  EXPECT_NEAR(p.z, 3, 1e-6);
+}
@@ -0,0 +1,229 @@
+#include "test.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "core/skirt.h"
+#include "loader/MeshLoader.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+namespace {
+
+string WriteFile(const string& name, const string& data) {
+  const string filename = testing::TempDir() + name;
+  std::ofstream(filename, std::ios::binary) << data;
+  return filename;
+}
+
+// Appends v to out with the given byte order.
+template <typename T>
+void Put(string* out, T v, bool bigEndian) {
+  char bytes[sizeof(T)];
+  memcpy(bytes, &v, sizeof(T));
+  const uint16_t one = 1;
+  const bool hostBig = *reinterpret_cast<const char*>(&one) == 0;
+  if (hostBig != bigEndian) std::reverse(bytes, bytes + sizeof(T));
+  out->append(bytes, sizeof(T));
+}
+
+// A unit quad at z = 1 facing +z, with an extra color per vertex and a flag
+// per face that readers must skip.
+string BinaryQuad(bool bigEndian) {
+  string ply = string("ply\nformat ") +
+               (bigEndian ? "binary_big_endian" : "binary_little_endian") +
+               " 1.0\n"
+               "comment unit quad\n"
+               "element vertex 4\n"
+               "property float x\n"
+               "property float y\n"
+               "property float z\n"
+               "property uchar red\n"
+               "property float nx\n"
+               "property float ny\n"
+               "property float nz\n"
+               "element face 1\n"
+               "property list uchar int vertex_indices\n"
+               "property int flags\n"
+               "end_header\n";
+  const float xy[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  for (const auto& v : xy) {
+    Put<float>(&ply, v[0], bigEndian);
+    Put<float>(&ply, v[1], bigEndian);
+    Put<float>(&ply, 1, bigEndian);
+    Put<uint8_t>(&ply, 255, bigEndian);
+    Put<float>(&ply, 0, bigEndian);
+    Put<float>(&ply, 0, bigEndian);
+    Put<float>(&ply, 1, bigEndian);
+  }
+  Put<uint8_t>(&ply, 4, bigEndian);
+  for (int32_t i = 0; i < 4; ++i) Put<int32_t>(&ply, i, bigEndian);
+  Put<int32_t>(&ply, 7, bigEndian);
+  return ply;
+}
+
+void ExpectQuad(const TriangleMesh& mesh) {
+  ASSERT_EQ(mesh.VertexCount(), 4);
+  ASSERT_EQ(mesh.TriangleCount(), 2);
+  EXPECT_EQ(mesh.Position(2), Vector3(1, 1, 1));
+  EXPECT_EQ(mesh.indices, std::vector<uint32_t>({0, 1, 2, 0, 2, 3}));
+
+  optional<Hit> hit = mesh.Intersect(Ray(Vector3(0.75, 0.25, 3), {0, 0, -1}));
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 2);
+}
+
+}  // namespace
+
+TEST(MeshLoader, BinaryPLY) {
+  for (bool bigEndian : {false, true}) {
+    shared_ptr<TriangleMesh> mesh =
+        LoadPLYMesh(WriteFile("quad.ply", BinaryQuad(bigEndian)));
+    ASSERT_TRUE(mesh);
+    ExpectQuad(*mesh);
+    ASSERT_TRUE(mesh->HasNormals());
+    EXPECT_EQ(mesh->nz[3], 1);
+  }
+}
+
+TEST(MeshLoader, AsciiPLY) {
+  shared_ptr<TriangleMesh> mesh = LoadPLYMesh(WriteFile("quad.ply", R"""(ply
+format ascii 1.0
+element vertex 4
+property double x
+property double y
+property double z
+property float u
+property float v
+element edge 1
+property list uchar int vertices
+element face 1
+property list uchar uint vertex_index
+end_header
+0 0 1 0 0
+1.0 0 1e0 1 0
+1 1 1 1 1
+0 1. 1 0 1
+2 0 2
+4 0 1 2 3
+)"""));
+  ASSERT_TRUE(mesh);
+  ExpectQuad(*mesh);
+  EXPECT_FALSE(mesh->HasNormals());
+  EXPECT_EQ(mesh->tv, std::vector<float>({0, 0, 1, 1}));
+}
+
+TEST(MeshLoader, BadPLY) {
+  string ply = BinaryQuad(false);
+  EXPECT_FALSE(
+      LoadPLYMesh(WriteFile("bad.ply", ply.substr(0, ply.size() - 8))));
+
+  ply.replace(ply.size() - 8, 4, "\x09\0\0\0", 4);
+  EXPECT_FALSE(LoadPLYMesh(WriteFile("bad.ply", ply)));
+
+  EXPECT_FALSE(LoadPLYMesh(WriteFile("bad.ply", "solid cube\n")));
+  EXPECT_FALSE(LoadPLYMesh(testing::TempDir() + "missing.ply"));
+}
+
+TEST(MeshLoader, OBJ) {
+  shared_ptr<TriangleMesh> mesh = LoadOBJMesh(WriteFile("quad.obj", R"""(
+# unit quad
+o quad
+v 0 0 1
+v 1 0 1
+  v 1 1 1.0
+v 0 1e0 1
+vn 0 0 1
+vn 0 0 1
+vn 0 0 1
+vn 0 0 1
+g face
+s off
+f 1//1 2//2 -2//-2 -1//-1
+)"""));
+  ASSERT_TRUE(mesh);
+  ExpectQuad(*mesh);
+  EXPECT_TRUE(mesh->HasNormals());
+  EXPECT_TRUE(mesh->tu.empty());
+}
+
+TEST(MeshLoader, OBJMismatchedAttributes) {
+  shared_ptr<TriangleMesh> mesh = LoadOBJMesh(WriteFile("quad.obj", R"""(
+v 0 0 1
+v 1 0 1
+v 1 1 1
+v 0 1 1
+vt 0 0
+vt 1 1
+vn 0 0 1
+f 1/1/1 2/2/1 3/2/1 4/1/1
+)"""));
+  ASSERT_TRUE(mesh);
+  ExpectQuad(*mesh);
+  EXPECT_FALSE(mesh->HasNormals());
+  EXPECT_TRUE(mesh->tu.empty());
+}
+
+TEST(MeshLoader, OBJNumbers) {
+  shared_ptr<TriangleMesh> mesh = LoadOBJMesh(WriteFile("tri.obj", R"""(
+v 1e-3 -2.5E+2 .5
+v 0.1 123456.789 -0.0000001
+v 3.4028234e38 1.17549435e-38 -7
+f 1 2 3
+)"""));
+  ASSERT_TRUE(mesh);
+  EXPECT_EQ(mesh->Position(0), Vector3(1e-3f, -2.5e2f, .5f));
+  EXPECT_EQ(mesh->Position(1), Vector3(0.1f, 123456.789f, -0.0000001f));
+  EXPECT_EQ(mesh->Position(2), Vector3(3.4028234e38f, 1.17549435e-38f, -7));
+}
+
+TEST(MeshLoader, BadOBJ) {
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "v 0 0 0\nf 1 2 3\n")));
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "v 0 0\nf 1 1 1\n")));
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "v 0 0 0\nf 1 -2 1\n")));
+  // Lines with a keyword and nothing else.
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "v 0 0 0\nv 1 0 0\nv ")));
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "v 0 0 0\nvn \nvt 0 0\n")));
+  EXPECT_FALSE(LoadOBJMesh(WriteFile("bad.obj", "vt \nv 0 0 0\n")));
+}
+
+// A grid big enough to be parsed in several chunks, with faces referencing
+// vertices of earlier chunks, half of them by relative index.
+TEST(MeshLoader, OBJChunks) {
+  const int n = 500;
+  std::ostringstream obj;
+  for (int y = 0; y <= n; ++y) {
+    for (int x = 0; x <= n; ++x) obj << "v " << x << " " << y << " 0.5\n";
+  }
+  const int count = (n + 1) * (n + 1);
+  for (int y = 0; y < n; ++y) {
+    for (int x = 0; x < n; ++x) {
+      int v = x + y * (n + 1) + 1;
+      if (y % 2) {
+        obj << "f " << v << " " << v + 1 << " " << v + n + 2 << " "
+            << v + n + 1 << "\n";
+      } else {
+        obj << "f " << v - count - 1 << " " << v - count << " "
+            << v + n + 1 - count << " " << v + n - count << "\n";
+      }
+    }
+  }
+  ASSERT_GT(obj.str().size(), size_t(8 << 20));
+
+  shared_ptr<TriangleMesh> mesh =
+      LoadOBJMesh(WriteFile("grid.obj", obj.str()));
+  ASSERT_TRUE(mesh);
+  ASSERT_EQ(mesh->VertexCount(), count);
+  ASSERT_EQ(mesh->TriangleCount(), 2 * n * n);
+  EXPECT_EQ(mesh->Position(count - 1), Vector3(n, n, 0.5));
+  for (int t = 0; t < mesh->TriangleCount(); t += 2) {
+    const int x = (t / 2) % n, y = (t / 2) / n;
+    const uint32_t v = x + y * (n + 1);
+    ASSERT_EQ(mesh->indices[3 * t], v);
+    ASSERT_EQ(mesh->indices[3 * t + 1], v + 1);
+    ASSERT_EQ(mesh->indices[3 * t + 2], v + n + 2);
+    ASSERT_EQ(mesh->indices[3 * t + 5], v + n + 1);
+  }
+}
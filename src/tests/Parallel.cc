@@ -0,0 +1,91 @@
+#include "test.h"
+
+#include <atomic>
+#include <vector>
+
+#include "core/Parallel.h"
+#include "core/skirt.h"
+
+using namespace skirt;
+
+class ParallelTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    ParallelInit(4);
+  }
+  void TearDown() override {
+    ParallelCleanup();
+  }
+};
+
+TEST_F(ParallelTest, ThreadCount) {
+  EXPECT_EQ(ParallelThreadCount(), 4);
+}
+
+TEST_F(ParallelTest, ParallelForVisitsEveryIndex) {
+  std::vector<std::atomic<int>> visits(10000);
+  ParallelFor([&](int64_t i) { visits[i]++; }, visits.size(), 7);
+  for (const auto& v : visits) EXPECT_EQ(v, 1);
+}
+
+TEST_F(ParallelTest, NestedGroups) {
+  std::atomic<int> count(0);
+  TaskGroup outer;
+  for (int i = 0; i < 8; ++i) {
+    outer.Run([&]() {
+      TaskGroup inner;
+      for (int j = 0; j < 8; ++j) inner.Run([&]() { count++; });
+      inner.Wait();
+    });
+  }
+  outer.Wait();
+  EXPECT_EQ(count, 64);
+}
+
+// Deep fork-join recursion, where most tasks are stolen from another thread's
+// deque or popped back by the thread that forked them.
+static int64_t ForkSum(int64_t start, int64_t end) {
+  if (end - start <= 8) {
+    int64_t sum = 0;
+    for (int64_t i = start; i < end; ++i) sum += i;
+    return sum;
+  }
+  int64_t mid = (start + end) / 2;
+  int64_t left = 0;
+  TaskGroup group;
+  group.Run([&]() { left = ForkSum(start, mid); });
+  int64_t right = ForkSum(mid, end);
+  group.Wait();
+  return left + right;
+}
+
+TEST_F(ParallelTest, RecursiveFork) {
+  EXPECT_EQ(ForkSum(0, 100000), int64_t(100000) * 99999 / 2);
+}
+
+TEST_F(ParallelTest, UnevenTasks) {
+  std::atomic<int64_t> total(0);
+  ParallelFor(
+      [&](int64_t i) {
+        int64_t sum = 0;
+        for (int64_t j = 0; j < (i % 16 == 0 ? 100000 : 10); ++j) sum += j;
+        total += sum;
+      },
+      256);
+  EXPECT_EQ(total, 16 * (int64_t(100000) * 99999 / 2) + 240 * 45);
+}
+
+TEST_F(ParallelTest, AtomicFloatAdd) {
+  AtomicFloat sum;
+  ParallelFor([&](int64_t) { sum.Add(0.5); }, 4096);
+  EXPECT_EQ(float(sum), 2048);
+  sum = 1;
+  EXPECT_EQ(float(sum), 1);
+}
+
+TEST(Parallel, NoPool) {
+  EXPECT_EQ(ParallelThreadCount(), 1);
+  int sum = 0;
+  ParallelFor([&](int64_t i) { sum += i; }, 100);
+  EXPECT_EQ(sum, 4950);
+}
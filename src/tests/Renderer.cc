@@ -0,0 +1,236 @@
+#include "test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "core/Integrator.h"
+#include "core/Parallel.h"
+#include "core/Renderer.h"
+#include "core/Scene.h"
+#include "core/TileOrder.h"
+#include "core/skirt.h"
+#include "shapes/Sphere.h"
+
+using namespace skirt;
+
+class RendererTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    unique_ptr<Scene> s(new Scene());
+    shared_ptr<Shape> sphere(new Sphere(0.5));
+    s->AddElement(shared_ptr<Element>(new Element(sphere)));
+    scene.reset(s->Bake(move(s)));
+  }
+
+  unique_ptr<const Scene> scene;
+};
+
+class TileOrderTest : public ::testing::TestWithParam<TileOrder> {};
+
+INSTANTIATE_TEST_SUITE_P(Renderer,
+                         TileOrderTest,
+                         ::testing::Values(TileOrder::Scanline,
+                                           TileOrder::Spiral,
+                                           TileOrder::Hilbert));
+
+TEST_P(TileOrderTest, VisitsEveryTileOnce) {
+  for (int nx : {1, 2, 5, 13}) {
+    for (int ny : {1, 3, 8, 7}) {
+      std::vector<int> tiles = OrderTiles(nx, ny, GetParam());
+      std::sort(tiles.begin(), tiles.end());
+      ASSERT_EQ(int(tiles.size()), nx * ny);
+      for (int i = 0; i < nx * ny; ++i) ASSERT_EQ(tiles[i], i);
+    }
+  }
+  EXPECT_TRUE(OrderTiles(0, 4, GetParam()).empty());
+}
+
+TEST_P(TileOrderTest, Name) {
+  TileOrder order;
+  ASSERT_TRUE(ParseTileOrder(TileOrderName(GetParam()), &order));
+  EXPECT_EQ(order, GetParam());
+}
+
+TEST(TileOrder, HilbertStepsToNeighbours) {
+  const int n = 16;
+  std::vector<int> tiles = OrderTiles(n, n, TileOrder::Hilbert);
+  for (size_t i = 1; i < tiles.size(); ++i) {
+    int dx = abs(tiles[i] % n - tiles[i - 1] % n);
+    int dy = abs(tiles[i] / n - tiles[i - 1] / n);
+    EXPECT_EQ(dx + dy, 1) << i;
+  }
+}
+
+TEST(TileOrder, SpiralStartsAtCenter) {
+  std::vector<int> tiles = OrderTiles(5, 5, TileOrder::Spiral);
+  EXPECT_EQ(tiles[0], 12);
+  EXPECT_EQ(tiles[1], 13);
+}
+
+TEST(TileOrder, Parse) {
+  TileOrder order;
+  EXPECT_FALSE(ParseTileOrder("zigzag", &order));
+}
+
+TEST_F(RendererTest, TilesMatchSingleTile) {
+  Film expected = scene->MakeFilm();
+  unique_ptr<Integrator> integrator = scene->MakeIntegrator();
+  FilmTile tile(0, 0, expected.width, expected.height, expected.width);
+  integrator->Render(&tile, 0, 1);
+  expected.AccumulateTile(tile);
+  expected.Resolve();
+
+  ParallelInit(4);
+  for (TileOrder order :
+       {TileOrder::Scanline, TileOrder::Spiral, TileOrder::Hilbert}) {
+    Film film = scene->MakeFilm();
+    Renderer renderer(scene.get(), 16, order);
+    renderer.Render(&film);
+
+    EXPECT_EQ(renderer.stats.order, order);
+    EXPECT_EQ(renderer.stats.tiles, 13 * 7);
+    EXPECT_EQ(renderer.stats.samples, film.width * film.height);
+    EXPECT_GE(renderer.stats.MeanTileStep(), 1);
+
+    ASSERT_EQ(film.data.size(), expected.data.size());
+    for (size_t i = 0; i < film.data.size(); ++i) {
+      ASSERT_EQ(film.data[i], expected.data[i]) << i;
+    }
+  }
+  ParallelCleanup();
+}
+
+TEST_F(RendererTest, ProgressivePassesMatchSinglePass) {
+  Film expected = scene->MakeFilm();
+  Renderer single(scene.get());
+  single.pixelSamples = 6;
+  single.Render(&expected);
+  EXPECT_EQ(single.stats.passes, 1);
+
+  Film film = scene->MakeFilm();
+  Renderer progressive(scene.get());
+  progressive.pixelSamples = 6;
+  progressive.passSamples = 4;
+  std::vector<float> weights;
+  progressive.onPass = [&](Film* f, int pass) {
+    EXPECT_EQ(pass, int(weights.size()));
+    weights.push_back(f->weights[0]);
+  };
+  progressive.Render(&film);
+
+  EXPECT_EQ(progressive.stats.passes, 2);
+  EXPECT_EQ(weights, std::vector<float>({4, 6}));
+  EXPECT_EQ(progressive.stats.samples, 6 * film.width * film.height);
+  for (size_t i = 0; i < film.data.size(); ++i) {
+    for (int c = 0; c < 3; ++c) {
+      ASSERT_TRUE(AlmostEqual(film.data[i][c], expected.data[i][c])) << i;
+    }
+  }
+}
+
+TEST_F(RendererTest, AdaptiveSampling) {
+  Film expected = scene->MakeFilm();
+  Renderer uniform(scene.get());
+  uniform.pixelSamples = 64;
+  uniform.Render(&expected);
+
+  Film film = scene->MakeFilm();
+  Renderer adaptive(scene.get());
+  adaptive.pixelSamples = 64;
+  adaptive.passSamples = 4;
+  adaptive.errorThreshold = 0.01;
+  adaptive.Render(&film);
+
+  // Flat sky and sphere pixels converge, the silhouette doesn't.
+  const int64_t pixels = film.width * film.height;
+  EXPECT_GT(adaptive.stats.convergedPixels, pixels / 2);
+  EXPECT_LT(adaptive.stats.convergedPixels, pixels);
+  EXPECT_LT(adaptive.stats.samples, uniform.stats.samples / 2);
+  for (int64_t i = 0; i < pixels; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      ASSERT_NEAR(film.data[i][c], expected.data[i][c], 0.05) << i;
+    }
+  }
+}
+
+TEST_F(RendererTest, AdaptiveSamplingStopsWhenConverged) {
+  Film film = scene->MakeFilm();
+  Renderer adaptive(scene.get());
+  adaptive.pixelSamples = 1000;
+  adaptive.passSamples = 4;
+  adaptive.errorThreshold = 1;
+  adaptive.Render(&film);
+
+  // Pixels are only checked once they have minSamples.
+  EXPECT_EQ(adaptive.stats.passes, 4);
+  EXPECT_EQ(adaptive.stats.convergedPixels, film.width * film.height);
+}
+
+// pixelSamples doesn't cap a budgeted render, which goes on until it runs out
+// of time or, here, converges.
+TEST_F(RendererTest, TimeBudget) {
+  Film film = scene->MakeFilm();
+  Renderer renderer(scene.get());
+  renderer.pixelSamples = 4;
+  renderer.passSamples = 4;
+  renderer.errorThreshold = 1;
+  renderer.timeBudget = 600;
+  int calls = 0;
+  renderer.onPass = [&](Film*, int) { calls++; };
+  renderer.Render(&film);
+
+  EXPECT_EQ(renderer.stats.passes, 4);
+  EXPECT_EQ(calls, renderer.stats.passes);
+  EXPECT_EQ(renderer.stats.SamplesPerPixel(), 16);
+  EXPECT_EQ(renderer.stats.rays, renderer.stats.samples);
+  EXPECT_GT(renderer.stats.RaysPerSecond(), 0);
+}
+
+// A budget spent before the first pass ends still gets all of it, and no
+// pass after it.
+TEST_F(RendererTest, TimeBudgetSpent) {
+  Film film = scene->MakeFilm();
+  Renderer renderer(scene.get());
+  renderer.passSamples = 1;
+  renderer.timeBudget = 1e-9;
+  int calls = 0;
+  renderer.onPass = [&](Film*, int) {
+    calls++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  };
+  auto start = std::chrono::steady_clock::now();
+  renderer.Render(&film);
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  EXPECT_EQ(renderer.stats.passes, 1);
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(renderer.stats.SamplesPerPixel(), 1);
+  for (int i = 0; i < film.width * film.height; ++i) {
+    ASSERT_EQ(film.weights[i], 1) << i;
+  }
+  // Rendering time leaves out onPass.
+  EXPECT_LE(renderer.stats.seconds, seconds - 0.05);
+}
+
+TEST_F(RendererTest, PacketsMatchSingleRays) {
+  std::vector<Film> films;
+  for (int packetSize : {1, 4, 8, 16}) {
+    SamplerIntegrator integrator(scene.get(), packetSize);
+    Film film = scene->MakeFilm();
+    FilmTile tile(0, 0, film.width, film.height, film.width);
+    integrator.Render(&tile, 0, 2);
+    EXPECT_EQ(integrator.rays, 2 * film.width * film.height);
+    film.AccumulateTile(tile);
+    film.Resolve();
+    films.push_back(move(film));
+  }
+  for (size_t f = 1; f < films.size(); ++f) {
+    for (size_t i = 0; i < films[0].data.size(); ++i) {
+      ASSERT_EQ(films[f].data[i], films[0].data[i]) << f << " " << i;
+    }
+  }
+}
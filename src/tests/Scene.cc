@@ -0,0 +1,139 @@
+#include "test.h"
+
+#include <random>
+
+#include "core/Element.h"
+#include "core/Matrix4.h"
+#include "core/Scene.h"
+#include "core/skirt.h"
+#include "shapes/Sphere.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+namespace {
+
+shared_ptr<TriangleMesh> TriangleSoup(int count, std::mt19937* rng) {
+  std::uniform_real_distribution<float> pos(-1, 1);
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  for (int i = 0; i < count; ++i) {
+    Vector3 c(pos(*rng), pos(*rng), pos(*rng));
+    for (int k = 0; k < 3; ++k) {
+      mesh->AddVertex(c + Vector3(pos(*rng), pos(*rng), pos(*rng)) * 0.2);
+    }
+    mesh->AddTriangle(3 * i, 3 * i + 1, 3 * i + 2);
+  }
+  return mesh;
+}
+
+// The mesh with its vertices moved to world space by m.
+shared_ptr<TriangleMesh> Flatten(const TriangleMesh& mesh, const Matrix4& m) {
+  shared_ptr<TriangleMesh> flat(new TriangleMesh());
+  for (int i = 0; i < mesh.VertexCount(); ++i) {
+    flat->AddVertex(Transform(m, mesh.Position(i)));
+  }
+  flat->indices = mesh.indices;
+  return flat;
+}
+
+}  // namespace
+
+class SceneInstancing : public ::testing::TestWithParam<int> {};
+
+// A mesh placed many times through transforms must be hit like copies of it
+// moved to world space, while only the shared mesh holds triangles.
+TEST_P(SceneInstancing, MatchesFlattenedCopies) {
+  std::mt19937 rng(20);
+  shared_ptr<TriangleMesh> mesh = TriangleSoup(300, &rng);
+  std::uniform_real_distribution<float> pos(-8, 8), angle(0, TAU);
+
+  unique_ptr<Scene> instanced(new Scene()), flat(new Scene());
+  instanced->desc.reset(new Description());
+  instanced->desc->acceleratorWidth = GetParam();
+  for (int i = 0; i < 40; ++i) {
+    Matrix4 m;
+    m.Translate(pos(rng), pos(rng), pos(rng) - 20)
+        .Rotate(Vector3(pos(rng), pos(rng), 1), angle(rng))
+        .Scale(1 + i % 3);
+    instanced->AddElement(shared_ptr<Element>(new Element(mesh, m)));
+    flat->AddElement(shared_ptr<Element>(new Element(Flatten(*mesh, m))));
+  }
+  shared_ptr<Shape> sphere(new Sphere(1));
+  instanced->AddElement(shared_ptr<Element>(new Element(sphere)));
+  flat->AddElement(shared_ptr<Element>(new Element(sphere)));
+
+  unique_ptr<const Scene> a(instanced->Bake(move(instanced)));
+  unique_ptr<const Scene> b(flat->Bake(move(flat)));
+  ASSERT_EQ(a->objectAccels.size(), 1u);
+  EXPECT_TRUE(b->objectAccels.empty());
+  for (int i = 0; i < 40; ++i) EXPECT_TRUE(a->elements[i]->IsInstance());
+  EXPECT_FALSE(a->elements[40]->IsInstance());
+
+  int hits = 0;
+  for (int i = 0; i < 4000; ++i) {
+    Vector3 o(pos(rng), pos(rng), 5);
+    Ray r(o, Vector3(pos(rng), pos(rng), -20) - o);
+    optional<Hit> expected = b->Intersect(r);
+    optional<Hit> got = a->Intersect(r);
+    ASSERT_EQ(bool(expected), bool(got)) << r;
+    EXPECT_EQ(bool(expected), a->IntersectP(r)) << r;
+    if (!expected) continue;
+    hits++;
+    EXPECT_NEAR(got->t, expected->t, 1e-4 * expected->t) << r;
+    EXPECT_NEAR(Distance(got->p, expected->p), 0, 1e-3) << r;
+    EXPECT_NEAR(std::abs(Dot(got->normal, expected->normal)), 1, 1e-3) << r;
+  }
+  EXPECT_GT(hits, 400);
+}
+
+// Moved instances, refit, must be hit like a scene built where they moved to.
+TEST_P(SceneInstancing, Refit) {
+  std::mt19937 rng(25);
+  shared_ptr<TriangleMesh> mesh = TriangleSoup(200, &rng);
+  std::uniform_real_distribution<float> pos(-8, 8), angle(0, TAU);
+  auto place = [&]() {
+    Matrix4 m;
+    m.Translate(pos(rng), pos(rng), pos(rng) - 20)
+        .Rotate(Vector3(pos(rng), pos(rng), 1), angle(rng));
+    return m;
+  };
+
+  unique_ptr<Scene> scene(new Scene());
+  scene->desc.reset(new Description());
+  scene->desc->acceleratorWidth = GetParam();
+  for (int i = 0; i < 30; ++i) {
+    scene->AddElement(shared_ptr<Element>(new Element(mesh, place())));
+  }
+  // Not const, as the animation refits it.
+  unique_ptr<Scene> baked(scene->Bake(move(scene)));
+
+  unique_ptr<Scene> flat(new Scene());
+  for (const shared_ptr<Element>& e : baked->elements) {
+    e->SetTransform(place());
+    flat->AddElement(
+        shared_ptr<Element>(new Element(Flatten(*mesh, e->ObjectToWorld()))));
+  }
+  baked->Refit(true);
+  unique_ptr<const Scene> reference(flat->Bake(move(flat)));
+
+  auto ray = [&] {
+    Vector3 o(pos(rng), pos(rng), 5);
+    return Ray(o, Vector3(pos(rng), pos(rng), -20) - o);
+  };
+  // Instances transform rays to object space and back, which the flattened
+  // copies don't, so t only matches to about 1e-4.
+  ExpectSameHits(
+      3000, ray, [&](const Ray& r) { return reference->Intersect(r); },
+      *baked, 800);
+}
+
+INSTANTIATE_TEST_SUITE_P(Widths, SceneInstancing, ::testing::Values(2, 4, 8));
+
+TEST(Scene, SingleMeshStaysFlat) {
+  std::mt19937 rng(3);
+  unique_ptr<Scene> scene(new Scene());
+  scene->AddElement(shared_ptr<Element>(new Element(TriangleSoup(10, &rng))));
+  unique_ptr<const Scene> baked(scene->Bake(move(scene)));
+  EXPECT_TRUE(baked->objectAccels.empty());
+  EXPECT_FALSE(baked->elements[0]->IsInstance());
+}
@@ -0,0 +1,28 @@
+#include "test.h"
+
+#include <random>
+
+#include "core/skirt.h"
+#include "shapes/Sphere.h"
+
+using namespace skirt;
+
+TEST(Sphere, IntersectPMatchesIntersect) {
+  Sphere sphere(0.5);
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> pos(-2, 2), dir(-1, 1), t(0, 4);
+
+  int hits = 0;
+  for (int i = 0; i < 10000; ++i) {
+    // Aim near the sphere, at (0, 0, -1), so many rays hit it, and bound some
+    // of them short of it or start them inside.
+    Vector3 o(pos(rng), pos(rng), pos(rng) - 1);
+    Vector3 d = Vector3(dir(rng), dir(rng), dir(rng) - 1) - o;
+    Ray r(o, d, 0, i % 2 ? t(rng) : Infinity);
+    bool hit = bool(sphere.Intersect(r));
+    ASSERT_EQ(hit, sphere.IntersectP(r)) << r;
+    hits += hit;
+  }
+  EXPECT_GT(hits, 1000);
+  EXPECT_LT(hits, 9000);
+}
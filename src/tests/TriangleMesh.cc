@@ -0,0 +1,258 @@
+#include "test.h"
+
+#include <random>
+
+#include "accelerators/BVH.h"
+#include "accelerators/WideBVH.h"
+#include "core/skirt.h"
+#include "shapes/TriangleMesh.h"
+
+using namespace skirt;
+
+namespace {
+
+// n x n unit quads on the z = 0 plane, from (0, 0) to (n, n), two triangles
+// each.
+shared_ptr<TriangleMesh> Grid(int n) {
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  for (int y = 0; y <= n; ++y) {
+    for (int x = 0; x <= n; ++x) mesh->AddVertex(Vector3(x, y, 0));
+  }
+  for (int y = 0; y < n; ++y) {
+    for (int x = 0; x < n; ++x) {
+      uint32_t v = x + y * (n + 1);
+      mesh->AddTriangle(v, v + 1, v + n + 2);
+      mesh->AddTriangle(v, v + n + 2, v + n + 1);
+    }
+  }
+  return mesh;
+}
+
+}  // namespace
+
+TEST(TriangleMesh, Triangle) {
+  TriangleMesh mesh;
+  mesh.AddVertex(Vector3(0, 0, -2));
+  mesh.AddVertex(Vector3(2, 0, -2));
+  mesh.AddVertex(Vector3(0, 2, -2));
+  mesh.AddTriangle(0, 1, 2);
+
+  EXPECT_EQ(mesh.Bound(), AABB(Vector3(0, 0, -2), Vector3(2, 2, -2)));
+  EXPECT_FLOAT_EQ(mesh.Area(), 2);
+
+  Ray r(Vector3(0.5, 0.5, 0), Vector3(0, 0, -1));
+  optional<Hit> hit = mesh.Intersect(r);
+  ASSERT_TRUE(hit);
+  EXPECT_FLOAT_EQ(hit->t, 2);
+  EXPECT_EQ(hit->p, Vector3(0.5, 0.5, -2));
+  EXPECT_EQ(hit->normal, Vector3(0, 0, 1));
+  EXPECT_TRUE(mesh.IntersectP(r));
+
+  EXPECT_FALSE(mesh.Intersect(Ray(Vector3(1.5, 1.5, 0), Vector3(0, 0, -1))));
+  EXPECT_FALSE(mesh.Intersect(Ray(Vector3(0.5, 0.5, 0), Vector3(0, 0, 1))));
+  EXPECT_FALSE(
+      mesh.IntersectP(Ray(Vector3(0.5, 0.5, 0), Vector3(0, 0, -1), 0, 1.5)));
+}
+
+TEST(TriangleMesh, InterpolatedNormal) {
+  TriangleMesh mesh;
+  mesh.AddVertex(Vector3(0, 0, 0), Vector3(1, 0, 1), 0, 0);
+  mesh.AddVertex(Vector3(1, 0, 0), Vector3(1, 0, 1), 1, 0);
+  mesh.AddVertex(Vector3(0, 1, 0), Vector3(-1, 0, 1), 0, 1);
+  mesh.AddTriangle(0, 1, 2);
+
+  optional<Hit> hit =
+      mesh.Intersect(Ray(Vector3(0.25, 0.5, 1), Vector3(0, 0, -1)));
+  ASSERT_TRUE(hit);
+  EXPECT_NEAR(hit->normal.x, 0, 1e-6);
+  EXPECT_NEAR(hit->normal.z, 1, 1e-6);
+}
+
+// Rays through the vertices and edges shared by the grid's triangles must
+// hit one of them. Vertices and edges on the border of the grid aren't
+// shared, so rays through them may miss.
+TEST(TriangleMesh, Watertight) {
+  const int n = 8;
+  shared_ptr<TriangleMesh> mesh = Grid(n);
+  std::mt19937 rng(9);
+  std::uniform_real_distribution<float> pos(-20, 20), cell(0, n);
+  std::uniform_int_distribution<int> vertex(1, n - 1);
+
+  for (int i = 0; i < 20000; ++i) {
+    Vector3 target;
+    switch (i % 3) {
+      case 0:  // vertex
+        target = Vector3(vertex(rng), vertex(rng), 0);
+        break;
+      case 1:  // vertical or horizontal edge
+        target = Vector3(vertex(rng), cell(rng), 0);
+        if (i % 2) std::swap(target.x, target.y);
+        break;
+      default:  // diagonal edge
+        target.x = target.y = cell(rng);
+    }
+    Vector3 o(pos(rng), pos(rng), 1 + std::abs(pos(rng)));
+    Ray r(o, target - o);
+    ASSERT_TRUE(mesh->IntersectP(r)) << r << " to " << target;
+  }
+}
+
+TEST(TriangleMesh, BVHReferencesTriangles) {
+  shared_ptr<TriangleMesh> mesh = Grid(16);
+  std::vector<shared_ptr<Element>> elements = {
+      shared_ptr<Element>(new Element(mesh))};
+  BVH bvh(elements);
+
+  ASSERT_EQ(bvh.elements.size(), 1u);
+  ASSERT_EQ(bvh.primitives.size(), size_t(mesh->TriangleCount()));
+  EXPECT_EQ(bvh.Bound(), mesh->Bound());
+  EXPECT_GT(bvh.nodes.size(), 1u);
+
+  std::mt19937 rng(4);
+  std::uniform_real_distribution<float> pos(-4, 20);
+  auto ray = [&] {
+    Vector3 o(pos(rng), pos(rng), 5);
+    return Ray(o, Vector3(pos(rng), pos(rng), 0) - o);
+  };
+  int hits = ExpectSameHits(
+      2000, ray, [&](const Ray& r) { return mesh->Intersect(r); }, bvh);
+  EXPECT_GT(hits, 0);
+}
+
+template <typename T>
+class TrianglePackTest : public ::testing::Test {};
+
+typedef ::testing::Types<BVH4, BVH8> WideBVHTypes;
+TYPED_TEST_SUITE(TrianglePackTest, WideBVHTypes);
+
+TYPED_TEST(TrianglePackTest, MatchesMesh) {
+  shared_ptr<TriangleMesh> mesh = Grid(16);
+  // Lift the vertices off the plane so rays come from every side.
+  std::mt19937 rng(6);
+  std::uniform_real_distribution<float> bump(-1, 1);
+  for (float& z : mesh->pz) z = bump(rng);
+
+  BVH bvh({shared_ptr<Element>(new Element(mesh))});
+  TypeParam wide(bvh);
+  TypeParam compressed(bvh, true);
+  ASSERT_FALSE(wide.packs.empty());
+
+  std::uniform_real_distribution<float> pos(-4, 20);
+  int hits = 0;
+  for (int i = 0; i < 5000; ++i) {
+    Vector3 o(pos(rng), pos(rng), i % 2 ? 5 : -5);
+    Ray r(o, Vector3(pos(rng), pos(rng), 0) - o);
+    if (i % 3 == 0) r.maxT = 0.8;
+    optional<Hit> expected = mesh->Intersect(r);
+    optional<Hit> got = wide.Intersect(r);
+    ASSERT_EQ(bool(expected), bool(got)) << r;
+    EXPECT_EQ(bool(expected), wide.IntersectP(r)) << r;
+    EXPECT_EQ(bool(expected), compressed.IntersectP(r)) << r;
+    if (expected) {
+      optional<Hit> quantized = compressed.Intersect(r);
+      ASSERT_TRUE(quantized) << r;
+      EXPECT_EQ(got->t, quantized->t) << r;
+      EXPECT_FLOAT_EQ(expected->t, got->t) << r;
+      EXPECT_NEAR(Dot(expected->normal, got->normal), 1, 1e-5) << r;
+      hits++;
+    }
+  }
+  EXPECT_GT(hits, 0);
+}
+
+TYPED_TEST(TrianglePackTest, Watertight) {
+  const int n = 8;
+  BVH bvh({shared_ptr<Element>(new Element(Grid(n)))});
+  TypeParam wide(bvh);
+
+  std::mt19937 rng(10);
+  std::uniform_real_distribution<float> pos(-20, 20), cell(0, n);
+  std::uniform_int_distribution<int> vertex(1, n - 1);
+  for (int i = 0; i < 20000; ++i) {
+    Vector3 target(vertex(rng), vertex(rng), 0);
+    if (i % 2) target.y = cell(rng);
+    Vector3 o(pos(rng), pos(rng), 1 + std::abs(pos(rng)));
+    Ray r(o, target - o);
+    ASSERT_TRUE(wide.IntersectP(r)) << r << " to " << target;
+    ASSERT_TRUE(wide.Intersect(r)) << r << " to " << target;
+  }
+}
+
+// Packs hold copies of the vertices, which a refit must take again from a
+// deformed mesh.
+TYPED_TEST(TrianglePackTest, Refit) {
+  shared_ptr<TriangleMesh> mesh = Grid(16);
+  BVH bvh({shared_ptr<Element>(new Element(mesh))});
+  TypeParam wide(bvh);
+  ASSERT_FALSE(wide.packs.empty());
+
+  for (int i = 0; i < mesh->VertexCount(); ++i) {
+    mesh->pz[i] = std::sin(mesh->px[i]) + std::cos(mesh->py[i] * 0.5f);
+  }
+  wide.Refit(false);
+  EXPECT_EQ(wide.Bound(), mesh->Bound());
+
+  std::mt19937 rng(24);
+  std::uniform_real_distribution<float> pos(-4, 20);
+  int rays = 0;
+  auto ray = [&] {
+    Vector3 o(pos(rng), pos(rng), rays++ % 2 ? 5 : -5);
+    return Ray(o, Vector3(pos(rng), pos(rng), 0) - o);
+  };
+  ExpectSameHits(
+      3000, ray, [&](const Ray& r) { return mesh->Intersect(r); }, wide, 4);
+}
+
+namespace {
+
+// count strips 20 long, each made of two triangles, side by side in the plane
+// x = y, the kind of mesh object splits can't separate.
+shared_ptr<TriangleMesh> DiagonalStrips(int count) {
+  shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  const float d = 10 * sqrt(0.5f);
+  for (int i = 0; i <= count; ++i) {
+    const float z = -10 + 20.0f * i / count;
+    mesh->AddVertex(Vector3(-d, -d, z));
+    mesh->AddVertex(Vector3(d, d, z));
+  }
+  for (int i = 0; i < count; ++i) {
+    mesh->AddTriangle(2 * i, 2 * i + 1, 2 * i + 3);
+    mesh->AddTriangle(2 * i, 2 * i + 3, 2 * i + 2);
+  }
+  return mesh;
+}
+
+// Expected cost of tracing a ray through the tree, as the SAH counts it.
+float SAHCost(const BVH& bvh) {
+  float cost = 0;
+  for (const LinearBVHNode& node : bvh.nodes) {
+    float area = node.bounds.SurfaceArea();
+    cost += node.nPrimitives ? area * node.nPrimitives : area;
+  }
+  return cost / bvh.Bound().SurfaceArea();
+}
+
+}  // namespace
+
+TEST(TriangleMesh, SpatialSplits) {
+  shared_ptr<TriangleMesh> mesh = DiagonalStrips(500);
+  std::vector<shared_ptr<Element>> elements = {
+      shared_ptr<Element>(new Element(mesh))};
+  BVH sah(elements);
+  BVH sbvh(elements, 4, BVH::SplitMethod::SBVH, 1);
+
+  EXPECT_GT(sbvh.primitives.size(), sah.primitives.size());
+  EXPECT_LE(sbvh.primitives.size(), 2 * sah.primitives.size());
+  EXPECT_LT(SAHCost(sbvh), 0.6 * SAHCost(sah));
+
+  BVH4 wide(sbvh);
+  std::mt19937 rng(28);
+  std::uniform_real_distribution<float> pos(-12, 12);
+  auto ray = [&] {
+    Vector3 o(20, pos(rng), pos(rng));
+    return Ray(o, Vector3(-20, pos(rng), pos(rng)) - o);
+  };
+  auto reference = [&](const Ray& r) { return mesh->Intersect(r); };
+  ExpectSameHits(3000, ray, reference, sbvh, 4);
+  ExpectSameHits(3000, ray, reference, wide, 4);
+}
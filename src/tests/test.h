@@ -4,6 +4,8 @@
 #include <rapidcheck.h>
 #include <rapidcheck/gtest.h>
 
+#include "core/Hit.h"
+#include "core/Ray.h"
 #include "core/Vector3.h"
 
 using namespace skirt;
@@ -30,4 +32,32 @@ INLINE bool AlmostEqual(float A, float B, int maxULPDiff = 5) {
   return ULPDiff <= maxULPDiff;
 }
 
+// Shoots count rays made by makeRay() at accel, and expects them to hit
+// where reference(ray) says, at a t at most maxULPDiff away, and IntersectP()
+// to agree. Stops at the first ray that hits one and not the other. Returns
+// the number of rays that hit.
+template <typename MakeRay, typename Reference, typename Accel>
+int ExpectSameHits(int count,
+                   const MakeRay& makeRay,
+                   const Reference& reference,
+                   const Accel& accel,
+                   int maxULPDiff = 0) {
+  int hits = 0;
+  for (int i = 0; i < count; ++i) {
+    Ray r = makeRay();
+    optional<Hit> expected = reference(r);
+    optional<Hit> got = accel.Intersect(r);
+    if (bool(expected) != bool(got)) {
+      ADD_FAILURE() << (expected ? "Missed " : "Unexpected hit of ") << r;
+      return hits;
+    }
+    EXPECT_EQ(bool(expected), accel.IntersectP(r)) << r;
+    if (expected) {
+      EXPECT_PRED3(AlmostEqual, expected->t, got->t, maxULPDiff) << r;
+      hits++;
+    }
+  }
+  return hits;
+}
+
 }  // namespace skirt